@@ -1,5 +1,8 @@
 #include "package.h"
+#include "image.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
 #include <assert.h>
 
@@ -18,12 +21,65 @@ int conf_i18n = 1;
 
 int main(int argc, char *argv[])
 {
+	int i;
+
+	/* Parse options. */
+	for (i = 1; argv != NULL && i < argc; i++) {
+		if (strcmp(argv[i], "-s") == 0) {
+			/* Store all files without compression. */
+			package_compress = false;
+		} else if (strcmp(argv[i], "-i") == 0) {
+			/* Reuse unchanged files in the existing package. */
+			package_incremental = true;
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			/* Convert PNG files to raw images. */
+			package_raw_image = true;
+			i++;
+			if (strcmp(argv[i], "argb") == 0) {
+				package_raw_order = RAW_IMAGE_ARGB;
+			} else if (strcmp(argv[i], "abgr") == 0) {
+				package_raw_order = RAW_IMAGE_ABGR;
+			} else {
+				printf("Pixel order must be argb or abgr.\n");
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			/* Set the number of worker threads. */
+			package_jobs = atoi(argv[++i]);
+		} else {
+			printf("Usage: pack [-s] [-i] [-r order] [-j jobs]\n");
+			printf("  -s       store files without compression\n");
+			printf("  -i       reuse unchanged files in data01.arc\n");
+			printf("  -r argb  convert PNG files to raw images for "
+			       "Windows and Linux without OpenGL\n");
+			printf("  -r abgr  convert PNG files to raw images for "
+			       "OpenGL, Mac, iOS and Web\n");
+			printf("  -j jobs  number of threads (default: CPUs)\n");
+			return 1;
+		}
+	}
+
 	/* Create a package. */
 	if (!create_package(".")) {
 		printf("Failed.\n");
 		return 1;
 	}
 
+	printf("%llu files (%llu compressed, %llu reused, %llu kept in place), "
+	       "%llu bytes stored for %llu bytes.\n",
+	       (unsigned long long)package_stats.file_count,
+	       (unsigned long long)package_stats.compressed_count,
+	       (unsigned long long)package_stats.reused_count,
+	       (unsigned long long)package_stats.kept_count,
+	       (unsigned long long)package_stats.stored_size,
+	       (unsigned long long)package_stats.total_size);
+	if (package_raw_image) {
+		printf("%llu images converted to raw pixels.\n",
+		       (unsigned long long)package_stats.raw_image_count);
+	}
+	printf("%llu duplicated files share bodies, %llu bytes saved.\n",
+	       (unsigned long long)package_stats.dedup_count,
+	       (unsigned long long)package_stats.dedup_size);
 	printf("Suceeded.\n");
 	return 0;
 }
@@ -60,12 +60,28 @@ static bool init(void)
 {
 	static struct image *img, *rule_img;
 	const char *fname, *method;
+	bool is_immediate;
 
 	/* パラメータを取得する */
 	fname = get_string_param(BG_PARAM_FILE);
 	span = get_float_param(BG_PARAM_SPAN);
 	method = get_string_param(BG_PARAM_METHOD);
 
+	/* フェードしない場合か、キーが押されている場合 */
+	is_immediate = (span == 0)
+		||
+		(!is_non_interruptible() &&
+		 ((!is_auto_mode() && is_control_pressed) || is_skip_mode()));
+
+	/*
+	 * フェードする場合は、イメージを読み込む前にフェード用のレイヤを
+	 * 用意する
+	 */
+	if (!is_immediate && !prepare_fade_layer_images()) {
+		log_script_exec_footer();
+		return false;
+	}
+
  	/* 描画メソッドを識別する */
 	fade_method = get_fade_method(method);
 	if (fade_method == FADE_METHOD_INVALID) {
@@ -118,11 +134,7 @@ static bool init(void)
 	set_ch_file_name(CH_LEFT, NULL);
 	set_ch_file_name(CH_CENTER, NULL);
 
-	/* フェードしない場合か、キーが押されている場合 */
-	if ((span == 0) 
-	    ||
-	    (!is_non_interruptible() &&
-	     ((!is_auto_mode() && is_control_pressed) || is_skip_mode()))) {
+	if (is_immediate) {
 		/* フェードせず、すぐに切り替える */
 		change_bg_immediately(img);
 		change_ch_immediately(CH_BACK, NULL, 0, 0, 0);
@@ -59,6 +59,7 @@ static bool init(void)
 	const char *method;
 	const char *alpha_s;
 	int xpos, ypos, chpos, ofs_x, ofs_y, alpha;
+	bool is_immediate;
 
 	/* パラメータを取得する */
 	pos = get_string_param(CH_PARAM_POS);
@@ -69,6 +70,23 @@ static bool init(void)
 	ofs_y = get_int_param(CH_PARAM_OFFSET_Y);
 	alpha_s = get_string_param(CH_PARAM_ALPHA);
 
+	/* Controlが押されているか、フェードしない場合 */
+	is_immediate = (span == 0)
+		||
+		(!is_non_interruptible() && is_skip_mode())
+		||
+		(!is_non_interruptible() && !is_auto_mode() &&
+		 is_control_pressed);
+
+	/*
+	 * フェードする場合は、イメージを読み込む前にフェード用のレイヤを
+	 * 用意する
+	 */
+	if (!is_immediate && !prepare_fade_layer_images()) {
+		log_script_exec_footer();
+		return false;
+	}
+
 	/* イメージが指定された場合 */
 	if (strcmp(fname, "none") != 0 &&
 	    strcmp(fname, U8("消去")) != 0) {
@@ -126,13 +144,7 @@ static bool init(void)
 			      fname))
 	    return false;
 
-	/* Controlが押されているか、フェードしない場合 */
-	if ((span == 0)
-	    ||
-	    (!is_non_interruptible() && is_skip_mode())
-	    ||
-	    (!is_non_interruptible() && !is_auto_mode() &&
-	     is_control_pressed)) {
+	if (is_immediate) {
 		/* フェードせず、すぐに切り替える */
 		change_ch_immediately(chpos, img, xpos, ypos, alpha);
 	} else {
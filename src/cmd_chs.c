@@ -62,6 +62,7 @@ static bool init(void)
 	int y[PARAM_SIZE];
 	const char *method;
 	int i;
+	bool is_immediate;
 
 	/* パラメータを取得する */
 	fname[CH_CENTER] = get_string_param(CHS_PARAM_CENTER);
@@ -72,6 +73,23 @@ static bool init(void)
 	span = get_float_param(CHS_PARAM_SPAN);
 	method = get_string_param(CHS_PARAM_METHOD);
 
+	/* キーが押されているか、フェードしない場合 */
+	is_immediate = (span == 0)
+		||
+		(!is_non_interruptible() && is_skip_mode())
+		||
+		(!is_non_interruptible() && !is_auto_mode() &&
+		 is_control_pressed);
+
+	/*
+	 * フェードする場合は、イメージを読み込む前にフェード用のレイヤを
+	 * 用意する
+	 */
+	if (!is_immediate && !prepare_fade_layer_images()) {
+		log_script_exec_footer();
+		return false;
+	}
+
 	/* 描画メソッドを識別する */
 	fade_method = get_fade_method(method);
 	if (fade_method == FADE_METHOD_INVALID) {
@@ -160,13 +178,7 @@ static bool init(void)
 		set_rule_image(rule_img);
 	}
 
-	/* キーが押されているか、フェードしない場合 */
-	if ((span == 0)
-	    ||
-	    (!is_non_interruptible() && is_skip_mode())
-	    ||
-	    (!is_non_interruptible() && !is_auto_mode() &&
-	     is_control_pressed)) {
+	if (is_immediate) {
 		/* フェードせず、すぐに切り替える */
 		for (i = 0; i < PARAM_SIZE; i++) {
 			if (stay[i])
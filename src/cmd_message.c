@@ -18,6 +18,7 @@
  *  - 2022/07/19 システムメニューに対応
  *  - 2022/07/28 コンフィグに対応
  *  - 2022/08/08 セーブ・ロード・ヒストリをGUIに変更
+ *  - 2026/10/19 メッセージのレイアウトを初期化時に求めるように変更
  */
 
 #include "suika.h"
@@ -63,8 +64,23 @@ static int total_chars;
 /* 前回までに描画した文字数 */
 static int drawn_chars;
 
-/* スペースの直後であるか */
-static bool is_after_space;
+/* レイアウト済みの文字 */
+struct layout_char {
+	/* 描画する文字 (エスケープと改行は0) */
+	uint32_t c;
+
+	/* メッセージボックス内の描画位置 */
+	int x;
+	int y;
+};
+
+/* メッセージのレイアウト (total_chars個が有効) */
+static struct layout_char *layout;
+static int layout_size;
+
+/* レイアウトの最後の文字の次の描画位置 */
+static int layout_end_x;
+static int layout_end_y;
 
 /* ビープ音再生中であるか */
 static bool is_beep;
@@ -110,12 +126,9 @@ static int msgbox_y;
 static int msgbox_w;
 static int msgbox_h;
 
-/* 描画するメッセージの現在の先頭 */
+/* 描画するメッセージの先頭 */
 static const char *msg;
 
-/* 描画するメッセージの本来の先頭 */
-static const char *msg_top;
-
 
 /* 文字の色 */
 static pixel_t color;
@@ -138,9 +151,6 @@ static bool load_flag;
 /* GUI画面から戻ったばかりであるか */
 static bool gui_flag;
 
-/* 文字列がエスケープ中か */
-static bool escaped;
-
 /* ポイント中のボタン */
 static int pointed_index;
 
@@ -178,11 +188,12 @@ static void draw_namebox(void);
 static int get_namebox_width(void);
 static bool play_voice(void);
 static void set_character_volume_by_name(const char *name);
+static bool layout_message(void);
 static void draw_msgbox(int *x, int *y, int *w, int *h);
 static int get_frame_chars(void);
 static void draw_click(int *x, int *y, int *w, int *h);
 static void check_stop_click_animation(void);
-static int get_en_word_width(void);
+static int get_en_word_width(const char *m);
 static void get_message_color(pixel_t *color, pixel_t *outline_color);
 static void init_pointed_index(void);
 static void init_first_draw_area(int *x, int *y, int *w, int *h);
@@ -342,8 +353,7 @@ static bool init(int *x, int *y, int *w, int *h)
 	raw_msg = get_command_type() == COMMAND_MESSAGE ?
 		get_string_param(MESSAGE_PARAM_MESSAGE) :
 		get_string_param(SERIF_PARAM_MESSAGE);
-	msg_top = expand_variable(raw_msg);
-	msg = msg_top;
+	msg = expand_variable(raw_msg);
 
 	/* 先頭が'\'である場合(NVLモード)を処理する */
 	if (msg[0] == '\\') {
@@ -376,9 +386,6 @@ static bool init(int *x, int *y, int *w, int *h)
 	total_chars = utf8_chars(msg);
 	drawn_chars = 0;
 
-	/* 先頭文字はスペースの直後とみなす */
-	is_after_space = true;
-
 	/* メッセージの描画位置を初期化する */
 	if (!is_nvl_mode) {
 		pen_x = conf_msgbox_margin_left;
@@ -395,6 +402,10 @@ static bool init(int *x, int *y, int *w, int *h)
 		   *x, *y, *w, *h,
 		   msgbox_x, msgbox_y, msgbox_w, msgbox_h);
 
+	/* メッセージのレイアウトを求める */
+	if (!layout_message())
+		return false;
+
 	/* メッセージボックスをクリアする */
 	if (!is_nvl_mode)
 		clear_msgbox();
@@ -682,53 +693,74 @@ static void set_character_volume_by_name(const char *name)
 	apply_character_volume(CH_VOL_SLOT_DEFAULT);
 }
 
-/* メッセージボックスの描画を行う */
-static void draw_msgbox(int *x, int *y, int *w, int *h)
+/*
+ * メッセージのレイアウトを求める
+ *  - 描画開始位置はorig_pen_x, orig_pen_y
+ *  - ワードラッピング、エスケープ、改行、行頭禁則を処理する
+ */
+static bool layout_message(void)
 {
+	struct layout_char *new_layout;
+	const char *m;
 	uint32_t c;
-	int char_count, mblen, cw, ch, i;
+	int mblen, cw, lx, ly, i;
+	bool is_after_space, escaped;
+
+	/* レイアウトの領域を確保する */
+	if (total_chars > layout_size) {
+		new_layout = realloc(layout,
+				     sizeof(struct layout_char) *
+				     (size_t)total_chars);
+		if (new_layout == NULL) {
+			log_memory();
+			return false;
+		}
+		layout = new_layout;
+		layout_size = total_chars;
+	}
 
-	/* 今回のフレームで描画する文字数を取得する */
-	char_count = get_frame_chars();
-	if (char_count == 0)
-		return;
+	/* 先頭文字はスペースの直後とみなす */
+	is_after_space = true;
+	escaped = false;
 
-	/* 1文字ずつ描画する */
-	for (i = 0; i < char_count; i++) {
+	/* 1文字ずつ位置を求める */
+	m = msg;
+	lx = orig_pen_x;
+	ly = orig_pen_y;
+	for (i = 0; i < total_chars; i++) {
 		/* ワードラッピングを処理する */
 		if (is_after_space) {
-			if (pen_x + get_en_word_width() >=
+			if (lx + get_en_word_width(m) >=
 			    msgbox_w - conf_msgbox_margin_right) {
-				pen_y += conf_msgbox_margin_line;
-				pen_x = conf_msgbox_margin_left;
+				ly += conf_msgbox_margin_line;
+				lx = conf_msgbox_margin_left;
 			}
 		}
-		is_after_space = *msg == ' ';
+		is_after_space = *m == ' ';
 
-		/* 描画する文字を取得する */
-		mblen = utf8_to_utf32(msg, &c);
+		/* 文字を取得する */
+		mblen = utf8_to_utf32(m, &c);
 		if (mblen == -1) {
-			drawn_chars = total_chars;
-			return;
+			total_chars = i;
+			break;
 		}
+		m += mblen;
 
 		/* エスケープの処理 */
 		if (!escaped) {
 			/* エスケープ文字であるとき */
 			if (c == CHAR_BACKSLASH || c == CHAR_YENSIGN) {
 				escaped = true;
-				msg += mblen;
-				drawn_chars++;
+				layout[i].c = 0;
 				continue;
 			}
 		} else if (escaped) {
 			/* エスケープされた文字であるとき */
 			if (c == CHAR_SMALLN) {
-				pen_y += conf_msgbox_margin_line;
-				pen_x = conf_msgbox_margin_left;
+				ly += conf_msgbox_margin_line;
+				lx = conf_msgbox_margin_left;
 				escaped = false;
-				msg += mblen;
-				drawn_chars++;
+				layout[i].c = 0;
 				continue;
 			}
 
@@ -736,34 +768,66 @@ static void draw_msgbox(int *x, int *y, int *w, int *h)
 			escaped = false;
 		}
 
-		/* 描画する文字の幅を取得する */
+		/* 文字の幅を取得する */
 		cw = get_glyph_width(c);
 
 		/*
 		 * メッセージボックスの幅を超える場合、改行する。
 		 * ただし行頭禁則文字の場合は改行しない。
 		 */
-		if ((pen_x + cw >= msgbox_w - conf_msgbox_margin_right) &&
+		if ((lx + cw >= msgbox_w - conf_msgbox_margin_right) &&
 		    (c != CHAR_SPACE && c != CHAR_COMMA && c != CHAR_PERIOD &&
 		     c != CHAR_COLON && c != CHAR_SEMICOLON &&
 		     c != CHAR_TOUTEN && c != CHAR_KUTEN)) {
-			pen_y += conf_msgbox_margin_line;
-			pen_x = conf_msgbox_margin_left;
+			ly += conf_msgbox_margin_line;
+			lx = conf_msgbox_margin_left;
 		}
 
+		/* 位置を記録して次の文字へ移動する */
+		layout[i].c = c;
+		layout[i].x = lx;
+		layout[i].y = ly;
+		lx += cw;
+	}
+
+	/* 最後の文字の次の位置を記録する */
+	layout_end_x = lx;
+	layout_end_y = ly;
+
+	return true;
+}
+
+/* メッセージボックスの描画を行う */
+static void draw_msgbox(int *x, int *y, int *w, int *h)
+{
+	struct layout_char *lc;
+	int char_count, cw, ch, i;
+
+	/* 今回のフレームで描画する文字数を取得する */
+	char_count = get_frame_chars();
+	if (char_count == 0)
+		return;
+
+	/* レイアウト済みの文字を1文字ずつ描画する */
+	for (i = 0; i < char_count; i++) {
+		lc = &layout[drawn_chars++];
+		if (lc->c == 0)
+			continue;
+
 		/* 描画する */
-		draw_char_on_msgbox(pen_x, pen_y, c, color, outline_color, &cw,
-				    &ch);
+		draw_char_on_msgbox(lc->x, lc->y, lc->c, color, outline_color,
+				    &cw, &ch);
 
 		/* 更新領域を求める */
 		union_rect(x, y, w, h,
 			   *x, *y, *w, *h,
-			   msgbox_x + pen_x, msgbox_y + pen_y, cw, ch);
+			   msgbox_x + lc->x, msgbox_y + lc->y, cw, ch);
+	}
 
-		/* 次の文字へ移動する */
-		pen_x += cw;
-		msg += mblen;
-		drawn_chars++;
+	/* すべて描画した場合、描画位置を最後の文字の次にする */
+	if (drawn_chars == total_chars) {
+		pen_x = layout_end_x;
+		pen_y = layout_end_y;
 	}
 }
 
@@ -940,14 +1004,12 @@ static void check_stop_click_animation(void)
 	}
 }
 
-/* msgが英単語の先頭であれば、その単語の描画幅、それ以外の場合0を返す */
-static int get_en_word_width(void)
+/* mが英単語の先頭であれば、その単語の描画幅、それ以外の場合0を返す */
+static int get_en_word_width(const char *m)
 {
-	const char *m;
 	uint32_t wc;
 	int width;
 
-	m = msg;
 	width = 0;
 	while (isgraph_extended(&m, &wc))
 		width += get_glyph_width(wc);
@@ -2297,9 +2359,6 @@ static bool cleanup(int *x, int *y, int *w, int *h)
 	    (!did_quick_load && !need_save_mode && !need_load_mode &&
 	     !need_history_mode && !need_config_mode)) {
 		is_overcoating = true;
-		msg = msg_top;
-		if (msg[0] == '\\')
-			msg++;
 		drawn_chars = 0;
 		pen_x = orig_pen_x;
 		pen_y = orig_pen_y;
@@ -2314,6 +2373,11 @@ static bool cleanup(int *x, int *y, int *w, int *h)
 		draw_msgbox(x, y, w, h);
 	}
 
+	/* レイアウトを解放する(再開時はinit()で求め直す) */
+	free(layout);
+	layout = NULL;
+	layout_size = 0;
+
 	/* 次のコマンドに移動する */
 	if (!did_quick_load && !need_save_mode && !need_load_mode &&
 	    !need_history_mode && !need_config_mode) {
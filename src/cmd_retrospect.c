@@ -106,6 +106,12 @@ bool init(void)
 	change_ch_immediately(CH_RIGHT, NULL, 0, 0, 0);
 	change_ch_immediately(CH_CENTER, NULL, 0, 0, 0);
 
+	/* FO/FIレイヤを用意する */
+	if (!prepare_fade_layer_images()) {
+		log_script_exec_footer();
+		return false;
+	}
+
 	/* FO/FIレイヤをロックする */
 	lock_fo_fi_for_menu();
 
@@ -79,6 +79,12 @@ static bool init(void)
 	    (!is_non_interruptible() && is_control_pressed)) {
 		/* 繰り返し動作を開始しない */
 	} else {
+		/* フェード用のレイヤを用意する */
+		if (!prepare_fade_layer_images()) {
+			log_script_exec_footer();
+			return false;
+		}
+
 		/* 繰り返し動作を開始する */
 		start_command_repetition();
 
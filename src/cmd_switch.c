@@ -249,6 +249,12 @@ bool init(void)
 			return false;
 	}
 
+	/* 選択肢を描画するFO/FIレイヤを用意する */
+	if (!prepare_fade_layer_images()) {
+		log_script_exec_footer();
+		return false;
+	}
+
 	/* 名前ボックス、メッセージボックスを非表示にする */
 	show_namebox(false);
 	show_msgbox(false);
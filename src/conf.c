@@ -55,6 +55,7 @@ int conf_font_outline_color_r;
 int conf_font_outline_color_g;
 int conf_font_outline_color_b;
 int conf_font_outline_remove;
+int conf_font_cache_size;
 
 /*
  * 名前ボックスの設定
@@ -369,6 +370,36 @@ int conf_msgbox_show_on_bg;
 /* ビープの調整 */
 float conf_beep_adjustment;
 
+/* デコード済みイメージのキャッシュの容量(KB) */
+int conf_image_cache_size;
+
+/* イメージの先読みで調べるコマンドの数 */
+int conf_image_prefetch_count;
+
+/* イメージの先読みを行わない */
+int conf_image_prefetch_disable;
+
+/* 不透明な背景とフェード用のレイヤをRGB565形式で保持する */
+int conf_image_lowmem;
+
+/* ピクセル列のプールに保持する空きバッファの総量(KB) */
+int conf_image_pool_size;
+
+/* イメージのメモリの統計を終了時にログに出力する */
+int conf_image_stats_log;
+
+/* フェード用のレイヤを起動時に作成する */
+int conf_image_fade_preallocate;
+
+/* フェード用のレイヤを解放するまでの未使用時間(ミリ秒, 0なら解放しない) */
+int conf_image_fade_release;
+
+/* 常駐させるスクリプトの数(現在のスクリプトを含む) */
+int conf_script_resident_count;
+
+/* 常駐させるスクリプトの合計サイズの上限(KB) */
+int conf_script_resident_size;
+
 /* リリース版であるか */
 int conf_release;
 
@@ -413,6 +444,7 @@ struct rule {
 	{"font.outline.color.g", 'i', &conf_font_outline_color_g, true, false},
 	{"font.outline.color.b", 'i', &conf_font_outline_color_b, true, false},
 	{"font.outline.remove", 'i', &conf_font_outline_remove, true, false},
+	{"font.cache.size", 'i', &conf_font_cache_size, true, false},
 	{"namebox.file", 's', &conf_namebox_file, false, false},
 	{"namebox.x", 'i', &conf_namebox_x, false, false},
 	{"namebox.y", 'i', &conf_namebox_y, false, false},
@@ -1075,6 +1107,16 @@ struct rule {
 	{"msgbox.show.on.ch", 'i', &conf_msgbox_show_on_ch, true, false},
 	{"msgbox.show.on.bg", 'i', &conf_msgbox_show_on_bg, true, false},
 	{"beep.adjustment", 'f', &conf_beep_adjustment, true, false},
+	{"image.cache.size", 'i', &conf_image_cache_size, true, false},
+	{"image.prefetch.count", 'i', &conf_image_prefetch_count, true, false},
+	{"image.prefetch.disable", 'i', &conf_image_prefetch_disable, true, false},
+	{"image.lowmem", 'i', &conf_image_lowmem, true, false},
+	{"image.pool.size", 'i', &conf_image_pool_size, true, false},
+	{"image.stats.log", 'i', &conf_image_stats_log, true, false},
+	{"image.fade.preallocate", 'i', &conf_image_fade_preallocate, true, false},
+	{"image.fade.release", 'i', &conf_image_fade_release, true, false},
+	{"script.resident.count", 'i', &conf_script_resident_count, true, false},
+	{"script.resident.size", 'i', &conf_script_resident_size, true, false},
 	{"release", 'i', &conf_release, true, false},
 };
 
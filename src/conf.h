@@ -72,6 +72,7 @@ extern int conf_font_outline_color_r;
 extern int conf_font_outline_color_g;
 extern int conf_font_outline_color_b;
 extern int conf_font_outline_remove;
+extern int conf_font_cache_size;
 
 /*
  * 名前ボックスの設定
@@ -333,6 +334,16 @@ extern int conf_click_disable;
 extern int conf_msgbox_show_on_ch;
 extern int conf_msgbox_show_on_bg;
 extern float conf_beep_adjustment;
+extern int conf_image_cache_size;
+extern int conf_image_prefetch_count;
+extern int conf_image_prefetch_disable;
+extern int conf_image_lowmem;
+extern int conf_image_pool_size;
+extern int conf_image_stats_log;
+extern int conf_image_fade_preallocate;
+extern int conf_image_fade_release;
+extern int conf_script_resident_count;
+extern int conf_script_resident_size;
 extern int conf_release;
 
 /* conf_localeを設定する */
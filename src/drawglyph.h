@@ -10,113 +10,407 @@
  *
  * [Changes]
  *  - 2016/06/19 作成
+ *  - 2026/10/19 整数演算で合成し, SSE2/AVX2でベクトル化するように変更
+ *  - 2026/10/19 アウトラインと中身を1パスで合成するように変更
  */
 
+/*
+ * 下記のマクロを定義してインクルードする
+ *  - DRAW_GLYPH_FUNC
+ */
+
+#ifndef PROTOTYPE_ONLY
+
+/* コンパイル時に有効な命令セットでベクトル化する */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DRAW_GLYPH_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DRAW_GLYPH_SSE2
+#endif
+
+/* 一度に合成する行の区間の最大ピクセル数 */
+#define GLYPH_ROW_CHUNK		(256)
+
+/* 0から65025の値を255で割る(切り捨て, 0x8081/2^23は1/255の近似) */
+#define DIV255(x)		(((x) * 0x8081) >> 23)
+
+/*
+ * 1ピクセルにカバレッジと色を合成する
+ *  - コンポーネント1と3は16ビットずつ1つの32ビット値で計算する
+ */
+static INLINE pixel_t blend_glyph_pixel(pixel_t dst, uint32_t cov,
+					pixel_t color)
+{
+	uint32_t inv, a, c13, c2;
+
+	/* cov * color + (255 - cov) * dst を求める(各16ビットに収まる) */
+	inv = 255 - cov;
+	c13 = (color & 0x00ff00ff) * cov + (dst & 0x00ff00ff) * inv;
+	c2 = ((color >> 8) & 0xff) * cov + ((dst >> 8) & 0xff) * inv;
+
+	/* 255で割る(DIV255()と同じ結果になる) */
+	c13 = ((c13 + 0x00010001 + ((c13 >> 8) & 0x00ff00ff)) >> 8) &
+		0x00ff00ff;
+	c2 = DIV255(c2);
+
+	/* 転送先のアルファ値にはカバレッジを飽和加算する */
+	a = cov + get_pixel_a(dst);
+	if (a > 255)
+		a = 255;
+
+	return (a << 24) | c13 | (c2 << 8);
+}
+
+#if defined(DRAW_GLYPH_SSE2)
+/*
+ * 4ピクセルにカバレッジと色を合成する
+ *  - covは各ピクセルのカバレッジを4バイトずつ複製したもの
+ *  - color16は色を2ピクセル分16ビットに展開したもの
+ */
+static INLINE __m128i blend_glyph_sse2(__m128i dst, __m128i cov,
+				       __m128i color16)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i v255 = _mm_set1_epi16(255);
+	const __m128i div = _mm_set1_epi16((short)0x8081);
+	const __m128i amask = _mm_set1_epi32((int)0xff000000U);
+	__m128i cov_lo, cov_hi, dst_lo, dst_hi, lo, hi, a;
+
+	cov_lo = _mm_unpacklo_epi8(cov, zero);
+	cov_hi = _mm_unpackhi_epi8(cov, zero);
+	dst_lo = _mm_unpacklo_epi8(dst, zero);
+	dst_hi = _mm_unpackhi_epi8(dst, zero);
+
+	/* cov * color + (255 - cov) * dst を求める */
+	lo = _mm_add_epi16(_mm_mullo_epi16(cov_lo, color16),
+			   _mm_mullo_epi16(_mm_sub_epi16(v255, cov_lo),
+					   dst_lo));
+	hi = _mm_add_epi16(_mm_mullo_epi16(cov_hi, color16),
+			   _mm_mullo_epi16(_mm_sub_epi16(v255, cov_hi),
+					   dst_hi));
+
+	/* 255で割る */
+	lo = _mm_srli_epi16(_mm_mulhi_epu16(lo, div), 7);
+	hi = _mm_srli_epi16(_mm_mulhi_epu16(hi, div), 7);
+
+	/* アルファ値は飽和加算したものに置き換える */
+	a = _mm_adds_epu8(cov, dst);
+	return _mm_or_si128(_mm_andnot_si128(amask, _mm_packus_epi16(lo, hi)),
+			    _mm_and_si128(amask, a));
+}
+
+/* 8ピクセルに全ての層を合成する(srcとdstは同じでもよい) */
+static INLINE void blend_glyph_8px(pixel_t *dst,
+				   const pixel_t *src,
+				   const unsigned char * const *cov,
+				   int offset,
+				   const __m128i *color16,
+				   const pixel_t *solid,
+				   int layer_count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi8((char)0xff);
+	__m128i c8, d0, d1;
+	int i;
+
+	d0 = _mm_loadu_si128((const __m128i *)src);
+	d1 = _mm_loadu_si128((const __m128i *)(src + 4));
+	for (i = 0; i < layer_count; i++) {
+		if (cov[i] == NULL)
+			continue;
+		c8 = _mm_loadl_epi64((const __m128i *)(cov[i] + offset));
+
+		/* カバレッジが全て0なら変化しない */
+		if ((_mm_movemask_epi8(_mm_cmpeq_epi8(c8, zero)) & 0xff) ==
+		    0xff)
+			continue;
+
+		/* カバレッジが全て255なら色で塗りつぶす */
+		if ((_mm_movemask_epi8(_mm_cmpeq_epi8(c8, full)) & 0xff) ==
+		    0xff) {
+			d0 = d1 = _mm_set1_epi32((int)solid[i]);
+			continue;
+		}
+
+		c8 = _mm_unpacklo_epi8(c8, c8);
+		d0 = blend_glyph_sse2(d0, _mm_unpacklo_epi16(c8, c8),
+				      color16[i]);
+		d1 = blend_glyph_sse2(d1, _mm_unpackhi_epi16(c8, c8),
+				      color16[i]);
+	}
+	_mm_storeu_si128((__m128i *)dst, d0);
+	_mm_storeu_si128((__m128i *)(dst + 4), d1);
+}
+#endif
+
+#if defined(DRAW_GLYPH_AVX2)
+/*
+ * 8ピクセルにカバレッジと色を合成する
+ *  - 128ビットのレーンごとにSSE2版と同じ計算を行う
+ */
+static INLINE __m256i blend_glyph_avx2(__m256i dst, __m256i cov,
+				       __m256i color16)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i v255 = _mm256_set1_epi16(255);
+	const __m256i div = _mm256_set1_epi16((short)0x8081);
+	const __m256i amask = _mm256_set1_epi32((int)0xff000000U);
+	__m256i cov_lo, cov_hi, dst_lo, dst_hi, lo, hi, a;
+
+	cov_lo = _mm256_unpacklo_epi8(cov, zero);
+	cov_hi = _mm256_unpackhi_epi8(cov, zero);
+	dst_lo = _mm256_unpacklo_epi8(dst, zero);
+	dst_hi = _mm256_unpackhi_epi8(dst, zero);
+
+	lo = _mm256_add_epi16(_mm256_mullo_epi16(cov_lo, color16),
+			      _mm256_mullo_epi16(_mm256_sub_epi16(v255,
+								  cov_lo),
+						 dst_lo));
+	hi = _mm256_add_epi16(_mm256_mullo_epi16(cov_hi, color16),
+			      _mm256_mullo_epi16(_mm256_sub_epi16(v255,
+								  cov_hi),
+						 dst_hi));
+
+	lo = _mm256_srli_epi16(_mm256_mulhi_epu16(lo, div), 7);
+	hi = _mm256_srli_epi16(_mm256_mulhi_epu16(hi, div), 7);
+
+	a = _mm256_adds_epu8(cov, dst);
+	return _mm256_or_si256(_mm256_andnot_si256(amask,
+						   _mm256_packus_epi16(lo, hi)),
+			       _mm256_and_si256(amask, a));
+}
+
+/* 8ピクセルに全ての層を合成する(srcとdstは同じでもよい) */
+static INLINE void blend_glyph_8px(pixel_t *dst,
+				   const pixel_t *src,
+				   const unsigned char * const *cov,
+				   int offset,
+				   const __m256i *color16,
+				   const pixel_t *solid,
+				   int layer_count)
+{
+	const __m256i shuffle = _mm256_setr_epi8(
+		0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+		4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi8((char)0xff);
+	__m128i c8;
+	__m256i d;
+	int i;
+
+	d = _mm256_loadu_si256((const __m256i *)src);
+	for (i = 0; i < layer_count; i++) {
+		if (cov[i] == NULL)
+			continue;
+		c8 = _mm_loadl_epi64((const __m128i *)(cov[i] + offset));
+
+		/* カバレッジが全て0なら変化しない */
+		if ((_mm_movemask_epi8(_mm_cmpeq_epi8(c8, zero)) & 0xff) ==
+		    0xff)
+			continue;
+
+		/* カバレッジが全て255なら色で塗りつぶす */
+		if ((_mm_movemask_epi8(_mm_cmpeq_epi8(c8, full)) & 0xff) ==
+		    0xff) {
+			d = _mm256_set1_epi32((int)solid[i]);
+			continue;
+		}
+
+		/* カバレッジを1ピクセルあたり4バイトに複製して合成する */
+		d = blend_glyph_avx2(
+			d,
+			_mm256_shuffle_epi8(_mm256_broadcastq_epi64(c8),
+					    shuffle),
+			color16[i]);
+	}
+	_mm256_storeu_si256((__m256i *)dst, d);
+}
+#endif
+
+#endif /* !PROTOTYPE_ONLY */
+
 /*
  * フォントをイメージに描画する
+ *  - 複数の層(アウトラインと中身)を与えられた順に合成する
+ *  - 転送先の各ピクセルは一度だけ読み書きされる
  */
-void DRAW_GLYPH_FUNC(unsigned char * RESTRICT font,
-		     int font_width,
-		     int font_height,
-		     int margin_left,
-		     int margin_top,
+void DRAW_GLYPH_FUNC(const struct glyph_layer * RESTRICT layer,
+		     int layer_count,
 		     pixel_t * RESTRICT image,
 		     int image_width,
 		     int image_height,
 		     int image_x,
-		     int image_y,
-		     pixel_t color)
+		     int image_y)
 #ifdef PROTOTYPE_ONLY
 ;
 #else
 {
-	unsigned char * RESTRICT src_ptr, src_pix;
-	pixel_t * RESTRICT dst_ptr, dst_pix, dst_aa;
-	float color_r, color_g, color_b;
-	float src_a, src_r, src_g, src_b;
-	float dst_a, dst_r, dst_g, dst_b;
-	int image_real_x, image_real_y;
-	int font_real_x, font_real_y;
-	int font_real_width, font_real_height;
-	int px, py;
-
-	/* 完全に描画しない場合のクリッピングを行う */
-	if (image_x + margin_left + font_width < 0)
-		return;
-	if (image_x + margin_left >= image_width)
-		return;
-	if (image_y + margin_top + font_height < 0)
-		return;
-	if (image_y + margin_top > image_height)
-		return;
+	unsigned char cov_buf[GLYPH_LAYER_MAX][GLYPH_ROW_CHUNK];
+	const unsigned char *cov[GLYPH_LAYER_MAX];
+	pixel_t * RESTRICT dst_ptr;
+	int left, top, right, bottom;
+	int lx, ly, x0, x1, cx, n, px, py, i;
+#if defined(DRAW_GLYPH_AVX2) || defined(DRAW_GLYPH_SSE2)
+	pixel_t tail[8], solid[GLYPH_LAYER_MAX];
+#endif
+#if defined(DRAW_GLYPH_AVX2)
+	__m256i color16[GLYPH_LAYER_MAX];
+#elif defined(DRAW_GLYPH_SSE2)
+	__m128i color16[GLYPH_LAYER_MAX];
+#endif
 
-	/* 部分的に描画しない場合のクリッピングを行う */
-	image_real_x = image_x + margin_left;
-	image_real_y = image_y + margin_top;
-	font_real_x = 0;
-	font_real_y = 0;
-	font_real_width = font_width;
-	font_real_height = font_height;
-	if (image_real_x < 0) {
-		font_real_x -= image_real_x;
-		font_real_width += image_real_x;
-		image_real_x = 0;
-	}
-	if (image_real_x + font_real_width >= image_width) {
-		font_real_width -= (image_real_x + font_real_width) -
-				   image_width;
+	assert(layer_count > 0 && layer_count <= GLYPH_LAYER_MAX);
+
+	/* 全ての層を囲む矩形を求める */
+	left = image_width;
+	top = image_height;
+	right = 0;
+	bottom = 0;
+	for (i = 0; i < layer_count; i++) {
+		if (layer[i].width <= 0 || layer[i].height <= 0)
+			continue;
+		lx = image_x + layer[i].left;
+		ly = image_y + layer[i].top;
+		if (lx < left)
+			left = lx;
+		if (ly < top)
+			top = ly;
+		if (lx + layer[i].width > right)
+			right = lx + layer[i].width;
+		if (ly + layer[i].height > bottom)
+			bottom = ly + layer[i].height;
 	}
-	if (image_real_y < 0) {
-		font_real_y -= image_real_y;
-		font_real_height += image_real_y;
-		image_real_y = 0;
+
+	/* クリッピングを行う */
+	if (left < 0)
+		left = 0;
+	if (top < 0)
+		top = 0;
+	if (right > image_width)
+		right = image_width;
+	if (bottom > image_height)
+		bottom = image_height;
+	if (left >= right || top >= bottom)
+		return;
+
+	/* 色を16ビットに展開しておく */
+#if defined(DRAW_GLYPH_AVX2)
+	for (i = 0; i < layer_count; i++) {
+		color16[i] = _mm256_unpacklo_epi8(
+			_mm256_set1_epi32((int)layer[i].color),
+			_mm256_setzero_si256());
+		solid[i] = layer[i].color | 0xff000000;
 	}
-	if (image_real_y + font_real_height >= image_height) {
-		font_real_height -= (image_real_y + font_real_height) -
-				    image_height;
+#elif defined(DRAW_GLYPH_SSE2)
+	for (i = 0; i < layer_count; i++) {
+		color16[i] = _mm_unpacklo_epi8(
+			_mm_set1_epi32((int)layer[i].color),
+			_mm_setzero_si128());
+		solid[i] = layer[i].color | 0xff000000;
 	}
+#endif
 
 	/* 描画する */
-	color_r = (float)get_pixel_c1(color);
-	color_g = (float)get_pixel_c2(color);
-	color_b = (float)get_pixel_c3(color);
-	dst_ptr = image + image_real_y * image_width + image_real_x;
-	src_ptr = font + font_real_y * font_width + font_real_x;
-	for (py = font_real_y; py < font_real_y + font_real_height; py++) {
-		for (px = font_real_x; px < font_real_x + font_real_width;
-		     px++) {
-			/* アルファ値を計算する */
-			src_pix = *src_ptr++;
-			src_a = src_pix / 255.0f;
-			dst_a = 1.0f - src_a;
-
-			/* 色にアルファ値を乗算する */
-			src_r = src_a * color_r;
-			src_g = src_a * color_g;
-			src_b = src_a * color_b;
-
-			/* 転送先ピクセルにアルファ値を乗算する */
-			dst_pix	= *dst_ptr;
-			dst_r = dst_a * (float)get_pixel_c1(dst_pix);
-			dst_g = dst_a * (float)get_pixel_c2(dst_pix);
-			dst_b = dst_a * (float)get_pixel_c3(dst_pix);
-
-			/* 転送先ピクセルのアルファ値を求める */
-			dst_aa = src_pix + get_pixel_a(dst_pix);
-			dst_aa = dst_aa >= 255 ? 255 : dst_aa;
-
-			/* 転送先に格納する */
-			*dst_ptr++ = make_pixel_fast(
-				dst_aa,
-				(uint32_t)(src_r + dst_r),
-				(uint32_t)(src_g + dst_g),
-				(uint32_t)(src_b + dst_b));
+	for (py = top; py < bottom; py++) {
+		dst_ptr = image + py * image_width;
+		for (cx = left; cx < right; cx += GLYPH_ROW_CHUNK) {
+			n = right - cx;
+			if (n > GLYPH_ROW_CHUNK)
+				n = GLYPH_ROW_CHUNK;
+
+			/* 各層のカバレッジを区間の先頭に揃える */
+			for (i = 0; i < layer_count; i++) {
+				lx = image_x + layer[i].left;
+				ly = py - (image_y + layer[i].top);
+				x0 = cx > lx ? cx : lx;
+				x1 = cx + n < lx + layer[i].width ?
+					cx + n : lx + layer[i].width;
+				if (ly < 0 || ly >= layer[i].height ||
+				    x0 >= x1) {
+					/* この区間には描画しない */
+					cov[i] = NULL;
+					continue;
+				}
+				if (x0 == cx && x1 == cx + n) {
+					/* 区間全体を覆うのでそのまま使う */
+					cov[i] = layer[i].buf +
+						ly * layer[i].width + cx - lx;
+					continue;
+				}
+				memset(cov_buf[i], 0, (size_t)n);
+				memcpy(cov_buf[i] + x0 - cx,
+				       layer[i].buf + ly * layer[i].width +
+				       x0 - lx,
+				       (size_t)(x1 - x0));
+				cov[i] = cov_buf[i];
+			}
+
+#if defined(DRAW_GLYPH_AVX2) || defined(DRAW_GLYPH_SSE2)
+			if (n >= 8) {
+				/*
+				 * 8の倍数でない場合, 末尾の8ピクセルを先に
+				 * 元の値から合成しておき最後に書き込む
+				 */
+				if (n % 8 != 0) {
+					blend_glyph_8px(tail,
+							dst_ptr + cx + n - 8,
+							cov, n - 8, color16,
+							solid, layer_count);
+				}
+
+				/* 8ピクセルずつ合成する */
+				for (px = 0; px + 8 <= n; px += 8) {
+					blend_glyph_8px(dst_ptr + cx + px,
+							dst_ptr + cx + px,
+							cov, px, color16,
+							solid, layer_count);
+				}
+
+				if (n % 8 != 0) {
+					memcpy(dst_ptr + cx + n - 8, tail,
+					       sizeof(tail));
+				}
+				continue;
+			}
+
+			/* 8ピクセルに満たない場合 */
+			for (px = 0; px < n; px++) {
+				for (i = 0; i < layer_count; i++) {
+					if (cov[i] == NULL)
+						continue;
+					dst_ptr[cx + px] = blend_glyph_pixel(
+						dst_ptr[cx + px],
+						cov[i][px],
+						layer[i].color);
+				}
+			}
+#else
+			/* 層ごとに行を合成する(コンパイラのベクトル化に任せる) */
+			for (i = 0; i < layer_count; i++) {
+				if (cov[i] == NULL)
+					continue;
+				for (px = 0; px < n; px++) {
+					dst_ptr[cx + px] = blend_glyph_pixel(
+						dst_ptr[cx + px],
+						cov[i][px],
+						layer[i].color);
+				}
+			}
+#endif
 		}
-		dst_ptr += image_width - font_real_width;
-		src_ptr += font_width - font_real_width;
 	}
 }
 #endif
 
+#ifndef PROTOTYPE_ONLY
+#undef DRAW_GLYPH_AVX2
+#undef DRAW_GLYPH_SSE2
+#undef GLYPH_ROW_CHUNK
+#undef DIV255
+#endif
+
 #undef DRAW_GLYPH_FUNC
 #undef PROTOTYPE_ONLY
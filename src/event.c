@@ -20,6 +20,16 @@
 /* False assertion */
 #define INVALID_KEYCODE	(0)
 
+/* 描画処理の名前(統計のログ出力用) */
+static const char *draw_kernel_name[DRAW_KERNELS] = {
+	"copy", "fast", "normal", "add", "sub", "binary",
+};
+
+/*
+ * 前方参照
+ */
+static void log_draw_and_cache_stats(void);
+
 /*
  * プラットフォーム非依存な初期化処理を行う
  */
@@ -104,6 +114,39 @@ void on_event_cleanup(void)
 
 	/* 変数の終了処理を行う */
 	cleanup_vars();
+
+	/*
+	 * イメージのメモリ使用量と解放されていないイメージ、描画処理と
+	 * キャッシュの統計を出力する
+	 */
+	if (conf_image_stats_log) {
+		dump_image_memory_stats();
+		report_image_leaks();
+		log_draw_and_cache_stats();
+	}
+
+	/* ピクセル列のプールを解放する */
+	cleanup_image_pool();
+}
+
+/* 描画処理とキャッシュの統計を出力する */
+static void log_draw_and_cache_stats(void)
+{
+	uint64_t count[DRAW_KERNELS], hit, miss, evict;
+	int i;
+
+	get_draw_kernel_stats(count);
+	for (i = 0; i < DRAW_KERNELS; i++) {
+		log_draw_kernel_stats(draw_kernel_name[i],
+				      (unsigned long)count[i]);
+	}
+
+	get_image_cache_stats(&hit, &miss, &evict);
+	log_image_cache_stats((unsigned long)hit, (unsigned long)miss,
+			      (unsigned long)evict);
+
+	get_glyph_cache_stats(&hit, &miss);
+	log_glyph_cache_stats((unsigned long)hit, (unsigned long)miss);
 }
 
 /*
@@ -8,16 +8,29 @@
 /*
  * [Changes]
  *  - 2016/06/28 作成
+ *  - 2026/10/19 パッケージのエントリ単位の圧縮に対応
+ *  - 2026/10/19 重複排除されたエントリに対応
+ *  - 2026/10/19 ファイルのメモリマップに対応
+ *  - 2026/10/19 パッケージ内のファイルのハッシュの取得に対応
+ *  - 2026/10/19 ファイル読み込みストリームをワーカスレッドから開けるようにした
+ *  - 2026/10/19 2GBを超えるパッケージに対応
+ *  - 2026/10/19 ファイル読み込みストリームのシークに対応
  */
 
 #include "suika.h"
 
+#include <zlib.h>
+
 #ifdef _MSC_VER
 #define strcasecmp _stricmp
 #endif
 
 #ifdef WIN
 #include <fcntl.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
 #endif
 
 /* Obfuscation Key */
@@ -50,8 +63,32 @@ struct rfile {
 	uint64_t pos;
 	uint64_t next_random;
 	uint64_t prev_random;
+
+	/* シークする場合にのみ用いる、一定間隔ごとの乱数の状態 */
+	uint64_t *key_checkpoint;
+
+	/* 圧縮されたエントリを使う場合にのみ用いる情報 */
+	bool is_deflated;
+	z_stream z;
+	unsigned char *zbuf;
+	uint64_t stored_size;
+	uint64_t stored_pos;
+	int unget_char;
+
+	/* メモリマップを使う場合にのみ用いる情報 */
+	void *map;
+	size_t map_size;
+#ifdef WIN
+	HANDLE map_handle;
+#endif
 };
 
+/* 圧縮データの読み込みバッファのサイズ */
+#define ZBUF_SIZE	(4096)
+
+/* シーク用に乱数の状態を保存する間隔 */
+#define KEY_CHECKPOINT_INTERVAL	(4096)
+
 /* ファイル書き込みストリーム (TODO: 難読化をサポートする) */
 struct wfile {
 	FILE *fp;
@@ -63,6 +100,9 @@ static struct file_entry entry[FILE_ENTRY_SIZE];
 /* パッケージのファイルエントリ数 */
 static uint64_t entry_count;
 
+/* パッケージのエントリが内容のハッシュを持つか(バージョン2) */
+static bool has_entry_hash;
+
 /* パッケージファイルのパス */
 static char *package_path;
 
@@ -74,7 +114,14 @@ const wchar_t *conv_utf8_to_utf16(const char *s);
  * 前方参照
  */
 static bool check_file_name(const char *file);
+#ifdef WIN
+static FILE *open_file_utf8(const char *path);
+#endif
+static bool open_deflated_rfile(struct rfile *rf);
+static size_t read_deflated_rfile(struct rfile *rf, void *buf, size_t size);
 static void ungetc_rfile(struct rfile *rf, char c);
+static bool seek_file(FILE *fp, uint64_t offset);
+static bool make_key_checkpoint(struct rfile *rf);
 static void set_random_seed(uint64_t index, uint64_t *next_random);
 static char get_next_random(uint64_t *next_random, uint64_t *prev_random);
 static void rewind_random(uint64_t *next_random, uint64_t *prev_random);
@@ -93,8 +140,22 @@ bool init_file(void)
 	return true;
 #else
 	FILE *fp;
-	uint64_t i, next_random;
+	uint64_t i, next_random, magic;
 	int j;
+	bool is_v2;
+
+	/*
+	 * 難読化キーを復元する
+	 *  - ワーカスレッドから開かれる場合があるので、ここで一度だけ行う
+	 */
+	key_reversed = ((((key_obfuscated >> 56) & 0xff) << 0) |
+			(((key_obfuscated >> 48) & 0xff) << 8) |
+			(((key_obfuscated >> 40) & 0xff) << 16) |
+			(((key_obfuscated >> 32) & 0xff) << 24) |
+			(((key_obfuscated >> 24) & 0xff) << 32) |
+			(((key_obfuscated >> 16) & 0xff) << 40) |
+			(((key_obfuscated >> 8)  & 0xff) << 48) |
+			(((key_obfuscated >> 0)  & 0xff) << 56));
 
 	/* パッケージファイルのパスを求める */
 	package_path = make_valid_path(NULL, PACKAGE_FILE);
@@ -120,12 +181,23 @@ bool init_file(void)
 #endif
 	}
 
-	/* パッケージのファイルエントリ数を取得する */
-	if (fread(&entry_count, sizeof(uint64_t), 1, fp) < 1) {
+	/* バージョン2のマジックナンバーもしくはファイルエントリ数を取得する */
+	if (fread(&magic, sizeof(uint64_t), 1, fp) < 1) {
 		log_package_file_error();
 		fclose(fp);
 		return false;
 	}
+	is_v2 = magic == PACKAGE_MAGIC_V2;
+	if (is_v2) {
+		/* バージョン2の場合、ファイルエントリ数が続く */
+		if (fread(&entry_count, sizeof(uint64_t), 1, fp) < 1) {
+			log_package_file_error();
+			fclose(fp);
+			return false;
+		}
+	} else {
+		entry_count = magic;
+	}
 	if (entry_count > FILE_ENTRY_SIZE) {
 		log_package_file_error();
 		fclose(fp);
@@ -143,12 +215,32 @@ bool init_file(void)
 			break;
 		if (fread(&entry[i].offset, sizeof(uint64_t), 1, fp) < 1)
 			break;
+		if (!is_v2) {
+			/* バージョン1は圧縮も重複排除もされていない */
+			entry[i].stored_size = entry[i].size;
+			entry[i].flags = 0;
+			entry[i].key_index = i;
+			continue;
+		}
+		if (fread(&entry[i].stored_size, sizeof(uint64_t), 1, fp) < 1)
+			break;
+		if (fread(&entry[i].flags, sizeof(uint64_t), 1, fp) < 1)
+			break;
+		if (fread(&entry[i].mtime, sizeof(uint64_t), 1, fp) < 1)
+			break;
+		if (fread(&entry[i].hash, sizeof(uint64_t), 1, fp) < 1)
+			break;
+		if (fread(&entry[i].key_index, sizeof(uint64_t), 1, fp) < 1)
+			break;
+		if (entry[i].key_index >= entry_count)
+			break;
 	}
 	if (i != entry_count) {
 		log_package_file_error();
 		fclose(fp);
 		return false;
 	}
+	has_entry_hash = is_v2;
 
 	fclose(fp);
 	return true;
@@ -169,6 +261,8 @@ void cleanup_file(void)
 
 /*
  * ファイル読み込みストリームを開く
+ *  - ワーカスレッドから呼び出してもよい(エラーのログはメインスレッドで出力
+ *    される)
  */
 struct rfile *open_rfile(const char *dir, const char *file, bool save_data)
 {
@@ -200,8 +294,7 @@ struct rfile *open_rfile(const char *dir, const char *file, bool save_data)
 
 	/* まずファイルシステム上のファイルを開いてみる */
 #ifdef WIN
-	_fmode = _O_BINARY;
-	rf->fp = _wfopen(conv_utf8_to_utf16(real_path), L"r");
+	rf->fp = open_file_utf8(real_path);
 #else
 	rf->fp = fopen(real_path, "r");
 #endif
@@ -209,6 +302,9 @@ struct rfile *open_rfile(const char *dir, const char *file, bool save_data)
 		/* 開けた場合、ファイルシステム上のファイルを用いる */
 		free(real_path);
 		rf->is_packaged = false;
+		rf->is_deflated = false;
+		rf->map = NULL;
+		rf->key_checkpoint = NULL;
 		return rf;
 	}
 	free(real_path);
@@ -241,8 +337,7 @@ struct rfile *open_rfile(const char *dir, const char *file, bool save_data)
 
 	/* みつかった場合、パッケージファイルを別なファイルポインタで開く */
 #ifdef WIN
-	_fmode = _O_BINARY;
-	rf->fp = _wfopen(conv_utf8_to_utf16(package_path), L"r");
+	rf->fp = open_file_utf8(package_path);
 #else
 	rf->fp = fopen(package_path, "r");
 #endif
@@ -253,7 +348,7 @@ struct rfile *open_rfile(const char *dir, const char *file, bool save_data)
 	}
 
 	/* 読み込み位置にシークする */
-	if (fseek(rf->fp, (long)entry[i].offset, SEEK_SET) != 0) {
+	if (!seek_file(rf->fp, entry[i].offset)) {
 		log_package_file_error();
 		fclose(rf->fp);
 		free(rf);
@@ -265,12 +360,64 @@ struct rfile *open_rfile(const char *dir, const char *file, bool save_data)
 	rf->size = entry[i].size;
 	rf->offset = entry[i].offset;
 	rf->pos = 0;
-	set_random_seed(i, &rf->next_random);
+	set_random_seed(entry[i].key_index, &rf->next_random);
 	rf->prev_random = 0;
+	rf->key_checkpoint = NULL;
+	rf->is_deflated = false;
+	rf->map = NULL;
+
+	/* 圧縮されている場合、展開の準備をする */
+	if (entry[i].flags & FILE_ENTRY_DEFLATE) {
+		rf->stored_size = entry[i].stored_size;
+		if (!open_deflated_rfile(rf)) {
+			fclose(rf->fp);
+			free(rf);
+			return NULL;
+		}
+	}
 
 	return rf;
 }
 
+#ifdef WIN
+/*
+ * UTF-8のパスのファイルを読み込み用に開く
+ *  - conv_utf8_to_utf16()の静的バッファと_fmodeはスレッド間で共有される
+ *    ので、ワーカスレッドから呼ばれても良いようにどちらも使わない
+ */
+static FILE *open_file_utf8(const char *path)
+{
+	wchar_t buf[MAX_PATH];
+
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, buf, MAX_PATH) == 0)
+		return NULL;
+
+	return _wfopen(buf, L"rb");
+}
+#endif
+
+/* 圧縮されたエントリの展開を開始する */
+static bool open_deflated_rfile(struct rfile *rf)
+{
+	rf->zbuf = malloc(ZBUF_SIZE);
+	if (rf->zbuf == NULL) {
+		log_memory();
+		return false;
+	}
+
+	memset(&rf->z, 0, sizeof(z_stream));
+	if (inflateInit2(&rf->z, FILE_DEFLATE_WBITS) != Z_OK) {
+		log_package_file_error();
+		free(rf->zbuf);
+		return false;
+	}
+
+	rf->is_deflated = true;
+	rf->stored_pos = 0;
+	rf->unget_char = -1;
+	return true;
+}
+
 /* ファイル名に半角英数字以外が含まれるかチェックする */
 static bool check_file_name(const char *file)
 {
@@ -328,6 +475,8 @@ size_t read_rfile(struct rfile *rf, void *buf, size_t size)
 		size = (size_t)(rf->size - rf->pos);
 	if (size == 0)
 		return 0;
+	if (rf->is_deflated)
+		return read_deflated_rfile(rf, buf, size);
 	len = fread(buf, 1, size, rf->fp);
 	rf->pos += len;
 	for (obf = 0; obf < len; obf++) {
@@ -337,6 +486,62 @@ size_t read_rfile(struct rfile *rf, void *buf, size_t size)
 	return len;
 }
 
+/* 圧縮されたエントリから読み込む */
+static size_t read_deflated_rfile(struct rfile *rf, void *buf, size_t size)
+{
+	unsigned char *dst;
+	size_t len, block, obf;
+	int ret;
+
+	dst = buf;
+	len = 0;
+
+	/* ungetc_rfile()で戻された文字があれば先に返す */
+	if (rf->unget_char != -1) {
+		*dst++ = (unsigned char)rf->unget_char;
+		rf->unget_char = -1;
+		len = 1;
+	}
+
+	/* 出力バッファが一杯になるまで展開する */
+	rf->z.next_out = dst;
+	rf->z.avail_out = (uInt)(size - len);
+	while (rf->z.avail_out > 0) {
+		/* 入力が空になったら圧縮データを読み込んで復号する */
+		if (rf->z.avail_in == 0) {
+			block = ZBUF_SIZE;
+			if (rf->stored_pos + block > rf->stored_size)
+				block = (size_t)(rf->stored_size - rf->stored_pos);
+			if (block == 0)
+				break;
+			block = fread(rf->zbuf, 1, block, rf->fp);
+			if (block == 0)
+				break;
+			for (obf = 0; obf < block; obf++) {
+				rf->zbuf[obf] ^= (unsigned char)
+					get_next_random(&rf->next_random,
+							NULL);
+			}
+			rf->stored_pos += block;
+			rf->z.next_in = rf->zbuf;
+			rf->z.avail_in = (uInt)block;
+		}
+
+		/* 展開する */
+		ret = inflate(&rf->z, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END)
+			break;
+		if (ret != Z_OK) {
+			log_package_file_error();
+			break;
+		}
+	}
+	len = size - rf->z.avail_out;
+	rf->pos += len;
+
+	return len;
+}
+
 /*
  * ファイル読み込みストリームから1行読み込む
  */
@@ -391,12 +596,150 @@ static void ungetc_rfile(struct rfile *rf, char c)
 	} else {
 		/* パッケージ内のファイルの場合 */
 		assert(rf->pos != 0);
-		ungetc(c, rf->fp);
 		rf->pos--;
+		if (rf->is_deflated) {
+			/* 圧縮されている場合 */
+			rf->unget_char = (unsigned char)c;
+			return;
+		}
+		ungetc(c, rf->fp);
 		rewind_random(&rf->next_random, &rf->prev_random);
 	}
 }
 
+/*
+ * ファイル読み込みストリームの読み込み位置を設定する
+ *  - パッケージ内の圧縮されたファイルはシークできない
+ */
+bool seek_rfile(struct rfile *rf, uint64_t pos)
+{
+	uint64_t i;
+
+	assert(rf != NULL);
+	assert(rf->fp != NULL);
+
+	/* ファイルシステム上のファイルの場合 */
+	if (!rf->is_packaged)
+		return seek_file(rf->fp, pos);
+
+	/* パッケージ内のファイルの場合 */
+	if (rf->is_deflated || pos > rf->size)
+		return false;
+	if (pos == rf->pos)
+		return true;
+
+	/* 初回は乱数の状態を一定間隔ごとに求めておく */
+	if (rf->key_checkpoint == NULL && !make_key_checkpoint(rf))
+		return false;
+
+	if (!seek_file(rf->fp, rf->offset + pos))
+		return false;
+
+	/* 直前のチェックポイントから乱数を進める */
+	rf->next_random = rf->key_checkpoint[pos / KEY_CHECKPOINT_INTERVAL];
+	for (i = pos - pos % KEY_CHECKPOINT_INTERVAL; i < pos; i++)
+		get_next_random(&rf->next_random, NULL);
+	rf->prev_random = 0;
+	rf->pos = pos;
+
+	return true;
+}
+
+/* パッケージ内のファイルの乱数の状態を一定間隔ごとに求める */
+static bool make_key_checkpoint(struct rfile *rf)
+{
+	uint64_t i, next_random;
+
+	rf->key_checkpoint = malloc(sizeof(uint64_t) *
+				    (size_t)(rf->size /
+					     KEY_CHECKPOINT_INTERVAL + 1));
+	if (rf->key_checkpoint == NULL) {
+		log_memory();
+		return false;
+	}
+
+	set_random_seed(entry[rf->index].key_index, &next_random);
+	for (i = 0; i <= rf->size; i++) {
+		if (i % KEY_CHECKPOINT_INTERVAL == 0)
+			rf->key_checkpoint[i / KEY_CHECKPOINT_INTERVAL] =
+				next_random;
+		get_next_random(&next_random, NULL);
+	}
+
+	return true;
+}
+
+/*
+ * ファイルの64ビットの位置にシークする
+ *  - Windowsではlongが32ビットなので、fseek()では2GBを超えられない
+ */
+static bool seek_file(FILE *fp, uint64_t offset)
+{
+#ifdef WIN
+	return _fseeki64(fp, (__int64)offset, SEEK_SET) == 0;
+#else
+	return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+/*
+ * ファイルをメモリにマップする
+ */
+const void *map_rfile(struct rfile *rf)
+{
+	assert(rf != NULL);
+	assert(rf->fp != NULL);
+
+	/* パッケージ内のファイルは難読化されているのでマップできない */
+	if (rf->is_packaged)
+		return NULL;
+
+	/* マップ済みの場合 */
+	if (rf->map != NULL)
+		return rf->map;
+
+	rf->map_size = get_rfile_size(rf);
+	if (rf->map_size == 0)
+		return NULL;
+
+#ifdef WIN
+	rf->map_handle = CreateFileMapping(
+		(HANDLE)_get_osfhandle(_fileno(rf->fp)), NULL, PAGE_READONLY,
+		0, 0, NULL);
+	if (rf->map_handle == NULL)
+		return NULL;
+	rf->map = MapViewOfFile(rf->map_handle, FILE_MAP_READ, 0, 0,
+				rf->map_size);
+	if (rf->map == NULL) {
+		CloseHandle(rf->map_handle);
+		return NULL;
+	}
+#else
+	rf->map = mmap(NULL, rf->map_size, PROT_READ, MAP_SHARED,
+		       fileno(rf->fp), 0);
+	if (rf->map == MAP_FAILED) {
+		rf->map = NULL;
+		return NULL;
+	}
+#endif
+
+	return rf->map;
+}
+
+/*
+ * パッケージ内のファイルの内容のハッシュを取得する
+ */
+bool get_rfile_hash(struct rfile *rf, uint64_t *hash)
+{
+	assert(rf != NULL);
+
+	if (!rf->is_packaged || !has_entry_hash)
+		return false;
+
+	*hash = entry[rf->index].hash;
+	return true;
+}
+
 /*
  * ファイル読み込みストリームを閉じる
  */
@@ -405,6 +748,19 @@ void close_rfile(struct rfile *rf)
 	assert(rf != NULL);
 	assert(rf->fp != NULL);
 
+	if (rf->map != NULL) {
+#ifdef WIN
+		UnmapViewOfFile(rf->map);
+		CloseHandle(rf->map_handle);
+#else
+		munmap(rf->map, rf->map_size);
+#endif
+	}
+	if (rf->is_deflated) {
+		inflateEnd(&rf->z);
+		free(rf->zbuf);
+	}
+	free(rf->key_checkpoint);
 	fclose(rf->fp);
 	free(rf);
 }
@@ -414,14 +770,6 @@ static void set_random_seed(uint64_t index, uint64_t *next_random)
 {
 	uint64_t i, next, lsb;
 
-	key_reversed = ((((key_obfuscated >> 56) & 0xff) << 0) |
-			(((key_obfuscated >> 48) & 0xff) << 8) |
-			(((key_obfuscated >> 40) & 0xff) << 16) |
-			(((key_obfuscated >> 32) & 0xff) << 24) |
-			(((key_obfuscated >> 24) & 0xff) << 32) |
-			(((key_obfuscated >> 16) & 0xff) << 40) |
-			(((key_obfuscated >> 8)  & 0xff) << 48) |
-			(((key_obfuscated >> 0)  & 0xff) << 56));
 	next = ~(*key_ref);
 	for (i = 0; i < index; i++) {
 		next ^= 0xafcb8f2ff4fff33f;
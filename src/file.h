@@ -8,6 +8,13 @@
 /*
  * [Changes]
  *  - 2016/06/28 作成
+ *  - 2026/10/19 パッケージのエントリ単位の圧縮に対応
+ *  - 2026/10/19 パッケージの差分作成のために更新時刻を追加
+ *  - 2026/10/19 同一内容のファイルの重複排除に対応
+ *  - 2026/10/19 生ピクセル形式のイメージのフラグを追加
+ *  - 2026/10/19 ファイルのメモリマップに対応
+ *  - 2026/10/19 パッケージ内のファイルのハッシュの取得に対応
+ *  - 2026/10/19 ファイル読み込みストリームのシークに対応
  */
 
 #ifndef SUIKA_FILE_H
@@ -18,6 +25,7 @@
 /*
  * [Archive File Design]
  * 
+ * Version 1:
  * struct header {
  *     u64 file_count;
  *     struct file_entry {
@@ -27,8 +35,53 @@
  *     } [file_count];
  * };
  * u8 file_body[file_count][file_length]; // Encrypted
+ *
+ * Version 2:
+ * struct header {
+ *     u64 magic;              // PACKAGE_MAGIC_V2
+ *     u64 file_count;
+ *     struct file_entry {
+ *         u8  file_name[256]; // Encrypted
+ *         u64 file_size;      // Size after decompression
+ *         u64 file_offset;
+ *         u64 stored_size;    // Size in the archive
+ *         u64 flags;          // FILE_ENTRY_*
+ *         u64 mtime;          // Used only by incremental build
+ *         u64 hash;           // Hash of the uncompressed content
+ *         u64 key_index;      // Index of the keystream for the body
+ *     } [file_count];
+ * };
+ * u8 file_body[][stored_size]; // Compressed, then encrypted
+ *
+ * Entries with identical contents share one body. The body is encrypted
+ * with the keystream of the entry "key_index", not with the entry's own.
  */
 
+/*
+ * パッケージのバージョン2を示すマジックナンバー ("SUIKAPK2")
+ *  - バージョン1の先頭はファイル数なのでFILE_ENTRY_SIZEを超えない
+ */
+#define PACKAGE_MAGIC_V2	(0x324b50414b495553ULL)
+
+/*
+ * パッケージのファイルエントリのフラグ
+ */
+
+/* ファイルの本体がdeflateで圧縮されている */
+#define FILE_ENTRY_DEFLATE	(1)
+
+/* ファイルの本体がPNGから変換された生ピクセル形式である(パッケージ作成用) */
+#define FILE_ENTRY_RAW_IMAGE	(2)
+
+/* 生ピクセル形式のピクセル値がABGRである(パッケージ作成用) */
+#define FILE_ENTRY_RAW_ABGR	(4)
+
+/*
+ * 圧縮に用いるdeflateのウィンドウサイズ(2の冪数)
+ *  - 展開時のメモリを小さくするため、zlibの既定値(15)より小さくする
+ */
+#define FILE_DEFLATE_WBITS	(13)
+
 /*
  * パッケージファイル名
  */
@@ -56,6 +109,21 @@ struct file_entry {
 
 	/* パッケージ内のファイルオフセット */
 	uint64_t offset;
+
+	/* パッケージ内に格納されたサイズ(圧縮後のサイズ) */
+	uint64_t stored_size;
+
+	/* フラグ(FILE_ENTRY_*) */
+	uint64_t flags;
+
+	/* 元のファイルの更新時刻(パッケージの差分作成に用いる) */
+	uint64_t mtime;
+
+	/* 展開後の内容のハッシュ(重複排除に用いる) */
+	uint64_t hash;
+
+	/* 本体の難読化に用いた乱数系列のエントリ番号 */
+	uint64_t key_index;
 };
 
 /*
@@ -98,6 +166,26 @@ size_t read_rfile(struct rfile *rf, void *buf, size_t size);
  */
 const char *gets_rfile(struct rfile *rf, char *buf, size_t size);
 
+/*
+ * ファイル読み込みストリームの読み込み位置を設定する
+ *  - パッケージ内の圧縮されたファイルではfalseを返す
+ */
+bool seek_rfile(struct rfile *rf, uint64_t pos);
+
+/*
+ * ファイルをメモリにマップする
+ *  - マップできない場合(パッケージ内のファイルなど)はNULLを返す
+ *  - サイズはget_rfile_size()で取得する
+ *  - マップはclose_rfile()で解除される
+ */
+const void *map_rfile(struct rfile *rf);
+
+/*
+ * パッケージ内のファイルの内容のハッシュ(FNV-1a)を取得する
+ *  - パッケージ外のファイルとバージョン1のパッケージではfalseを返す
+ */
+bool get_rfile_hash(struct rfile *rf, uint64_t *hash);
+
 /*
  * ファイル読み込みストリームを閉じる
  */
@@ -11,6 +11,12 @@
  * [Changes]
  *  - 2016/06/18 作成
  *  - 2021/07/28 フォントのアウトラインを描画するように変更
+ *  - 2026/10/19 フォントファイルをメモリマップで読み込むように変更
+ *  - 2026/10/19 ラスタライズ済みのグリフをキャッシュするように変更
+ *  - 2026/10/19 文字の幅をキャッシュするように変更
+ *  - 2026/10/19 グリフを別スレッドで先読みするように変更
+ *  - 2026/10/19 アウトラインと中身を1パスで合成するように変更
+ *  - 2026/10/19 パッケージ内のフォントファイルをストリームで読むように変更
  */
 
 #include "suika.h"
@@ -27,8 +33,35 @@
 #include <freetype/ftstroke.h>
 #endif
 
+/* グリフの先読みをスレッドで行うか */
+#if !defined(EM) && !defined(SWITCH)
+#define PREWARM_THREAD
+#ifdef WIN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
 #define SCALE	(64)
 
+/* グリフキャッシュのハッシュ表のサイズ */
+#define GLYPH_CACHE_BUCKETS		(1024)
+
+/* グリフキャッシュの容量のデフォルト値 */
+#define GLYPH_CACHE_DEFAULT_LIMIT	(4 * 1024 * 1024)
+
+/* 1文字あたりのビットマップの最大数 (アウトライン内側, 外側, 中身) */
+#define GLYPH_BITMAP_COUNT		(GLYPH_LAYER_MAX)
+
+/* 幅を配列に保持する文字の範囲 (ASCII, CJKの記号とかな) */
+#define ADVANCE_ASCII_END		(0x80)
+#define ADVANCE_KANA_BEGIN		(0x3000)
+#define ADVANCE_KANA_END		(0x3100)
+
+/* 上記以外の文字の幅を保持するハッシュ表のサイズ (2の累乗) */
+#define ADVANCE_HASH_SIZE		(4096)
+
 /* フォントファイル名 */
 static char *font_file;
 
@@ -38,21 +71,156 @@ static bool is_initialized;
 /* FreeType2のオブジェクト */
 static FT_Library library;
 static FT_Face face;
-static FT_Byte *font_file_content;
+
+/* フォントファイルの内容 (マップもしくはヒープ上、ストリームの場合はNULL) */
+static const FT_Byte *font_file_data;
 static FT_Long font_file_size;
 
+/* マップ中もしくはストリームで読み込み中のフォントファイル */
+static struct rfile *font_rfile;
+
+/* フォントファイルを読み込むストリーム */
+static FT_StreamRec font_stream;
+
+/* ヒープに読み込んだフォントファイルの内容 (マップできない場合) */
+static FT_Byte *font_file_content;
+
+/* 読み込み済みのフォントファイル名 */
+static char *loaded_font_file;
+
+/* アウトライン描画用のストローカ */
+static FT_Stroker stroker;
+
+/* グリフのビットマップ */
+struct glyph_bitmap {
+	unsigned char *buf;
+	int width;
+	int rows;
+	int left;
+	int top;
+};
+
+/* グリフキャッシュのエントリ */
+struct glyph_cache {
+	/* キー */
+	uint32_t codepoint;
+	int size;
+	bool outline;
+
+	/* 描画した際の幅と高さ */
+	int w;
+	int h;
+
+	/* ビットマップ (描画順) */
+	int bitmap_count;
+	struct glyph_bitmap bitmap[GLYPH_BITMAP_COUNT];
+
+	/* エントリとビットマップの合計サイズ */
+	size_t bytes;
+
+	/* ハッシュ表のチェイン */
+	struct glyph_cache *hash_next;
+
+	/* LRUリスト (先頭が最も新しい) */
+	struct glyph_cache *lru_prev;
+	struct glyph_cache *lru_next;
+};
+
+/* グリフキャッシュ */
+static struct glyph_cache *glyph_cache_bucket[GLYPH_CACHE_BUCKETS];
+static struct glyph_cache *glyph_cache_lru_head;
+static struct glyph_cache *glyph_cache_lru_tail;
+static size_t glyph_cache_bytes;
+
+/* グリフキャッシュのヒット数とミス数 */
+static uint64_t glyph_cache_hit;
+static uint64_t glyph_cache_miss;
+
+/* 文字の幅のキャッシュ (-1は未取得) */
+static int advance_ascii[ADVANCE_ASCII_END];
+static int advance_kana[ADVANCE_KANA_END - ADVANCE_KANA_BEGIN];
+
+/* 上記以外の文字の幅のキャッシュ (コードポイント0は空き) */
+static struct advance_entry {
+	uint32_t codepoint;
+	int advance;
+} advance_hash[ADVANCE_HASH_SIZE];
+static int advance_hash_count;
+
+#ifdef PREWARM_THREAD
+/* グリフキャッシュのロック (先読みスレッドの実行中のみ用いる) */
+#ifdef WIN
+static CRITICAL_SECTION glyph_cache_lock;
+static bool is_glyph_cache_lock_initialized;
+#else
+static pthread_mutex_t glyph_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* 先読みスレッド */
+#ifdef WIN
+static HANDLE prewarm_handle;
+#else
+static pthread_t prewarm_tid;
+#endif
+
+/* 先読みスレッドを開始したか */
+static bool is_prewarm_running;
+
+/* 先読みを中止するか */
+static volatile bool prewarm_stop;
+
+/* 先読みする文字のリスト */
+static uint32_t *prewarm_codepoints;
+static int prewarm_count;
+
+/* 先読みする文字のサイズとアウトラインの有無 */
+static int prewarm_size;
+static bool prewarm_outline;
+
+/* 先読みで用いるキャッシュの容量 */
+static size_t prewarm_limit;
+#endif
+
 /*
  * 前方参照
  */
+static void release_font(void);
 static bool read_font_file_content(void);
-static bool draw_glyph_without_outline(struct image *img, int x, int y,
-				       pixel_t color, uint32_t codepoint,
-				       int *w, int *h);
-static void draw_glyph_func(unsigned char * RESTRICT font, int font_width,
-			    int font_height, int margin_left, int margin_top,
-			    pixel_t * RESTRICT image, int image_width,
-			    int image_height, int image_x, int image_y,
-			    pixel_t color);
+static FT_Error open_font_face(FT_Library lib, FT_Stream stream,
+			       struct rfile *rf, FT_Face *f);
+static unsigned long read_font_stream(FT_Stream stream, unsigned long offset,
+				      unsigned char *buffer,
+				      unsigned long count);
+static struct glyph_cache *get_glyph_cache(uint32_t codepoint);
+static struct glyph_cache *find_glyph_cache(uint32_t codepoint, int size,
+					    bool outline);
+static void insert_glyph_cache(struct glyph_cache *gc);
+static struct glyph_cache *rasterize_glyph(FT_Face f, FT_Stroker st,
+					   uint32_t codepoint, int size,
+					   bool outline);
+static size_t get_glyph_cache_limit(void);
+static void link_glyph_cache_lru(struct glyph_cache *gc);
+static void unlink_glyph_cache_lru(struct glyph_cache *gc);
+static void remove_glyph_cache(struct glyph_cache *gc);
+static void clear_glyph_cache(void);
+static int *get_advance_slot(uint32_t codepoint);
+static int load_advance(uint32_t codepoint);
+static void clear_advance_cache(void);
+static void stop_prewarm(void);
+#ifdef PREWARM_THREAD
+#ifdef WIN
+static DWORD WINAPI prewarm_thread(LPVOID param);
+#else
+static void *prewarm_thread(void *param);
+#endif
+static void run_prewarm(void);
+#endif
+static void lock_glyph_cache(void);
+static void unlock_glyph_cache(void);
+static void draw_glyph_func(const struct glyph_layer * RESTRICT layer,
+			    int layer_count, pixel_t * RESTRICT image,
+			    int image_width, int image_height, int image_x,
+			    int image_y);
 
 /*
  * フォントレンダラの初期化処理を行う
@@ -61,20 +229,26 @@ bool init_glyph(void)
 {
 	FT_Error err;
 
-	/* Android用, もしくはフォント変更時用 */
-	if (face != NULL) {
-		FT_Done_Face(face);
-		face = NULL;
-	}
-	if (library != NULL) {
-		FT_Done_FreeType(library);
-		library = NULL;
-	}
-	if (font_file_content != NULL) {
-		free(font_file_content);
-		font_file_content = NULL;
+	/* フォントか文字サイズが変わりうるのでキャッシュを空にする */
+	stop_prewarm();
+	clear_glyph_cache();
+	clear_advance_cache();
+
+	/* 同じフォントファイルが読み込み済みであれば再利用する */
+	if (face != NULL && loaded_font_file != NULL &&
+	    strcmp(loaded_font_file, font_file) == 0) {
+		err = FT_Set_Pixel_Sizes(face, 0, (FT_UInt)conf_font_size);
+		if (err != 0) {
+			log_api_error("FT_Set_Pixel_Sizes");
+			return false;
+		}
+		is_initialized = true;
+		return true;
 	}
 
+	/* Android用, もしくはフォント変更時用 */
+	release_font();
+
 	/* FreeType2ライブラリを初期化する */
 	err = FT_Init_FreeType(&library);
 	if (err != 0) {
@@ -87,13 +261,19 @@ bool init_glyph(void)
 		return false;
 	
 	/* フォントファイルを読み込む */
-	err = FT_New_Memory_Face(library, font_file_content, font_file_size,
-				 0, &face);
+	err = open_font_face(library, &font_stream, font_rfile, &face);
 	if (err != 0) {
 		log_font_file_error(conf_font_file);
 		return false;
 	}
 
+	/* 読み込み済みのフォントファイル名を保存する */
+	loaded_font_file = strdup(font_file);
+	if (loaded_font_file == NULL) {
+		log_memory();
+		return false;
+	}
+
 	/* 文字サイズをセットする */
 	err = FT_Set_Pixel_Sizes(face, 0, (FT_UInt)conf_font_size);
 	if (err != 0) {
@@ -101,12 +281,57 @@ bool init_glyph(void)
 		return false;
 	}
 
+	/* アウトライン描画用のストローカを作成する */
+	err = FT_Stroker_New(library, &stroker);
+	if (err != 0) {
+		log_api_error("FT_Stroker_New");
+		return false;
+	}
+	FT_Stroker_Set(stroker, 2*64, FT_STROKER_LINECAP_ROUND,
+		       FT_STROKER_LINEJOIN_ROUND, 0);
+
 	/* 成功 */
 	is_initialized = true;
 	return true;
 }
 
-/* フォントファイルの内容を読み込む */
+/* フォントのオブジェクトとフォントファイルの内容を解放する */
+static void release_font(void)
+{
+	if (stroker != NULL) {
+		FT_Stroker_Done(stroker);
+		stroker = NULL;
+	}
+	if (face != NULL) {
+		FT_Done_Face(face);
+		face = NULL;
+	}
+	if (library != NULL) {
+		FT_Done_FreeType(library);
+		library = NULL;
+	}
+	if (font_rfile != NULL) {
+		close_rfile(font_rfile);
+		font_rfile = NULL;
+	}
+	if (font_file_content != NULL) {
+		free(font_file_content);
+		font_file_content = NULL;
+	}
+	font_file_data = NULL;
+	if (loaded_font_file != NULL) {
+		free(loaded_font_file);
+		loaded_font_file = NULL;
+	}
+}
+
+/*
+ * フォントファイルの内容を読み込む
+ *  - マップできる場合はマップし、ファイルを開いたままにする
+ *  - パッケージ内の圧縮されていないファイルは、開いたままにしてストリーム
+ *    で読む
+ *  - どちらもできない場合(古いパッケージなど)はヒープに読み込む
+ */
 static bool read_font_file_content(void)
 {
 	struct rfile *rf;
@@ -125,6 +350,19 @@ static bool read_font_file_content(void)
 		return false;
 	}
 
+	/* マップできる場合はマップしたメモリを用いる */
+	font_file_data = map_rfile(rf);
+	if (font_file_data != NULL) {
+		font_rfile = rf;
+		return true;
+	}
+
+	/* シークできる場合はストリームで読む */
+	if (seek_rfile(rf, 0)) {
+		font_rfile = rf;
+		return true;
+	}
+
 	/* メモリを確保する */
 	font_file_content = malloc((size_t)font_file_size);
 	if (font_file_content == NULL) {
@@ -136,7 +374,8 @@ static bool read_font_file_content(void)
 	/* ファイルの内容を読み込む */
 	remain = font_file_size;
 	while (remain > 0) {
-		block = (FT_Long)read_rfile(rf, font_file_content,
+		block = (FT_Long)read_rfile(rf, font_file_content +
+					    (font_file_size - remain),
 					    (size_t)remain);
 		if (block == 0)
 			break;
@@ -149,29 +388,64 @@ static bool read_font_file_content(void)
 		return false;
 	}
 	close_rfile(rf);
+	font_file_data = font_file_content;
 
 	return true;
 }
 
 /*
- * フォントレンダラの終了処理を行う
+ * フォントのフェイスを作成する
+ *  - フォントファイルの内容がメモリ上にない場合はstreamでrfから読み込む
+ *  - streamとrfはフェイスを破棄するまで有効でなければならない
  */
-void cleanup_glyph(void)
+static FT_Error open_font_face(FT_Library lib, FT_Stream stream,
+			       struct rfile *rf, FT_Face *f)
 {
-	if (face != NULL) {
-		FT_Done_Face(face);
-		face = NULL;
-	}
+	FT_Open_Args args;
 
-	if (library != NULL) {
-		FT_Done_FreeType(library);
-		library = NULL;
+	if (font_file_data != NULL) {
+		return FT_New_Memory_Face(lib, font_file_data, font_file_size,
+					  0, f);
 	}
 
-	if (font_file_content != NULL) {
-		free(font_file_content);
-		font_file_content = NULL;
-	}
+	memset(stream, 0, sizeof(FT_StreamRec));
+	stream->size = (unsigned long)font_file_size;
+	stream->descriptor.pointer = rf;
+	stream->read = read_font_stream;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = FT_OPEN_STREAM;
+	args.stream = stream;
+	return FT_Open_Face(lib, &args, 0, f);
+}
+
+/*
+ * FreeType2のストリームの読み込み関数
+ *  - countが0の場合はシークのみを行い、成功すれば0を返す
+ */
+static unsigned long read_font_stream(FT_Stream stream, unsigned long offset,
+				      unsigned char *buffer,
+				      unsigned long count)
+{
+	struct rfile *rf;
+
+	rf = stream->descriptor.pointer;
+	if (!seek_rfile(rf, offset))
+		return count == 0 ? 1 : 0;
+	if (count == 0)
+		return 0;
+
+	return (unsigned long)read_rfile(rf, buffer, count);
+}
+
+/*
+ * フォントレンダラの終了処理を行う
+ */
+void cleanup_glyph(void)
+{
+	stop_prewarm();
+	clear_glyph_cache();
+	release_font();
 
 	free(font_file);
 	font_file = NULL;
@@ -278,14 +552,71 @@ int utf8_chars(const char *mbs)
  */
 int get_glyph_width(uint32_t codepoint)
 {
-	int w, h;
+	int *slot;
+
+	/* キャッシュされていればそれを返す */
+	slot = get_advance_slot(codepoint);
+	if (slot != NULL && *slot != -1)
+		return *slot;
+
+	/* ラスタライズせずにグリフを読み込んで幅を求める */
+	if (slot == NULL)
+		return load_advance(codepoint);
+	*slot = load_advance(codepoint);
+	return *slot;
+}
+
+/* 文字の幅のキャッシュの格納場所を取得する(ハッシュ表が満杯ならNULL) */
+static int *get_advance_slot(uint32_t codepoint)
+{
+	uint32_t i;
+
+	/* 配列に保持する文字の場合 */
+	if (codepoint < ADVANCE_ASCII_END)
+		return &advance_ascii[codepoint];
+	if (codepoint >= ADVANCE_KANA_BEGIN && codepoint < ADVANCE_KANA_END)
+		return &advance_kana[codepoint - ADVANCE_KANA_BEGIN];
+
+	/* ハッシュ表を線形探査する */
+	i = (codepoint * 2654435761U) & (ADVANCE_HASH_SIZE - 1);
+	while (advance_hash[i].codepoint != 0) {
+		if (advance_hash[i].codepoint == codepoint)
+			return &advance_hash[i].advance;
+		i = (i + 1) & (ADVANCE_HASH_SIZE - 1);
+	}
 
-	w = h = 0;
+	/* 使用率が3/4を超える場合は追加しない */
+	if (advance_hash_count >= ADVANCE_HASH_SIZE / 4 * 3)
+		return NULL;
 
-	/* 幅を求める */
-	draw_glyph(NULL, 0, 0, 0, 0, codepoint, &w, &h);
+	advance_hash[i].codepoint = codepoint;
+	advance_hash[i].advance = -1;
+	advance_hash_count++;
+	return &advance_hash[i].advance;
+}
 
-	return w;
+/* グリフを読み込んで文字の幅を求める */
+static int load_advance(uint32_t codepoint)
+{
+	FT_Error err;
+
+	err = FT_Load_Glyph(face, FT_Get_Char_Index(face, codepoint),
+			    FT_LOAD_DEFAULT);
+	if (err != 0) {
+		log_api_error("FT_Load_Glyph");
+		return 0;
+	}
+
+	return (int)face->glyph->advance.x / SCALE;
+}
+
+/* 文字の幅のキャッシュを空にする */
+static void clear_advance_cache(void)
+{
+	memset(advance_ascii, 0xff, sizeof(advance_ascii));
+	memset(advance_kana, 0xff, sizeof(advance_kana));
+	memset(advance_hash, 0, sizeof(advance_hash));
+	advance_hash_count = 0;
 }
 
 /*
@@ -320,134 +651,524 @@ int get_utf8_width(const char *mbs)
 bool draw_glyph(struct image *img, int x, int y, pixel_t color,
 		pixel_t outline_color, uint32_t codepoint, int *w, int *h)
 {
-	FT_Stroker stroker;
-	FT_UInt glyphIndex;
-	FT_Glyph glyph;
-	FT_BitmapGlyph bitmapGlyph;
-	int descent;
-
-	if (conf_font_outline_remove) {
-		return draw_glyph_without_outline(img, x, y, color, codepoint,
-						  w, h);
-	}
-
-	/* アウトライン(内側)を描画する */
-	FT_Stroker_New(library, &stroker);
-	FT_Stroker_Set(stroker, 2*64, FT_STROKER_LINECAP_ROUND, FT_STROKER_LINEJOIN_ROUND, 0);
-	glyphIndex = FT_Get_Char_Index(face, codepoint);
-	FT_Load_Glyph(face, glyphIndex, FT_LOAD_DEFAULT);
-	FT_Get_Glyph(face->glyph, &glyph);
-	FT_Glyph_StrokeBorder(&glyph, stroker, true, true);
-	FT_Glyph_To_Bitmap(&glyph, FT_RENDER_MODE_NORMAL, NULL, true);
-	bitmapGlyph = (FT_BitmapGlyph)glyph;
-	if (img != NULL) {
-		draw_glyph_func(bitmapGlyph->bitmap.buffer,
-				(int)bitmapGlyph->bitmap.width,
-				(int)bitmapGlyph->bitmap.rows,
-				bitmapGlyph->left,
-				conf_font_size - bitmapGlyph->top,
-				get_image_pixels(img),
-				get_image_width(img),
-				get_image_height(img),
-				x,
-				y,
-				outline_color);
-	}
-	FT_Done_Glyph(glyph);
-	FT_Stroker_Done(stroker);
-
-	/* アウトライン(外側)を描画する */
-	FT_Stroker_New(library, &stroker);
-	FT_Stroker_Set(stroker, 2*64, FT_STROKER_LINECAP_ROUND, FT_STROKER_LINEJOIN_ROUND, 0);
-	glyphIndex = FT_Get_Char_Index(face, codepoint);
-	FT_Load_Glyph(face, glyphIndex, FT_LOAD_DEFAULT);
-	FT_Get_Glyph(face->glyph, &glyph);
-	FT_Glyph_StrokeBorder(&glyph, stroker, false, true);
-	FT_Glyph_To_Bitmap(&glyph, FT_RENDER_MODE_NORMAL, NULL, true);
-	bitmapGlyph = (FT_BitmapGlyph)glyph;
-	if (img != NULL) {
-		draw_glyph_func(bitmapGlyph->bitmap.buffer,
-				(int)bitmapGlyph->bitmap.width,
-				(int)bitmapGlyph->bitmap.rows,
-				bitmapGlyph->left,
-				conf_font_size - bitmapGlyph->top,
-				get_image_pixels(img),
-				get_image_width(img),
-				get_image_height(img),
-				x,
-				y,
-				outline_color);
-	}
-	descent = (int)(face->glyph->metrics.height / SCALE) -
-		  (int)(face->glyph->metrics.horiBearingY / SCALE);
-	*w = (int)face->glyph->advance.x / SCALE;
-	*h = conf_font_size + descent + 2;
-	FT_Done_Glyph(glyph);
-	FT_Stroker_Done(stroker);
+	struct glyph_layer layer[GLYPH_BITMAP_COUNT];
+	struct glyph_cache *gc;
+	int i;
+
+	/* キャッシュからラスタライズ済みのグリフを取得する */
+	gc = get_glyph_cache(codepoint);
+	if (gc == NULL)
+		return false;
+
+	/* 描画した幅と高さを返す */
+	*w = gc->w;
+	*h = gc->h;
 	if (img == NULL)
 		return true;
 
-	/* 中身を描画する */
-	glyphIndex = FT_Get_Char_Index(face, codepoint);
-	FT_Load_Glyph(face, glyphIndex, FT_LOAD_DEFAULT);
-	FT_Get_Glyph(face->glyph, &glyph);
-	FT_Glyph_To_Bitmap(&glyph, FT_RENDER_MODE_NORMAL, NULL, true);
-	bitmapGlyph = (FT_BitmapGlyph)glyph;
-	draw_glyph_func(bitmapGlyph->bitmap.buffer,
-			(int)bitmapGlyph->bitmap.width,
-			(int)bitmapGlyph->bitmap.rows,
-			bitmapGlyph->left,
-			conf_font_size - bitmapGlyph->top,
-			get_image_pixels(img),
-			get_image_width(img),
-			get_image_height(img),
-			x,
-			y,
-			color);
-	FT_Done_Glyph(glyph);
+	/* アウトライン(内側, 外側)と中身の順に1パスで合成する */
+	for (i = 0; i < gc->bitmap_count; i++) {
+		layer[i].buf = gc->bitmap[i].buf;
+		layer[i].width = gc->bitmap[i].width;
+		layer[i].height = gc->bitmap[i].rows;
+		layer[i].left = gc->bitmap[i].left;
+		layer[i].top = conf_font_size - gc->bitmap[i].top;
+		layer[i].color = i == gc->bitmap_count - 1 ? color :
+			outline_color;
+	}
+	draw_glyph_func(layer, gc->bitmap_count, get_image_pixels(img),
+			get_image_width(img), get_image_height(img), x, y);
 
 	/* 成功 */
 	return true;
 }
 
-static bool draw_glyph_without_outline(struct image *img, int x, int y,
-				       pixel_t color, uint32_t codepoint,
-				       int *w, int *h)
+/*
+ * グリフキャッシュ
+ */
+
+/* グリフキャッシュのエントリを取得する(なければラスタライズする) */
+static struct glyph_cache *get_glyph_cache(uint32_t codepoint)
 {
-	FT_Error err;
-	int descent;
+	struct glyph_cache *gc, *found;
+	bool outline;
+
+	outline = !conf_font_outline_remove;
+
+	/* ハッシュ表を検索する */
+	lock_glyph_cache();
+	gc = find_glyph_cache(codepoint, conf_font_size, outline);
+	if (gc != NULL) {
+		/* LRUリストの先頭に移動する */
+		unlink_glyph_cache_lru(gc);
+		link_glyph_cache_lru(gc);
+		glyph_cache_hit++;
+		unlock_glyph_cache();
+		return gc;
+	}
+	glyph_cache_miss++;
+	unlock_glyph_cache();
+
+	/* ラスタライズする */
+	gc = rasterize_glyph(face, stroker, codepoint, conf_font_size, outline);
+	if (gc == NULL) {
+		log_api_error("FT_Load_Glyph");
+		return NULL;
+	}
 
-	/* 文字をグレースケールビットマップとして取得する */
-	err = FT_Load_Char(face, codepoint, FT_LOAD_RENDER);
-	if (err != 0) {
-		log_api_error("FT_Load_Char");
-		return false;
+	/* 先読みスレッドが先に追加した場合はそれを用いる */
+	lock_glyph_cache();
+	found = find_glyph_cache(codepoint, conf_font_size, outline);
+	if (found != NULL) {
+		unlock_glyph_cache();
+		free(gc);
+		return found;
 	}
 
-	/* 文字のビットマップを対象イメージに描画する */
-	if (img != NULL) {
-		draw_glyph_func(face->glyph->bitmap.buffer,
-				(int)face->glyph->bitmap.width,
-				(int)face->glyph->bitmap.rows,
-				face->glyph->bitmap_left,
-				conf_font_size - face->glyph->bitmap_top,
-				get_image_pixels(img),
-				get_image_width(img),
-				get_image_height(img),
-				x,
-				y,
-				color);
+	/* ハッシュ表とLRUリストに追加する */
+	insert_glyph_cache(gc);
+
+	/* 容量を超えた場合は最も古いエントリから削除する */
+	while (glyph_cache_bytes > get_glyph_cache_limit() &&
+	       glyph_cache_lru_tail != gc)
+		remove_glyph_cache(glyph_cache_lru_tail);
+	unlock_glyph_cache();
+
+	return gc;
+}
+
+/* グリフキャッシュのエントリを検索する */
+static struct glyph_cache *find_glyph_cache(uint32_t codepoint, int size,
+					    bool outline)
+{
+	struct glyph_cache *gc;
+	int bucket;
+
+	bucket = (int)((codepoint ^ ((uint32_t)size << 16)) %
+		       GLYPH_CACHE_BUCKETS);
+	for (gc = glyph_cache_bucket[bucket]; gc != NULL; gc = gc->hash_next) {
+		if (gc->codepoint == codepoint && gc->size == size &&
+		    gc->outline == outline)
+			return gc;
 	}
+	return NULL;
+}
 
-	/* descentを求める */
-	descent = (int)(face->glyph->metrics.height / SCALE) -
-		  (int)(face->glyph->metrics.horiBearingY / SCALE);
+/* グリフキャッシュのエントリをハッシュ表とLRUリストに追加する */
+static void insert_glyph_cache(struct glyph_cache *gc)
+{
+	int bucket;
+
+	bucket = (int)((gc->codepoint ^ ((uint32_t)gc->size << 16)) %
+		       GLYPH_CACHE_BUCKETS);
+	gc->hash_next = glyph_cache_bucket[bucket];
+	glyph_cache_bucket[bucket] = gc;
+	link_glyph_cache_lru(gc);
+	glyph_cache_bytes += gc->bytes;
+}
 
-	/* 描画した幅と高さを求める */
-	*w = (int)face->glyph->advance.x / SCALE;
-	*h = conf_font_size + descent;
+/*
+ * グリフをラスタライズしてキャッシュのエントリを作成する
+ *  - 先読みスレッドからも呼ばれるので、ログを出力しない
+ */
+static struct glyph_cache *rasterize_glyph(FT_Face f, FT_Stroker st,
+					   uint32_t codepoint, int size,
+					   bool outline)
+{
+	FT_Glyph glyph[GLYPH_BITMAP_COUNT];
+	FT_BitmapGlyph bitmap_glyph;
+	struct glyph_cache *gc;
+	unsigned char *p;
+	size_t bytes;
+	int count, descent, i, row;
+	int left, top, right, bottom, bw, bh, bx, by;
+	bool found;
+
+	/* グリフを読み込む */
+	if (FT_Load_Glyph(f, FT_Get_Char_Index(f, codepoint),
+			  FT_LOAD_DEFAULT) != 0)
+		return NULL;
+
+	/* アウトライン(内側, 外側)と中身のグリフを作成する */
+	count = 0;
+	if (outline) {
+		if (FT_Get_Glyph(f->glyph, &glyph[count]) == 0) {
+			FT_Glyph_StrokeBorder(&glyph[count], st, true, true);
+			count++;
+		}
+		if (FT_Get_Glyph(f->glyph, &glyph[count]) == 0) {
+			FT_Glyph_StrokeBorder(&glyph[count], st, false, true);
+			count++;
+		}
+	}
+	if (FT_Get_Glyph(f->glyph, &glyph[count]) == 0)
+		count++;
 
-	return true;
+	/*
+	 * ビットマップに変換して全てを囲む矩形を求める
+	 *  - 1パスで合成できるように全てのビットマップをこの矩形に揃える
+	 */
+	left = top = right = bottom = 0;
+	found = false;
+	for (i = 0; i < count; i++) {
+		FT_Glyph_To_Bitmap(&glyph[i], FT_RENDER_MODE_NORMAL, NULL,
+				   true);
+		bitmap_glyph = (FT_BitmapGlyph)glyph[i];
+		if (bitmap_glyph->bitmap.width == 0 ||
+		    bitmap_glyph->bitmap.rows == 0)
+			continue;
+		bx = bitmap_glyph->left;
+		by = -bitmap_glyph->top;
+		bw = (int)bitmap_glyph->bitmap.width;
+		bh = (int)bitmap_glyph->bitmap.rows;
+		if (!found || bx < left)
+			left = bx;
+		if (!found || by < top)
+			top = by;
+		if (!found || bx + bw > right)
+			right = bx + bw;
+		if (!found || by + bh > bottom)
+			bottom = by + bh;
+		found = true;
+	}
+	bw = right - left;
+	bh = bottom - top;
+	bytes = sizeof(struct glyph_cache) +
+		(size_t)count * (size_t)bw * (size_t)bh;
+
+	/* エントリを確保する(ビットマップはエントリの後ろに格納する) */
+	gc = malloc(bytes);
+	if (gc == NULL) {
+		for (i = 0; i < count; i++)
+			FT_Done_Glyph(glyph[i]);
+		return NULL;
+	}
+	gc->codepoint = codepoint;
+	gc->size = size;
+	gc->outline = outline;
+	gc->bitmap_count = count;
+	gc->bytes = bytes;
+
+	/* ビットマップを矩形内の位置にコピーする */
+	p = (unsigned char *)(gc + 1);
+	for (i = 0; i < count; i++) {
+		bitmap_glyph = (FT_BitmapGlyph)glyph[i];
+		gc->bitmap[i].buf = p;
+		gc->bitmap[i].width = bw;
+		gc->bitmap[i].rows = bh;
+		gc->bitmap[i].left = left;
+		gc->bitmap[i].top = -top;
+		memset(p, 0, (size_t)bw * (size_t)bh);
+		bx = bitmap_glyph->left - left;
+		by = -bitmap_glyph->top - top;
+		for (row = 0; row < (int)bitmap_glyph->bitmap.rows &&
+			     bitmap_glyph->bitmap.width > 0; row++) {
+			memcpy(p + (by + row) * bw + bx,
+			       bitmap_glyph->bitmap.buffer +
+			       row * bitmap_glyph->bitmap.pitch,
+			       (size_t)bitmap_glyph->bitmap.width);
+		}
+		p += bw * bh;
+		FT_Done_Glyph(glyph[i]);
+	}
+
+	/* 描画した際の幅と高さを求める */
+	descent = (int)(f->glyph->metrics.height / SCALE) -
+		  (int)(f->glyph->metrics.horiBearingY / SCALE);
+	gc->w = (int)f->glyph->advance.x / SCALE;
+	gc->h = size + descent + (outline ? 2 : 0);
+
+	return gc;
+}
+
+/* グリフキャッシュの容量を取得する */
+static size_t get_glyph_cache_limit(void)
+{
+	if (conf_font_cache_size > 0)
+		return (size_t)conf_font_cache_size * 1024;
+	return GLYPH_CACHE_DEFAULT_LIMIT;
+}
+
+/* グリフキャッシュのエントリをLRUリストの先頭に追加する */
+static void link_glyph_cache_lru(struct glyph_cache *gc)
+{
+	gc->lru_prev = NULL;
+	gc->lru_next = glyph_cache_lru_head;
+	if (glyph_cache_lru_head != NULL)
+		glyph_cache_lru_head->lru_prev = gc;
+	else
+		glyph_cache_lru_tail = gc;
+	glyph_cache_lru_head = gc;
+}
+
+/* グリフキャッシュのエントリをLRUリストから外す */
+static void unlink_glyph_cache_lru(struct glyph_cache *gc)
+{
+	if (gc->lru_prev != NULL)
+		gc->lru_prev->lru_next = gc->lru_next;
+	else
+		glyph_cache_lru_head = gc->lru_next;
+	if (gc->lru_next != NULL)
+		gc->lru_next->lru_prev = gc->lru_prev;
+	else
+		glyph_cache_lru_tail = gc->lru_prev;
+}
+
+/* グリフキャッシュのエントリを削除する */
+static void remove_glyph_cache(struct glyph_cache *gc)
+{
+	struct glyph_cache **pp;
+	int bucket;
+
+	/* ハッシュ表から外す */
+	bucket = (int)((gc->codepoint ^ ((uint32_t)gc->size << 16)) %
+		       GLYPH_CACHE_BUCKETS);
+	for (pp = &glyph_cache_bucket[bucket]; *pp != gc;
+	     pp = &(*pp)->hash_next)
+		;
+	*pp = gc->hash_next;
+
+	/* LRUリストから外す */
+	unlink_glyph_cache_lru(gc);
+
+	glyph_cache_bytes -= gc->bytes;
+	free(gc);
+}
+
+/* グリフキャッシュを空にする */
+static void clear_glyph_cache(void)
+{
+	while (glyph_cache_lru_head != NULL)
+		remove_glyph_cache(glyph_cache_lru_head);
+}
+
+/*
+ * グリフキャッシュのヒット数とミス数を取得する
+ */
+void get_glyph_cache_stats(uint64_t *hit, uint64_t *miss)
+{
+	*hit = glyph_cache_hit;
+	*miss = glyph_cache_miss;
+}
+
+/*
+ * グリフの先読み
+ */
+
+/*
+ * グリフを別スレッドでラスタライズしてキャッシュに格納する
+ *  - 既に先読み中の場合は中止してから開始する
+ *  - キャッシュの容量を超える分は先読みしない
+ */
+void prewarm_glyphs(const uint32_t *codepoints, int count)
+{
+	/* 既に先読み中であれば中止する */
+	stop_prewarm();
+
+	if (face == NULL || count == 0)
+		return;
+
+#ifdef PREWARM_THREAD
+	/* 文字のリストをコピーする */
+	prewarm_codepoints = malloc(sizeof(uint32_t) * (size_t)count);
+	if (prewarm_codepoints == NULL) {
+		log_memory();
+		return;
+	}
+	memcpy(prewarm_codepoints, codepoints, sizeof(uint32_t) * (size_t)count);
+	prewarm_count = count;
+	prewarm_size = conf_font_size;
+	prewarm_outline = !conf_font_outline_remove;
+	prewarm_limit = get_glyph_cache_limit();
+	prewarm_stop = false;
+
+	/* スレッドの開始前からキャッシュのロックを有効にする */
+	is_prewarm_running = true;
+
+	/* 先読みスレッドからログ関数を呼び出せるようにする */
+	init_worker_log();
+
+	/* スレッドを開始する */
+#ifdef WIN
+	if (!is_glyph_cache_lock_initialized) {
+		InitializeCriticalSection(&glyph_cache_lock);
+		is_glyph_cache_lock_initialized = true;
+	}
+	prewarm_handle = CreateThread(NULL, 0, prewarm_thread, NULL, 0, NULL);
+	if (prewarm_handle == NULL) {
+		is_prewarm_running = false;
+		free(prewarm_codepoints);
+		prewarm_codepoints = NULL;
+		return;
+	}
+#else
+	if (pthread_create(&prewarm_tid, NULL, prewarm_thread, NULL) != 0) {
+		is_prewarm_running = false;
+		free(prewarm_codepoints);
+		prewarm_codepoints = NULL;
+		return;
+	}
+#endif
+#else
+	UNUSED_PARAMETER(codepoints);
+#endif
+}
+
+/* グリフの先読みを中止する */
+static void stop_prewarm(void)
+{
+#ifdef PREWARM_THREAD
+	if (!is_prewarm_running)
+		return;
+
+	/* スレッドの終了を待つ */
+	prewarm_stop = true;
+#ifdef WIN
+	WaitForSingleObject(prewarm_handle, INFINITE);
+	CloseHandle(prewarm_handle);
+#else
+	pthread_join(prewarm_tid, NULL);
+#endif
+	is_prewarm_running = false;
+
+	/* 先読みスレッドが出力したログを出力する */
+	flush_worker_log();
+
+	free(prewarm_codepoints);
+	prewarm_codepoints = NULL;
+#endif
+}
+
+#ifdef PREWARM_THREAD
+/* 先読みスレッド */
+#ifdef WIN
+static DWORD WINAPI prewarm_thread(LPVOID param)
+#else
+static void *prewarm_thread(void *param)
+#endif
+{
+	UNUSED_PARAMETER(param);
+
+	run_prewarm();
+
+#ifdef WIN
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+/*
+ * 先読みスレッドの本体
+ *  - FreeTypeのオブジェクトはスレッド間で共有できないので、別に作成する
+ *  - フォントファイルの内容は読み込み専用なので共有する
+ */
+static void run_prewarm(void)
+{
+	FT_Library lib;
+	FT_StreamRec stream;
+	FT_Face f;
+	FT_Stroker st;
+	struct rfile *rf;
+	struct glyph_cache *gc;
+	int i;
+	bool found;
+
+	/* ストリームで読む場合は、このスレッド用にファイルを開く */
+	rf = NULL;
+	if (font_file_data == NULL) {
+		rf = open_rfile(FONT_DIR, font_file, false);
+		if (rf == NULL)
+			return;
+	}
+
+	/* 先読み用のFreeTypeのオブジェクトを作成する */
+	if (FT_Init_FreeType(&lib) != 0) {
+		if (rf != NULL)
+			close_rfile(rf);
+		return;
+	}
+	if (open_font_face(lib, &stream, rf, &f) != 0) {
+		FT_Done_FreeType(lib);
+		if (rf != NULL)
+			close_rfile(rf);
+		return;
+	}
+	if (FT_Set_Pixel_Sizes(f, 0, (FT_UInt)prewarm_size) != 0 ||
+	    FT_Stroker_New(lib, &st) != 0) {
+		FT_Done_Face(f);
+		FT_Done_FreeType(lib);
+		if (rf != NULL)
+			close_rfile(rf);
+		return;
+	}
+	FT_Stroker_Set(st, 2*64, FT_STROKER_LINECAP_ROUND,
+		       FT_STROKER_LINEJOIN_ROUND, 0);
+
+	/* 出現順にラスタライズする */
+	for (i = 0; i < prewarm_count && !prewarm_stop; i++) {
+		/* キャッシュ済みであればスキップする */
+		lock_glyph_cache();
+		found = find_glyph_cache(prewarm_codepoints[i], prewarm_size,
+					 prewarm_outline) != NULL;
+		unlock_glyph_cache();
+		if (found)
+			continue;
+
+		/* ラスタライズする */
+		gc = rasterize_glyph(f, st, prewarm_codepoints[i],
+				     prewarm_size, prewarm_outline);
+		if (gc == NULL)
+			continue;
+
+		/* キャッシュに追加する(容量を超える場合は終了する) */
+		lock_glyph_cache();
+		if (find_glyph_cache(gc->codepoint, gc->size,
+				     gc->outline) != NULL) {
+			free(gc);
+		} else if (glyph_cache_bytes + gc->bytes > prewarm_limit) {
+			free(gc);
+			prewarm_stop = true;
+		} else {
+			insert_glyph_cache(gc);
+		}
+		unlock_glyph_cache();
+	}
+
+	FT_Stroker_Done(st);
+	FT_Done_Face(f);
+	FT_Done_FreeType(lib);
+	if (rf != NULL)
+		close_rfile(rf);
+}
+#endif
+
+/* グリフキャッシュをロックする */
+static void lock_glyph_cache(void)
+{
+#ifdef PREWARM_THREAD
+	if (!is_prewarm_running)
+		return;
+#ifdef WIN
+	EnterCriticalSection(&glyph_cache_lock);
+#else
+	pthread_mutex_lock(&glyph_cache_lock);
+#endif
+#endif
+}
+
+/* グリフキャッシュをアンロックする */
+static void unlock_glyph_cache(void)
+{
+#ifdef PREWARM_THREAD
+	if (!is_prewarm_running)
+		return;
+#ifdef WIN
+	LeaveCriticalSection(&glyph_cache_lock);
+#else
+	pthread_mutex_unlock(&glyph_cache_lock);
+#endif
+#endif
 }
 
 /*
@@ -578,65 +1299,43 @@ bool isgraph_extended(const char **mbs, uint32_t *wc)
 #include "drawglyph.h"
 
 /* draw_glyph_func()をディスパッチする */
-void draw_glyph_func(unsigned char * RESTRICT font,
-		     int font_width,
-		     int font_height,
-		     int margin_left,
-		     int margin_top,
+void draw_glyph_func(const struct glyph_layer * RESTRICT layer,
+		     int layer_count,
 		     pixel_t * RESTRICT image,
 		     int image_width,
 		     int image_height,
 		     int image_x,
-		     int image_y,
-		     pixel_t color)
+		     int image_y)
 {
 	if (has_avx512) {
-		draw_glyph_func_avx512(font, font_width, font_height,
-				       margin_left, margin_top, image,
-				       image_width, image_height, image_x,
-				       image_y, color);
+		draw_glyph_func_avx512(layer, layer_count, image, image_width,
+				       image_height, image_x, image_y);
 	} else if (has_avx2) {
-		draw_glyph_func_avx2(font, font_width, font_height,
-				     margin_left, margin_top, image,
-				     image_width, image_height, image_x,
-				     image_y, color);
+		draw_glyph_func_avx2(layer, layer_count, image, image_width,
+				     image_height, image_x, image_y);
 	} else if (has_avx) {
-		draw_glyph_func_avx(font, font_width, font_height,
-				    margin_left, margin_top, image,
-				    image_width, image_height, image_x,
-				    image_y, color);
+		draw_glyph_func_avx(layer, layer_count, image, image_width,
+				    image_height, image_x, image_y);
 #if !defined(_MSC_VER)
 	} else if (has_sse42) {
-		draw_glyph_func_sse42(font, font_width, font_height,
-				      margin_left, margin_top, image,
-				      image_width, image_height, image_x,
-				      image_y, color);
+		draw_glyph_func_sse42(layer, layer_count, image, image_width,
+				      image_height, image_x, image_y);
 	} else if (has_sse41) {
-		draw_glyph_func_sse41(font, font_width, font_height,
-				      margin_left, margin_top, image,
-				      image_width, image_height, image_x,
-				      image_y, color);
+		draw_glyph_func_sse41(layer, layer_count, image, image_width,
+				      image_height, image_x, image_y);
 	} else if (has_sse3) {
-		draw_glyph_func_sse3(font, font_width, font_height,
-				     margin_left, margin_top, image,
-				     image_width, image_height, image_x,
-				     image_y, color);
+		draw_glyph_func_sse3(layer, layer_count, image, image_width,
+				     image_height, image_x, image_y);
 #endif
 	} else if (has_sse2) {
-		draw_glyph_func_sse2(font, font_width, font_height,
-				     margin_left, margin_top, image,
-				     image_width, image_height, image_x,
-				     image_y, color);
+		draw_glyph_func_sse2(layer, layer_count, image, image_width,
+				     image_height, image_x, image_y);
 	} else if (has_sse) {
-		draw_glyph_func_sse(font, font_width, font_height,
-				    margin_left, margin_top, image,
-				    image_width, image_height, image_x,
-				    image_y, color);
+		draw_glyph_func_sse(layer, layer_count, image, image_width,
+				    image_height, image_x, image_y);
 	} else {
-		draw_glyph_func_novec(font, font_width, font_height,
-				      margin_left, margin_top, image,
-				      image_width, image_height, image_x,
-				      image_y, color);
+		draw_glyph_func_novec(layer, layer_count, image, image_width,
+				      image_height, image_x, image_y);
 	}
 }
 
@@ -10,6 +10,9 @@
  *
  * [Changes]
  *  - 2016/06/18 作成
+ *  - 2026/10/19 グリフキャッシュに対応
+ *  - 2026/10/19 グリフの先読みに対応
+ *  - 2026/10/19 アウトラインと中身を1パスで合成するように変更
  */
 
 #ifndef SUIKA_GLYPH_H
@@ -49,10 +52,29 @@ int get_glyph_width(uint32_t codepoint);
 /* utf-8文字列を描画した際の幅を取得する */
 int get_utf8_width(const char *mbs);
 
+/* 1文字の中で合成する層(アウトライン(内側, 外側)と中身)の最大数 */
+#define GLYPH_LAYER_MAX		(3)
+
+/* 合成する層 */
+struct glyph_layer {
+	const unsigned char *buf;	/* 8ビットのカバレッジ */
+	int width;
+	int height;
+	int left;			/* 描画位置からのオフセット */
+	int top;
+	pixel_t color;
+};
+
 /* 文字の描画を行う */
 bool draw_glyph(struct image *img, int x, int y, pixel_t color,
 		pixel_t outline_color, uint32_t codepoint, int *w, int *h);
 
+/* グリフキャッシュのヒット数とミス数を取得する */
+void get_glyph_cache_stats(uint64_t *hit, uint64_t *miss);
+
+/* グリフを別スレッドでラスタライズしてキャッシュに格納する */
+void prewarm_glyphs(const uint32_t *codepoints, int count);
+
 /* フォントファイル名を設定する */
 bool set_font_file_name(const char *file);
 
@@ -856,6 +856,9 @@ static bool move_to_title(void)
 	if (!load_script(file))
 		return false;
 
+	/* 既読フラグをロードする */
+	load_seen();
+
 	/* @guiコマンドを実行中の場合はキャンセルする */
 	if (is_in_command_repetition())
 		stop_command_repetition();
@@ -1348,6 +1351,7 @@ static bool init_save_buttons(void)
 						button[i].height);
 		if (button[i].rt.img == NULL)
 			return false;
+		set_image_category(button[i].rt.img, IMAGE_CATEGORY_GUI);
 
 		button[i].rt.color =
 			make_pixel_slow(0xff,
@@ -1597,6 +1601,7 @@ static bool init_history_buttons(void)
 						button[i].height);
 		if (button[i].rt.img == NULL)
 			return false;
+		set_image_category(button[i].rt.img, IMAGE_CATEGORY_GUI);
 
 		button[i].rt.color =
 			make_pixel_slow(0xff,
@@ -1883,6 +1888,7 @@ static bool init_preview_buttons(void)
 						button[i].height);
 		if (button[i].rt.img == NULL)
 			return false;
+		set_image_category(button[i].rt.img, IMAGE_CATEGORY_GUI);
 		lock_image(button[i].rt.img);
 		clear_image_color(button[i].rt.img,
 				  make_pixel_slow(0, 0, 0, 0));
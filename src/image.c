@@ -18,6 +18,12 @@
  *  2021-06-05 色指定のイメージ作成に対応
  *  2021-06-10 マスクつき描画に対応
  *  2021-08-04 Direct3Dに対応
+ *  2026-10-19 参照カウントに対応
+ *  2026-10-19 アルファ値の種類による描画処理の自動選択に対応
+ *  2026-10-19 RGB565形式の不透明イメージに対応
+ *  2026-10-19 ピクセル列のプールに対応
+ *  2026-10-19 所有者の種類ごとのメモリ使用量の集計に対応
+ *  2026-10-19 参照カウントの不可分な増減に対応
  */
 
 #include "suika.h"
@@ -30,6 +36,59 @@
 #include <malloc.h>
 #endif
 
+/*
+ * ピクセル列のプールをロックするか
+ *  - 先読みと一括読み込みのスレッドでもイメージが作成・破棄される
+ */
+#if !defined(EM) && !defined(SWITCH) && !defined(ANDROID)
+#define POOL_LOCK
+#ifdef WIN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
+/*
+ * 参照カウントを不可分に増減する
+ *  - 先読みスレッドはキャッシュのロック中に参照カウントを読んで追い出しを
+ *    判断するが、メインスレッドはロックを取らずに参照を増減する
+ */
+#if defined(WIN)
+#define INC_REF_COUNT(p)	InterlockedIncrement(p)
+#define DEC_REF_COUNT(p)	InterlockedDecrement(p)
+#elif defined(POOL_LOCK)
+#define INC_REF_COUNT(p)	__sync_add_and_fetch(p, 1)
+#define DEC_REF_COUNT(p)	__sync_sub_and_fetch(p, 1)
+#else
+#define INC_REF_COUNT(p)	(++*(p))
+#define DEC_REF_COUNT(p)	(--*(p))
+#endif
+
+/*
+ * プールに保持する空きバッファの総量のデフォルト値
+ *  - 1280x720の32ビットのバッファを1つ保持できる程度にとどめる
+ */
+#define POOL_DEFAULT_LIMIT	(4 * 1024 * 1024)
+
+/* プールを使うバッファのサイズの範囲(2のべき乗の指数) */
+#define POOL_MIN_SHIFT		(16)
+#define POOL_MAX_SHIFT		(28)
+
+/* 2のべき乗の区間を分割するサイズクラスの数 */
+#define POOL_CLASS_DIV		(8)
+
+/* 画面サイズ専用のクラスの数(32ビットとRGB565形式) */
+#define POOL_SCREEN_CLASSES	(2)
+
+/* クラスの数 */
+#define POOL_CLASSES		(POOL_SCREEN_CLASSES + \
+				 (POOL_MAX_SHIFT - POOL_MIN_SHIFT) * \
+				 POOL_CLASS_DIV)
+
+/* 高水位標までプールを縮小する間隔(確保の回数) */
+#define POOL_TRIM_INTERVAL	(256)
+
 /*
  * image構造体
  */
@@ -42,18 +101,134 @@ struct image {
 	ALIGN_DECL(SSE_ALIGN, pixel_t * RESTRICT pixels);
 #endif
 	bool need_free;			/* pixelsを解放する必要があるか */
+#ifdef WIN
+	volatile LONG ref_count;	/* 参照カウント */
+#else
+	volatile int ref_count;		/* 参照カウント */
+#endif
 	pixel_t *locked_pixels;		/* ロック済みのピクセル列 */
 	void *texture;			/* テクスチャへのポインタ */
+	int alpha_type;			/* アルファ値の種類 */
+	uint16_t *packed;		/* RGB565形式のピクセル列 */
+	int category;			/* 最後に設定された所有者の種類 */
+	bool is_cached;			/* キャッシュに格納されているか */
+	struct image *prev;		/* 生存中のイメージのリスト */
+	struct image *next;
+};
+
+/*
+ * RGB565形式のイメージ
+ *  - ピクセル列をpackedに16ビットで保持し、pixelsはロック中のみ確保する
+ *  - ロック時に32ビットに展開し、アンロック時に16ビットに詰め直す
+ *  - 描画元にする場合は1行ずつ展開して描画関数に渡す
+ */
+
+/* 読み込み時に用いる4x4の組織的ディザ行列 */
+static const unsigned char dither_matrix[4][4] = {
+	{ 0,  8,  2, 10},
+	{12,  4, 14,  6},
+	{ 3, 11,  1,  9},
+	{15,  7, 13,  5},
+};
+
+/* RGB565形式のイメージの1行を展開するバッファ */
+static pixel_t *row_buf;
+static int row_buf_width;
+
+/*
+ * ピクセル列のプール
+ *  - 破棄したイメージのバッファを解放せずに保持し、同じクラスのバッファの
+ *    確保に再利用する
+ *  - 画面サイズのバッファは専用のクラスで同じサイズのものを再利用する
+ *  - それ以外はクラスのサイズに切り上げて確保する(小さいものは使わない)
+ *  - 一定回数の確保ごとに、その間の同時使用数の最大値(高水位標)を超えて
+ *    保持している空きバッファを解放する
+ */
+
+/* サイズクラスごとの空きバッファ */
+struct pool_class {
+	void *free_list;		/* 空きバッファ(先頭に次へのポインタ) */
+	size_t size;			/* バッファのサイズ */
+	int free_count;			/* 空きバッファの数 */
+	int use_count;			/* 使用中のバッファの数 */
+	int peak_count;			/* 縮小後の使用中のバッファの最大数 */
 };
 
+static struct pool_class pool[POOL_CLASSES];
+
+/* 空きバッファの総量 */
+static size_t pool_bytes;
+
+/* 確保の回数 */
+static int pool_alloc_count;
+
+/* 統計 */
+static uint64_t pool_hit;
+static uint64_t pool_miss;
+static uint64_t pool_trim;
+static size_t pool_peak_bytes;
+
+/* 所有者の種類の名前(ログ出力用) */
+static const char *category_name[IMAGE_CATEGORIES] = {
+	"none", "layer", "fade", "cache", "gui", "thumbnail",
+};
+
+/*
+ * 生存中のイメージのリスト
+ *  - 所有者の種類ごとのメモリ使用量は集計時にリストをたどって求める
+ *  - プールと同じロックで保護する
+ */
+static struct image *image_list;
+
+/* プールのロック */
+#ifdef POOL_LOCK
+#ifdef WIN
+static CRITICAL_SECTION pool_lock;
+static bool is_pool_lock_initialized;
+#else
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+#endif
+
 /* ロックされているイメージの数 */
 static int lock_count;
 
+/* 描画処理ごとの使用回数 */
+static uint64_t draw_kernel_count[DRAW_KERNELS];
+
 /*
  * 前方参照
  */
 
 static struct image *create_image_helper(int w, int h);
+static pixel_t *alloc_pixels(int w, int h);
+static void free_pixels(pixel_t *pixels, int w, int h);
+static void *alloc_buffer(size_t bytes);
+static void free_buffer(void *p, size_t bytes);
+static int get_pool_class(size_t bytes, size_t *size);
+static size_t get_pool_limit(void);
+static void trim_pool(void);
+static void lock_pool(void);
+static void unlock_pool(void);
+static void *alloc_aligned(size_t bytes);
+static void free_aligned(void *p);
+static void register_image(struct image *img);
+static void unregister_image(struct image *img);
+static size_t get_image_bytes(struct image *img);
+static int get_current_category(struct image *img);
+static uint16_t pack_pixel(pixel_t p, int x, int y, bool dither);
+static void unpack_pixels(pixel_t *dst, const uint16_t *src, int count);
+static const pixel_t *get_source_row(struct image *img, int x, int y,
+				     int width);
+static void draw_blend(struct image * RESTRICT dst_image, int dst_left,
+		       int dst_top, struct image * RESTRICT src_image,
+		       int width, int height, int src_left, int src_top,
+		       int alpha, int bt);
+static void draw_packed_source(struct image * RESTRICT dst_image,
+			       int dst_left, int dst_top,
+			       struct image * RESTRICT src_image, int width,
+			       int height, int src_left, int src_top,
+			       int alpha, int bt);
 static void draw_blend_none(struct image * RESTRICT dst_image, int dst_left,
 			    int dst_top, struct image * RESTRICT src_image,
 			    int width, int height, int src_left, int src_top);
@@ -73,6 +248,11 @@ static void draw_blend_sub(struct image * RESTRICT dst_image, int dst_left,
 			   int dst_top, struct image * RESTRICT src_image,
 			   int width, int height, int src_left, int src_top,
 			   int alpha);
+static void draw_blend_binary(struct image * RESTRICT dst_image,
+			      int dst_left, int dst_top,
+			      struct image * RESTRICT src_image, int width,
+			      int height, int src_left, int src_top,
+			      bool fill_alpha);
 
 /*
  * 初期化
@@ -110,41 +290,650 @@ static struct image *create_image_helper(int w, int h)
 	}
 
 	/* ピクセル列のメモリを確保する */
-#if !defined(SSE_VERSIONING)
-	pixels = malloc((size_t)w * (size_t)h * sizeof(pixel_t));
-	if(pixels == NULL) {
+	pixels = alloc_pixels(w, h);
+	if (pixels == NULL) {
 		log_memory();
+		if (conf_image_stats_log)
+			dump_image_memory_stats();
 		free(img);
 		return NULL;
 	}
+
+	/* 構造体を初期化する */
+	img->width = w;
+	img->height = h;
+	img->pixels = pixels;
+	img->need_free = true;
+	img->ref_count = 1;
+	img->locked_pixels = NULL;
+	img->texture = NULL;
+	img->alpha_type = IMAGE_ALPHA_GENERAL;
+	img->packed = NULL;
+	register_image(img);
+
+	return img;
+}
+
+/* ピクセル列のメモリを確保する */
+static pixel_t *alloc_pixels(int w, int h)
+{
+	return alloc_buffer((size_t)w * (size_t)h * sizeof(pixel_t));
+}
+
+/* ピクセル列のメモリを解放する */
+static void free_pixels(pixel_t *pixels, int w, int h)
+{
+	free_buffer(pixels, (size_t)w * (size_t)h * sizeof(pixel_t));
+}
+
+/*
+ * プールからバッファを確保する
+ *  - 空きバッファがなければクラスのサイズで新たに確保する
+ */
+static void *alloc_buffer(size_t bytes)
+{
+	struct pool_class *pc;
+	size_t size;
+	void *p;
+	int cls;
+
+	/* プールを使わない場合 */
+	cls = get_pool_class(bytes, &size);
+	if (cls < 0)
+		return alloc_aligned(bytes);
+
+	/* 空きバッファを取り出す */
+	lock_pool();
+	pc = &pool[cls];
+	pc->size = size;
+	p = pc->free_list;
+	if (p != NULL) {
+		pc->free_list = *(void **)p;
+		pc->free_count--;
+		pool_bytes -= size;
+		pool_hit++;
+	} else {
+		pool_miss++;
+	}
+	pc->use_count++;
+	if (pc->use_count > pc->peak_count)
+		pc->peak_count = pc->use_count;
+	if (++pool_alloc_count >= POOL_TRIM_INTERVAL) {
+		pool_alloc_count = 0;
+		trim_pool();
+	}
+	unlock_pool();
+	if (p != NULL)
+		return p;
+
+	/* 空きバッファがない場合は確保する */
+	p = alloc_aligned(size);
+	if (p == NULL) {
+		lock_pool();
+		pc->use_count--;
+		unlock_pool();
+	}
+	return p;
+}
+
+/*
+ * バッファをプールに返す
+ *  - プールの総量を超える場合は解放する
+ */
+static void free_buffer(void *p, size_t bytes)
+{
+	struct pool_class *pc;
+	size_t size;
+	int cls;
+
+	/* プールを使わない場合 */
+	cls = get_pool_class(bytes, &size);
+	if (cls < 0) {
+		free_aligned(p);
+		return;
+	}
+
+	/* 空きバッファにする */
+	lock_pool();
+	pc = &pool[cls];
+	pc->use_count--;
+	if (pool_bytes + size <= get_pool_limit()) {
+		*(void **)p = pc->free_list;
+		pc->free_list = p;
+		pc->free_count++;
+		pool_bytes += size;
+		if (pool_bytes > pool_peak_bytes)
+			pool_peak_bytes = pool_bytes;
+		p = NULL;
+	} else {
+		pool_trim++;
+	}
+	unlock_pool();
+
+	/* プールに入らなかった場合は解放する */
+	if (p != NULL)
+		free_aligned(p);
+}
+
+/*
+ * バッファのサイズクラスを求める
+ *  - プールを使わないサイズの場合と低メモリモードでは-1を返す
+ */
+static int get_pool_class(size_t bytes, size_t *size)
+{
+	size_t screen, base, step;
+	int shift, k, cls;
+
+	/* 低メモリモードでは空きバッファを保持しない */
+	if (conf_image_lowmem)
+		return -1;
+
+	/* 画面サイズのバッファは同じサイズのものだけを再利用する */
+	screen = (size_t)conf_window_width * (size_t)conf_window_height;
+	if (bytes == screen * sizeof(pixel_t)) {
+		*size = bytes;
+		return 0;
+	}
+	if (bytes == screen * sizeof(uint16_t)) {
+		*size = bytes;
+		return 1;
+	}
+
+	/* 2のべき乗の区間を求める */
+	if (bytes < ((size_t)1 << POOL_MIN_SHIFT))
+		return -1;
+	for (shift = POOL_MIN_SHIFT; shift < POOL_MAX_SHIFT; shift++)
+		if (bytes < ((size_t)1 << (shift + 1)))
+			break;
+	if (shift == POOL_MAX_SHIFT)
+		return -1;
+
+	/* 区間を等分したサイズに切り上げる(最後は次の区間の先頭になる) */
+	base = (size_t)1 << shift;
+	step = base / POOL_CLASS_DIV;
+	k = (int)((bytes - base + step - 1) / step);
+	cls = POOL_SCREEN_CLASSES + (shift - POOL_MIN_SHIFT) * POOL_CLASS_DIV +
+		k;
+	if (cls >= POOL_CLASSES)
+		return -1;
+
+	*size = base + step * (size_t)k;
+	return cls;
+}
+
+/* プールに保持する空きバッファの総量を取得する */
+static size_t get_pool_limit(void)
+{
+	if (conf_image_pool_size > 0)
+		return (size_t)conf_image_pool_size * 1024;
+	return POOL_DEFAULT_LIMIT;
+}
+
+/*
+ * 高水位標を超えて保持している空きバッファを解放する(ロック中に呼ぶ)
+ *  - 前回からの同時使用数の最大値まで、空きバッファを残す
+ */
+static void trim_pool(void)
+{
+	struct pool_class *pc;
+	void *p;
+	int i;
+
+	for (i = 0; i < POOL_CLASSES; i++) {
+		pc = &pool[i];
+		while (pc->free_count > 0 &&
+		       pc->use_count + pc->free_count > pc->peak_count) {
+			p = pc->free_list;
+			pc->free_list = *(void **)p;
+			pc->free_count--;
+			pool_bytes -= pc->size;
+			pool_trim++;
+			free_aligned(p);
+		}
+		pc->peak_count = pc->use_count;
+	}
+}
+
+/* プールをロックする */
+static void lock_pool(void)
+{
+#ifdef POOL_LOCK
+#ifdef WIN
+	/* 最初のイメージはスレッドの開始前にメインスレッドで作成される */
+	if (!is_pool_lock_initialized) {
+		InitializeCriticalSection(&pool_lock);
+		is_pool_lock_initialized = true;
+	}
+	EnterCriticalSection(&pool_lock);
+#else
+	pthread_mutex_lock(&pool_lock);
+#endif
+#endif
+}
+
+/* プールをアンロックする */
+static void unlock_pool(void)
+{
+#ifdef POOL_LOCK
+#ifdef WIN
+	LeaveCriticalSection(&pool_lock);
+#else
+	pthread_mutex_unlock(&pool_lock);
+#endif
+#endif
+}
+
+/* アラインされたメモリを確保する */
+static void *alloc_aligned(size_t bytes)
+{
+	void *p;
+
+#if !defined(SSE_VERSIONING)
+	p = malloc(bytes);
 #elif defined(WIN)
-	pixels = _aligned_malloc((size_t)w * (size_t)h * sizeof(pixel_t),
-				 SSE_ALIGN);
-	if (pixels == NULL) {
+	p = _aligned_malloc(bytes, SSE_ALIGN);
+#else
+	if (posix_memalign(&p, SSE_ALIGN, bytes) != 0)
+		p = NULL;
+#endif
+
+	return p;
+}
+
+/* アラインされたメモリを解放する */
+static void free_aligned(void *p)
+{
+#if defined(SSE_VERSIONING) && defined(WIN)
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+/*
+ * プールの空きバッファを全て解放する
+ *  - 統計の出力が指定されている場合はログに出力する
+ */
+void cleanup_image_pool(void)
+{
+	struct pool_class *pc;
+	void *p;
+	int i;
+
+	if (conf_image_stats_log) {
+		log_image_pool_stats((unsigned long)pool_hit,
+				     (unsigned long)pool_miss,
+				     (unsigned long)pool_trim,
+				     (unsigned long)(pool_peak_bytes / 1024));
+	}
+
+	lock_pool();
+	for (i = 0; i < POOL_CLASSES; i++) {
+		pc = &pool[i];
+		while (pc->free_list != NULL) {
+			p = pc->free_list;
+			pc->free_list = *(void **)p;
+			free_aligned(p);
+		}
+		pc->free_count = 0;
+	}
+	pool_bytes = 0;
+	unlock_pool();
+
+	/* プールのロックを破棄する */
+#if defined(POOL_LOCK) && defined(WIN)
+	if (is_pool_lock_initialized) {
+		DeleteCriticalSection(&pool_lock);
+		is_pool_lock_initialized = false;
+	}
+#endif
+}
+
+/* 生存中のイメージのリストに追加する */
+static void register_image(struct image *img)
+{
+	img->category = IMAGE_CATEGORY_NONE;
+	img->is_cached = false;
+	img->prev = NULL;
+
+	lock_pool();
+	img->next = image_list;
+	if (image_list != NULL)
+		image_list->prev = img;
+	image_list = img;
+	unlock_pool();
+}
+
+/* 生存中のイメージのリストから除く */
+static void unregister_image(struct image *img)
+{
+	lock_pool();
+	if (img->prev != NULL)
+		img->prev->next = img->next;
+	else
+		image_list = img->next;
+	if (img->next != NULL)
+		img->next->prev = img->prev;
+	unlock_pool();
+}
+
+/* イメージが所有するピクセル列のバイト数を求める */
+static size_t get_image_bytes(struct image *img)
+{
+	if (!img->need_free)
+		return 0;
+	if (img->packed != NULL)
+		return (size_t)img->width * (size_t)img->height *
+			sizeof(uint16_t);
+	return (size_t)img->width * (size_t)img->height * sizeof(pixel_t);
+}
+
+/*
+ * イメージの所有者の種類を設定する
+ *  - 共有されたイメージは最後に設定した所有者のものとして数える
+ *  - キャッシュはset_image_cached()で設定する
+ */
+void set_image_category(struct image *img, int category)
+{
+	assert(img != NULL);
+	assert(category > IMAGE_CATEGORY_NONE && category < IMAGE_CATEGORIES);
+	assert(category != IMAGE_CATEGORY_CACHE);
+
+	lock_pool();
+	img->category = category;
+	unlock_pool();
+}
+
+/*
+ * イメージがキャッシュに格納されているかを設定する
+ *  - キャッシュへの格納時と、キャッシュから外したときに呼び出す
+ */
+void set_image_cached(struct image *img, bool is_cached)
+{
+	assert(img != NULL);
+
+	lock_pool();
+	img->is_cached = is_cached;
+	unlock_pool();
+}
+
+/*
+ * イメージの所有者の種類を取得する
+ */
+int get_image_category(struct image *img)
+{
+	int category;
+
+	assert(img != NULL);
+
+	lock_pool();
+	category = get_current_category(img);
+	unlock_pool();
+
+	return category;
+}
+
+/*
+ * 現在の所有者の種類を求める(ロック中に呼ぶ)
+ *  - キャッシュだけが参照しているイメージはキャッシュのものとする
+ *  - キャッシュと共有されたイメージは、所有者が設定されていればその
+ *    所有者のものとする
+ */
+static int get_current_category(struct image *img)
+{
+	if (img->is_cached &&
+	    (img->ref_count == 1 || img->category == IMAGE_CATEGORY_NONE))
+		return IMAGE_CATEGORY_CACHE;
+	return img->category;
+}
+
+/*
+ * 所有者の種類ごとのメモリ使用量を取得する
+ *  - bytesとcountはIMAGE_CATEGORIES個
+ *  - ピクセル列を所有するイメージのみを数える(ロック中の展開分は除く)
+ */
+void get_image_memory_stats(size_t *bytes, int *count)
+{
+	struct image *img;
+	int i, category;
+
+	for (i = 0; i < IMAGE_CATEGORIES; i++) {
+		bytes[i] = 0;
+		count[i] = 0;
+	}
+
+	lock_pool();
+	for (img = image_list; img != NULL; img = img->next) {
+		if (!img->need_free)
+			continue;
+		category = get_current_category(img);
+		bytes[category] += get_image_bytes(img);
+		count[category]++;
+	}
+	unlock_pool();
+}
+
+/*
+ * 所有者の種類ごとのメモリ使用量をログに出力する
+ */
+void dump_image_memory_stats(void)
+{
+	size_t bytes[IMAGE_CATEGORIES];
+	int count[IMAGE_CATEGORIES];
+	int i;
+
+	get_image_memory_stats(bytes, count);
+	for (i = 0; i < IMAGE_CATEGORIES; i++) {
+		log_image_memory_stats(category_name[i],
+				       (unsigned long)(bytes[i] / 1024),
+				       count[i]);
+	}
+}
+
+/*
+ * 生存しているイメージをリークとしてログに出力する(終了時)
+ *  - 全ての所有者の終了処理の後に呼び出す
+ *  - ピクセル列を所有しないイメージは除く
+ */
+void report_image_leaks(void)
+{
+	struct image *img;
+
+	lock_pool();
+	for (img = image_list; img != NULL; img = img->next) {
+		if (!img->need_free)
+			continue;
+		log_image_leak(img->width, img->height,
+			       category_name[get_current_category(img)],
+			       (int)img->ref_count);
+	}
+	unlock_pool();
+}
+
+/*
+ * プールの統計を取得する
+ */
+void get_image_pool_stats(uint64_t *hit, uint64_t *miss, uint64_t *trim,
+			  size_t *bytes, size_t *peak_bytes)
+{
+	lock_pool();
+	*hit = pool_hit;
+	*miss = pool_miss;
+	*trim = pool_trim;
+	*bytes = pool_bytes;
+	*peak_bytes = pool_peak_bytes;
+	unlock_pool();
+}
+
+/*
+ * RGB565形式のイメージを作成する
+ *  - 不透明なイメージにのみ用いる(アルファ値は常に255になる)
+ */
+struct image *create_image_rgb565(int w, int h)
+{
+	struct image *img;
+
+	assert(w > 0 && h > 0);
+
+	/* イメージ構造体のメモリを確保する */
+	img = malloc(sizeof(struct image));
+	if (img == NULL) {
 		log_memory();
-		free(img);
 		return NULL;
 	}
-#else
-	if (posix_memalign((void **)&pixels, SSE_ALIGN, (size_t)w * (size_t)h *
-			   sizeof(pixel_t)) != 0) {
+
+	/* ピクセル列のメモリを確保する */
+	img->packed = alloc_buffer((size_t)w * (size_t)h * sizeof(uint16_t));
+	if (img->packed == NULL) {
 		log_memory();
+		if (conf_image_stats_log)
+			dump_image_memory_stats();
 		free(img);
 		return NULL;
 	}
-#endif
 
 	/* 構造体を初期化する */
 	img->width = w;
 	img->height = h;
-	img->pixels = pixels;
+	img->pixels = NULL;
 	img->need_free = true;
+	img->ref_count = 1;
 	img->locked_pixels = NULL;
 	img->texture = NULL;
+	img->alpha_type = IMAGE_ALPHA_OPAQUE;
+	register_image(img);
 
 	return img;
 }
 
+/*
+ * 不透明なイメージをRGB565形式に変換する
+ *  - ディザをかけて変換し、32ビットのピクセル列を解放する
+ *  - テクスチャは作成済みのものをそのまま使う
+ *  - 変換できない場合はfalseを返し、イメージは変更されない
+ */
+bool pack_image_rgb565(struct image *img)
+{
+	uint16_t *packed;
+	pixel_t *pixels;
+	int x, y;
+
+	assert(img != NULL);
+	assert(img->locked_pixels == NULL);
+
+	/* 変換済みの場合 */
+	if (img->packed != NULL)
+		return true;
+
+	/* 不透明でないか、ピクセル列を所有していない場合は変換しない */
+	if (img->alpha_type != IMAGE_ALPHA_OPAQUE || !img->need_free)
+		return false;
+
+	/* ピクセル列のメモリを確保する */
+	packed = alloc_buffer((size_t)img->width * (size_t)img->height *
+			      sizeof(uint16_t));
+	if (packed == NULL) {
+		log_memory();
+		return false;
+	}
+
+	/* ディザをかけて変換する */
+	for (y = 0; y < img->height; y++) {
+		for (x = 0; x < img->width; x++) {
+			packed[img->width * y + x] =
+				pack_pixel(img->pixels[img->width * y + x],
+					   x, y, true);
+		}
+	}
+
+	/* 集計中でないときに付け替えて、32ビットのピクセル列を解放する */
+	pixels = img->pixels;
+	lock_pool();
+	img->pixels = NULL;
+	img->packed = packed;
+	unlock_pool();
+	free_pixels(pixels, img->width, img->height);
+
+	return true;
+}
+
+/*
+ * イメージがRGB565形式であるか調べる
+ */
+bool is_image_rgb565(struct image *img)
+{
+	assert(img != NULL);
+
+	return img->packed != NULL;
+}
+
+/* ピクセルをRGB565形式にする */
+static uint16_t pack_pixel(pixel_t p, int x, int y, bool dither)
+{
+	uint32_t c1, c2, c3, d;
+
+	c1 = get_pixel_c1(p);
+	c2 = get_pixel_c2(p);
+	c3 = get_pixel_c3(p);
+
+	/* 切り捨てられる下位ビットの範囲でしきい値を加える */
+	if (dither) {
+		d = dither_matrix[y & 3][x & 3];
+		c1 = c1 + (d >> 1) > 255 ? 255 : c1 + (d >> 1);
+		c2 = c2 + (d >> 2) > 255 ? 255 : c2 + (d >> 2);
+		c3 = c3 + (d >> 1) > 255 ? 255 : c3 + (d >> 1);
+	}
+
+	return (uint16_t)(((c1 >> 3) << 11) | ((c2 >> 2) << 5) | (c3 >> 3));
+}
+
+/*
+ * RGB565形式のピクセル列を展開する
+ *  - 上位ビットを下位に複製するので、詰め直すと元の値に戻る
+ */
+static void unpack_pixels(pixel_t *dst, const uint16_t *src, int count)
+{
+	uint32_t c1, c2, c3;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		c1 = (uint32_t)(src[i] >> 11) & 0x1f;
+		c2 = (uint32_t)(src[i] >> 5) & 0x3f;
+		c3 = (uint32_t)src[i] & 0x1f;
+		dst[i] = make_pixel_fast(0xff,
+					 (c1 << 3) | (c1 >> 2),
+					 (c2 << 2) | (c2 >> 4),
+					 (c3 << 3) | (c3 >> 2));
+	}
+}
+
+/*
+ * 描画元の1行のピクセル列を取得する
+ *  - RGB565形式のイメージは行バッファに展開する(次の呼び出しまで有効)
+ */
+static const pixel_t *get_source_row(struct image *img, int x, int y,
+				     int width)
+{
+	if (img->packed == NULL)
+		return get_image_pixels(img) + img->width * y + x;
+
+	/* 行バッファを確保する */
+	if (width > row_buf_width) {
+		if (row_buf != NULL)
+			free_pixels(row_buf, row_buf_width, 1);
+		row_buf = alloc_pixels(img->width, 1);
+		if (row_buf == NULL) {
+			log_memory();
+			row_buf_width = 0;
+			return NULL;
+		}
+		row_buf_width = img->width;
+	}
+
+	unpack_pixels(row_buf, img->packed + img->width * y + x, width);
+	return row_buf;
+}
+
 /*
  * バッファを指定してイメージを作成する
  */
@@ -167,7 +956,12 @@ struct image *create_image_with_pixels(int w, int h, pixel_t *buf)
 	img->height = h;
 	img->pixels = buf;
 	img->need_free = false;
+	img->ref_count = 1;
 	img->locked_pixels = NULL;
+	img->texture = NULL;
+	img->alpha_type = IMAGE_ALPHA_GENERAL;
+	img->packed = NULL;
+	register_image(img);
 
 	/* 成功 */
 	return img;
@@ -200,32 +994,66 @@ struct image *create_image_from_color_string(int w, int h, const char *color)
 	lock_image(img);
 	clear_image_color(img, cl);
 	unlock_image(img);
+	img->alpha_type = IMAGE_ALPHA_OPAQUE;
+
+	return img;
+}
+
+/*
+ * イメージの参照カウントを増やす
+ */
+struct image *ref_image(struct image *img)
+{
+	assert(img != NULL);
+	assert(img->ref_count > 0);
 
+	INC_REF_COUNT(&img->ref_count);
 	return img;
 }
 
+/*
+ * イメージの参照カウントを取得する
+ */
+int get_image_ref_count(struct image *img)
+{
+	assert(img != NULL);
+
+	return (int)img->ref_count;
+}
+
 /*
  * イメージを削除する
+ *  - 参照カウントを減らし、0になったら解放する
  */
 void destroy_image(struct image *img)
 {
 	assert(img != NULL);
 	assert(img->width > 0 && img->height > 0);
-	assert(img->pixels != NULL);
+	assert(img->pixels != NULL || img->packed != NULL);
+	assert(img->ref_count > 0);
+
+	/* 他に参照されている場合は解放しない */
+	if (DEC_REF_COUNT(&img->ref_count) > 0)
+		return;
+
 	assert(img->locked_pixels == NULL);
 
+	/* 使用量から除く */
+	unregister_image(img);
+
 	/* テクスチャを削除する */
 	destroy_texture(img->texture);
 
 	/* ピクセル列のメモリを解放する */
 	if (img->need_free) {
-#if defined(SSE_VERSIONING) && defined(WIN)
-		_aligned_free(img->pixels);
-#else
-		free(img->pixels);
-#endif		
+		if (img->packed != NULL)
+			free_buffer(img->packed, (size_t)img->width *
+				    (size_t)img->height * sizeof(uint16_t));
+		else
+			free_pixels(img->pixels, img->width, img->height);
 	}
 	img->pixels = NULL;
+	img->packed = NULL;
 
 	/* イメージ構造体のメモリを解放する */
 	free(img);
@@ -237,10 +1065,24 @@ void destroy_image(struct image *img)
 
 /*
  * イメージをロックする
+ *  - ピクセル列が書き換えられる可能性があるのでアルファ値の種類は一般に戻す
  */
 bool lock_image(struct image *img)
 {
+	/* RGB565形式の場合は32ビットに展開する */
+	if (img->packed != NULL) {
+		assert(img->pixels == NULL);
+		img->pixels = alloc_pixels(img->width, img->height);
+		if (img->pixels == NULL) {
+			log_memory();
+			return false;
+		}
+		unpack_pixels(img->pixels, img->packed,
+			      img->width * img->height);
+	}
+
 	lock_count++;
+	img->alpha_type = IMAGE_ALPHA_GENERAL;
 	if (!lock_texture(img->width, img->height, img->pixels,
 			  &img->locked_pixels, &img->texture))
 		return false;
@@ -253,9 +1095,21 @@ bool lock_image(struct image *img)
  */
 void unlock_image(struct image *img)
 {
+	int i;
+
 	lock_count--;
 	unlock_texture(img->width, img->height, img->pixels,
 		       &img->locked_pixels, &img->texture);
+
+	/* RGB565形式の場合は詰め直して32ビットのピクセル列を解放する */
+	if (img->packed != NULL) {
+		for (i = 0; i < img->width * img->height; i++)
+			img->packed[i] = pack_pixel(img->pixels[i], 0, 0,
+						    false);
+		free_pixels(img->pixels, img->width, img->height);
+		img->pixels = NULL;
+		img->alpha_type = IMAGE_ALPHA_OPAQUE;
+	}
 }
 
 /*
@@ -275,6 +1129,9 @@ int get_image_lock_count(void)
  */
 pixel_t *get_image_pixels(struct image *img)
 {
+	/* RGB565形式のイメージはロック中のみ取得できる */
+	assert(img->packed == NULL || img->pixels != NULL);
+
 	if (img->locked_pixels != NULL)
 		return img->locked_pixels;
 
@@ -309,6 +1166,50 @@ void *get_texture_object(struct image *img)
 	return img->texture;
 }
 
+/*
+ * イメージのアルファ値の種類を取得する
+ */
+int get_image_alpha_type(struct image *img)
+{
+	assert(img != NULL);
+
+	return img->alpha_type;
+}
+
+/*
+ * イメージのアルファ値の種類を設定する
+ *  - デコーダがピクセル列を書き込んだ後に呼び出す
+ */
+void set_image_alpha_type(struct image *img, int type)
+{
+	assert(img != NULL);
+	assert(type == IMAGE_ALPHA_GENERAL || type == IMAGE_ALPHA_OPAQUE ||
+	       type == IMAGE_ALPHA_BINARY);
+
+	img->alpha_type = type;
+}
+
+/*
+ * ピクセル列のアルファ値の種類を判定する
+ *  - 行ごとにデコードした直後に呼び出せるよう、それまでの判定結果typeを
+ *    受け取って狭めた結果を返す
+ *  - 半透明のピクセルが見つかった時点で打ち切る
+ */
+int scan_image_alpha_type(const pixel_t *p, size_t count, int type)
+{
+	size_t i;
+	uint32_t a;
+
+	for (i = 0; i < count && type != IMAGE_ALPHA_GENERAL; i++) {
+		a = get_pixel_a(p[i]);
+		if (a == 0)
+			type = IMAGE_ALPHA_BINARY;
+		else if (a != 255)
+			type = IMAGE_ALPHA_GENERAL;
+	}
+	return type;
+}
+
 /*
  * クリア
  */
@@ -426,7 +1327,7 @@ void draw_image(struct image * RESTRICT dst_image,
 	assert(dst_image->pixels != NULL);
 	assert(src_image != NULL);
 	assert(src_image->width > 0 && src_image->height > 0);
-	assert(src_image->pixels != NULL);
+	assert(src_image->pixels != NULL || src_image->packed != NULL);
 	assert(width >= 0 && height >= 0);
 	assert(bt == BLEND_NONE || bt == BLEND_FAST || bt == BLEND_NORMAL ||
 	       bt == BLEND_ADD || bt == BLEND_SUB);
@@ -442,7 +1343,42 @@ void draw_image(struct image * RESTRICT dst_image,
 			 &dst_left, &dst_top, &src_left, &src_top))
 		return;	/* 描画範囲外 */
 
+	/*
+	 * 転送元のアルファ値の種類から、結果が同じになる軽い描画処理を選ぶ
+	 *  - 不透明なイメージのアルファ合成はコピーと同じ結果になる
+	 *  - 透明と不透明のみのイメージは透明なピクセルを飛ばしてコピーする
+	 */
+	if (alpha == 255 && (bt == BLEND_FAST || bt == BLEND_NORMAL)) {
+		if (src_image->alpha_type == IMAGE_ALPHA_OPAQUE ||
+		    src_image->packed != NULL) {
+			bt = BLEND_NONE;
+		} else if (src_image->alpha_type == IMAGE_ALPHA_BINARY) {
+			draw_kernel_count[DRAW_KERNEL_BINARY]++;
+			draw_blend_binary(dst_image, dst_left, dst_top,
+					  src_image, width, height, src_left,
+					  src_top, bt == BLEND_FAST);
+			return;
+		}
+	}
+
 	/* 描画を行う */
+	draw_kernel_count[bt]++;
+	if (src_image->packed != NULL) {
+		draw_packed_source(dst_image, dst_left, dst_top, src_image,
+				   width, height, src_left, src_top, alpha,
+				   bt);
+	} else {
+		draw_blend(dst_image, dst_left, dst_top, src_image, width,
+			   height, src_left, src_top, alpha, bt);
+	}
+}
+
+/* 描画関数を呼び出す */
+static void draw_blend(struct image * RESTRICT dst_image, int dst_left,
+		       int dst_top, struct image * RESTRICT src_image,
+		       int width, int height, int src_left, int src_top,
+		       int alpha, int bt)
+{
 	switch(bt) {
 	case BLEND_NONE:
 		draw_blend_none(dst_image, dst_left, dst_top, src_image, width,
@@ -470,6 +1406,59 @@ void draw_image(struct image * RESTRICT dst_image,
 	}
 }
 
+/*
+ * RGB565形式のイメージを描画する
+ *  - コピーの場合は描画先に直接展開する
+ *  - それ以外は1行ずつ展開し、1行のイメージとして描画関数に渡す
+ */
+static void draw_packed_source(struct image * RESTRICT dst_image,
+			       int dst_left, int dst_top,
+			       struct image * RESTRICT src_image, int width,
+			       int height, int src_left, int src_top,
+			       int alpha, int bt)
+{
+	struct image row;
+	pixel_t *dst_ptr;
+	const pixel_t *src_row;
+	int y;
+
+	for (y = 0; y < height; y++) {
+		if (bt == BLEND_NONE) {
+			dst_ptr = get_image_pixels(dst_image) +
+				dst_image->width * (dst_top + y) + dst_left;
+			unpack_pixels(dst_ptr, src_image->packed +
+				      src_image->width * (src_top + y) +
+				      src_left, width);
+			continue;
+		}
+
+		src_row = get_source_row(src_image, src_left, src_top + y,
+					 width);
+		if (src_row == NULL)
+			return;
+
+		memset(&row, 0, sizeof(row));
+		row.width = width;
+		row.height = 1;
+		row.pixels = (pixel_t *)src_row;
+		row.ref_count = 1;
+		row.alpha_type = IMAGE_ALPHA_OPAQUE;
+		draw_blend(dst_image, dst_left, dst_top + y, &row, width, 1, 0,
+			   0, alpha, bt);
+	}
+}
+
+/*
+ * 描画処理ごとの使用回数を取得する
+ */
+void get_draw_kernel_stats(uint64_t *count)
+{
+	int i;
+
+	for (i = 0; i < DRAW_KERNELS; i++)
+		count[i] = draw_kernel_count[i];
+}
+
 /*
  * クリッピング
  */
@@ -934,6 +1923,41 @@ static void draw_blend_sub(struct image *dst_image, int dst_left, int dst_top,
 
 #endif	/* SSE_VERSIONING */
 
+/*
+ * 透明なピクセルを飛ばしてコピーする描画関数
+ *  - 透明と不透明のピクセルのみのイメージをアルファ値255で描画する場合に
+ *    アルファ合成の代わりに用いる
+ *  - fill_alphaが真の場合はBLEND_FASTと同じく描画先のアルファ値を255にする
+ */
+static void draw_blend_binary(struct image * RESTRICT dst_image,
+			      int dst_left, int dst_top,
+			      struct image * RESTRICT src_image, int width,
+			      int height, int src_left, int src_top,
+			      bool fill_alpha)
+{
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	pixel_t src_pix, alpha_mask;
+	int x, y, sw, dw;
+
+	sw = get_image_width(src_image);
+	dw = get_image_width(dst_image);
+	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
+	dst_ptr = get_image_pixels(dst_image) + dw * dst_top + dst_left;
+	alpha_mask = fill_alpha ? make_pixel_fast(0xff, 0, 0, 0) : 0;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			src_pix = src_ptr[x];
+			if (get_pixel_a(src_pix) != 0)
+				dst_ptr[x] = src_pix;
+			else
+				dst_ptr[x] |= alpha_mask;
+		}
+		src_ptr += sw;
+		dst_ptr += dw;
+	}
+}
+
 /*
  * ルール付き描画
  *  - ベクトル化が見込めないのでここで定義する
@@ -947,7 +1971,8 @@ void draw_image_rule(struct image * RESTRICT dst_image,
 		     struct image * RESTRICT rule_image,
 		     int threshold)
 {
-	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr, * RESTRICT rule_ptr;
+	const pixel_t * RESTRICT src_ptr;
+	pixel_t * RESTRICT dst_ptr, * RESTRICT rule_ptr;
 	int x, y, dw, sw, rw, w, dh, sh, rh, h;
 
 	assert(dst_image->locked_pixels != NULL);
@@ -974,16 +1999,17 @@ void draw_image_rule(struct image * RESTRICT dst_image,
 
 	/* 描画する */
 	dst_ptr = get_image_pixels(dst_image);
-	src_ptr = get_image_pixels(src_image);
 	rule_ptr = get_image_pixels(rule_image);
 	for (y = 0; y < h; y++) {
+		src_ptr = get_source_row(src_image, 0, y, w);
+		if (src_ptr == NULL)
+			return;
 		for (x = 0; x < w; x++) {
 			if (get_pixel_c1(*(rule_ptr + x)) <=
 			    (unsigned char)threshold)
 				*(dst_ptr + x) = *(src_ptr + x);
 		}
 		dst_ptr += dw;
-		src_ptr += sw;
 		rule_ptr += rw;
 	}
 }
@@ -996,7 +2022,8 @@ void draw_image_melt(struct image * RESTRICT dst_image,
 		     struct image * RESTRICT rule_image,
 		     int threshold)
 {
-	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr, * RESTRICT rule_ptr;
+	const pixel_t * RESTRICT src_ptr;
+	pixel_t * RESTRICT dst_ptr, * RESTRICT rule_ptr;
 	pixel_t src_pix, dst_pix, rule_pix;
 	float src_a, src_r, src_g, src_b, dst_a, dst_r, dst_g, dst_b, rule_a;
 	int x, y, dw, sw, rw, w, dh, sh, rh, h;
@@ -1025,9 +2052,11 @@ void draw_image_melt(struct image * RESTRICT dst_image,
 
 	/* 描画する */
 	dst_ptr = get_image_pixels(dst_image);
-	src_ptr = get_image_pixels(src_image);
 	rule_ptr = get_image_pixels(rule_image);
 	for (y = 0; y < h; y++) {
+		src_ptr = get_source_row(src_image, 0, y, w);
+		if (src_ptr == NULL)
+			return;
 		for (x = 0; x < w; x++) {
 			/* 描画元のピクセルを取得する */
 			src_pix = src_ptr[x];
@@ -1064,7 +2093,6 @@ void draw_image_melt(struct image * RESTRICT dst_image,
 				(uint32_t)(src_b + dst_b));
 		}
 		dst_ptr += dw;
-		src_ptr += sw;
 		rule_ptr += rw;
 	}
 }
@@ -1083,7 +2111,8 @@ void draw_image_scale(struct image * RESTRICT dst_image,
 		      int virtual_dst_top,
 		      struct image * RESTRICT src_image)
 {
-	pixel_t *dst_ptr, *src_ptr;
+	pixel_t *dst_ptr;
+	const pixel_t *src_ptr;
 	float scale_x, scale_y;
 	pixel_t src_pix, dst_pix;
 	float src_a, src_r, src_g, src_b, dst_a, dst_r, dst_g, dst_b;
@@ -1113,7 +2142,6 @@ void draw_image_scale(struct image * RESTRICT dst_image,
 
 	/* ピクセルへのポインタを取得する */
 	dst_ptr = get_image_pixels(dst_image);
-	src_ptr = get_image_pixels(src_image);
 
 	/* 描画する */
 	for (i = real_draw_top; i < real_draw_top + real_draw_height; i++) {
@@ -1130,6 +2158,12 @@ void draw_image_scale(struct image * RESTRICT dst_image,
 		if (virtual_y >= real_src_height)
 			continue;
 
+		/* 描画元の行を取得する */
+		src_ptr = get_source_row(src_image, 0, virtual_y,
+					 real_src_width);
+		if (src_ptr == NULL)
+			return;
+
 		for (j = real_draw_left; j < real_draw_left + real_draw_width;
 		     j++) {
 			/* 描画先のX座標でクリッピングする */
@@ -1146,7 +2180,7 @@ void draw_image_scale(struct image * RESTRICT dst_image,
 				continue;
 
 			/* 描画元のピクセルを取得する */
-			src_pix = src_ptr[real_src_width * virtual_y + virtual_x];
+			src_pix = src_ptr[virtual_x];
 
 			/* 描画先のピクセルを取得する */
 			dst_pix = dst_ptr[real_dst_width * i + j];
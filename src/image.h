@@ -16,6 +16,15 @@
  *  2016-06-16 OSX対応
  *  2016-08-05 Android NDK対応
  *  2021-06-10 マスクつき描画対応
+ *  2026-10-19 生ピクセル形式のイメージファイルに対応
+ *  2026-10-19 参照カウントとデコード済みイメージのキャッシュに対応
+ *  2026-10-19 イメージの先読みに対応
+ *  2026-10-19 複数のイメージの並列デコードに対応
+ *  2026-10-19 縮小デコードに対応
+ *  2026-10-19 アルファ値の種類による描画処理の自動選択に対応
+ *  2026-10-19 RGB565形式の不透明イメージに対応
+ *  2026-10-19 ピクセル列のプールに対応
+ *  2026-10-19 所有者の種類ごとのメモリ使用量の集計に対応
  */
 
 #ifndef SUIKA_IMAGE_H
@@ -41,6 +50,36 @@ enum blend_type {
 	BLEND_SUB,			/* 飽和減算ブレンド */
 };
 
+/*
+ * 読み込み時に判定したイメージのアルファ値の種類
+ *  - ロックされたイメージは書き換えられた可能性があるので一般に戻る
+ */
+#define IMAGE_ALPHA_GENERAL	(0)	/* 半透明のピクセルを含む(不明を含む) */
+#define IMAGE_ALPHA_OPAQUE	(1)	/* 全てのピクセルが不透明 */
+#define IMAGE_ALPHA_BINARY	(2)	/* 完全な透明と不透明のピクセルのみ */
+
+/* 描画処理の種類(使用回数の統計用、BINARY以外はblend_typeと同じ順序) */
+enum draw_kernel {
+	DRAW_KERNEL_COPY,		/* コピー */
+	DRAW_KERNEL_FAST,		/* 高速なアルファ合成 */
+	DRAW_KERNEL_NORMAL,		/* 標準的なアルファ合成 */
+	DRAW_KERNEL_ADD,		/* 飽和加算 */
+	DRAW_KERNEL_SUB,		/* 飽和減算 */
+	DRAW_KERNEL_BINARY,		/* 透明なピクセルを飛ばしたコピー */
+	DRAW_KERNELS
+};
+
+/* イメージの所有者の種類(メモリ使用量の集計用) */
+enum image_category {
+	IMAGE_CATEGORY_NONE,		/* 所有者が決まっていない */
+	IMAGE_CATEGORY_LAYER,		/* ステージのレイヤと部品 */
+	IMAGE_CATEGORY_FADE,		/* フェード用のレイヤ */
+	IMAGE_CATEGORY_CACHE,		/* デコード済みイメージのキャッシュ */
+	IMAGE_CATEGORY_GUI,		/* GUIのボタン */
+	IMAGE_CATEGORY_THUMB,		/* セーブデータのサムネイル */
+	IMAGE_CATEGORIES
+};
+
 /* ピクセル値を合成する */
 static INLINE pixel_t make_pixel_fast(uint32_t a, uint32_t c1, uint32_t c2,
 				      uint32_t c3)
@@ -149,21 +188,106 @@ static INLINE uint32_t get_pixel_b_slow(pixel_t p)
 
 #endif
 
+/*
+ * 生ピクセル形式のイメージファイル (パッケージ作成時にPNGから変換される)
+ *
+ * struct raw_image {
+ *     u8  magic[8];       // RAW_IMAGE_MAGIC
+ *     u32 width;
+ *     u32 height;
+ *     u32 order;          // RAW_IMAGE_ARGB or RAW_IMAGE_ABGR
+ *     u8  reserved[12];
+ *     pixel_t pixels[width * height];
+ * };
+ */
+
+/* 生ピクセル形式のマジック */
+#define RAW_IMAGE_MAGIC		"SUIKARAW"
+
+/* 生ピクセル形式のヘッダのサイズ */
+#define RAW_IMAGE_HEADER_SIZE	(32)
+
+/* 生ピクセル形式のピクセル値の形式 */
+#define RAW_IMAGE_ARGB		(0)
+#define RAW_IMAGE_ABGR		(1)
+
 /* イメージを作成する */
 struct image *create_image(int w, int h);
 
 /* ピクセル列を指定してイメージを作成する */
 struct image *create_image_with_pixels(int w, int h, pixel_t *ptr);
 
+/* RGB565形式の不透明なイメージを作成する */
+struct image *create_image_rgb565(int w, int h);
+
+/* 不透明なイメージをRGB565形式に変換する */
+bool pack_image_rgb565(struct image *img);
+
+/* イメージがRGB565形式であるか調べる */
+bool is_image_rgb565(struct image *img);
+
 /* ファイル名を指定してイメージを作成する */
 struct image *create_image_from_file(const char *dir, const char *file);
 
+/* ファイル名を指定して縮小したイメージを作成する(JPEGのみ1/2, 1/4, 1/8) */
+struct image *create_image_from_file_scaled(const char *dir, const char *file,
+					    int scale_denom);
+
 /* 文字列で色を指定してイメージを作成する */
 struct image *create_image_from_color_string(int w, int h, const char *color);
 
-/* イメージを削除する */
+/* イメージの参照カウントを増やす */
+struct image *ref_image(struct image *img);
+
+/* イメージの参照カウントを取得する */
+int get_image_ref_count(struct image *img);
+
+/* イメージを削除する(参照カウントが0になったら解放する) */
 void destroy_image(struct image *img);
 
+/* デコード済みイメージのキャッシュを空にする */
+void cleanup_image_cache(void);
+
+/* デコード済みイメージのキャッシュの統計を取得する */
+void get_image_cache_stats(uint64_t *hit, uint64_t *miss, uint64_t *evict);
+
+/* キャッシュが共有するイメージのサイズの変化を反映する */
+void update_image_cache_bytes(struct image *img);
+
+/* イメージを別スレッドで先読みしてキャッシュに格納する */
+void prefetch_images(const char **dir, const char **file, int count);
+
+/* イメージの先読みを取り消す */
+void cancel_image_prefetch(void);
+
+/* 複数のイメージを並列にデコードしてキャッシュに格納する */
+void preload_images(const char **dir, const char **file, int count);
+
+/* ピクセル列のプールの空きバッファを解放する(終了時) */
+void cleanup_image_pool(void);
+
+/* ピクセル列のプールの統計を取得する */
+void get_image_pool_stats(uint64_t *hit, uint64_t *miss, uint64_t *trim,
+			  size_t *bytes, size_t *peak_bytes);
+
+/* イメージの所有者の種類を設定する(最後に設定したものが有効になる) */
+void set_image_category(struct image *img, int category);
+
+/* イメージがキャッシュに格納されているかを設定する */
+void set_image_cached(struct image *img, bool is_cached);
+
+/* イメージの所有者の種類を取得する */
+int get_image_category(struct image *img);
+
+/* 所有者の種類ごとのメモリ使用量を取得する(IMAGE_CATEGORIES個) */
+void get_image_memory_stats(size_t *bytes, int *count);
+
+/* 所有者の種類ごとのメモリ使用量をログに出力する */
+void dump_image_memory_stats(void);
+
+/* 生存しているイメージをリークとしてログに出力する(終了時) */
+void report_image_leaks(void);
+
 /* イメージをロックする */
 bool lock_image(struct image *img);
 
@@ -185,6 +309,15 @@ int get_image_height(struct image *img);
 /* テクスチャを取得する */
 void *get_texture_object(struct image *img);
 
+/* イメージのアルファ値の種類を取得する */
+int get_image_alpha_type(struct image *img);
+
+/* イメージのアルファ値の種類を設定する(デコーダ用) */
+void set_image_alpha_type(struct image *img, int type);
+
+/* ピクセル列のアルファ値の種類を判定する(typeから狭めていく) */
+int scan_image_alpha_type(const pixel_t *p, size_t count, int type);
+
 /* イメージに関連付けられたオブジェクトを取得する(for NDK, iOS) */
 void *get_image_object(struct image *img);
 
@@ -219,6 +352,9 @@ void draw_image(struct image * RESTRICT dst_image,
 		int alpha,
 		int bt);
 
+/* 描画処理ごとの使用回数を取得する(countはDRAW_KERNELS個) */
+void get_draw_kernel_stats(uint64_t *count);
+
 /* イメージをルール付きで描画する */
 void draw_image_rule(struct image * RESTRICT dst_image,
 		     struct image * RESTRICT src_image,
@@ -18,6 +18,12 @@
  *  - 2022/06/14 Suika2 Pro for Creators
  *  - 2022/11/06 UTF-8
  *  - 2023/01/06 パラメータ名のエラーを追加
+ *  - 2026/10/19 数値のパラメータのエラーを追加
+ *  - 2026/10/19 ワーカスレッドからの呼び出しに対応
+ *  - 2026/10/19 ピクセル列のプールの統計を追加
+ *  - 2026/10/19 イメージのメモリ使用量とリークを追加
+ *  - 2026/10/19 ワーカスレッドのログの破棄に対応
+ *  - 2026/10/19 描画処理とキャッシュの統計を追加
  */
 
 /*
@@ -29,11 +35,73 @@
 
 #include "suika.h"
 
+/* ワーカスレッドのログをサポートするか */
+#if !defined(EM) && !defined(SWITCH)
+#define WORKER_LOG
+#ifdef WIN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
+#ifdef WORKER_LOG
+/* 保留できるワーカスレッドのログの最大数 */
+#define WORKER_LOG_MAX		(64)
+
+/* ワーカスレッドのログのバッファサイズ */
+#define WORKER_LOG_BUF_SIZE	(1024)
+
+/* init_worker_log()が呼ばれたか */
+static bool is_worker_log_enabled;
+
+/* メインスレッド */
+#ifdef WIN
+static DWORD main_thread_id;
+#else
+static pthread_t main_thread;
+#endif
+
+/* メインスレッドで調べた英語モードであるか */
+static bool is_worker_english_mode;
+
+/* 保留されたログ (先頭の1文字はレベル) */
+static char *worker_log[WORKER_LOG_MAX];
+static int worker_log_count;
+
+/* 保留されたログのロック */
+#ifdef WIN
+static CRITICAL_SECTION worker_log_lock;
+#else
+static pthread_mutex_t worker_log_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* ログを捨てるワーカスレッド (保留されたログのロック中に更新する) */
+static bool is_discard_thread_set;
+#ifdef WIN
+static DWORD discard_thread_id;
+#else
+static pthread_t discard_thread;
+#endif
+#endif
+
 static bool is_english_mode(void);
+#ifdef WORKER_LOG
+static bool is_worker_thread(void);
+static bool put_worker_log(char level, const char *s, va_list ap);
+static bool log_error_worker(const char *s, ...);
+static bool log_info_worker(const char *s, ...);
+#endif
 
 /* 英語モードであるかチェックする */
 static bool is_english_mode(void)
 {
+#ifdef WORKER_LOG
+	/* ワーカスレッドではロケールを調べない(setlocale()を呼ぶため) */
+	if (is_worker_thread())
+		return is_worker_english_mode;
+#endif
+
 	/* FIXME: 日本語ロケールでなければ英語メッセージする */
 	if (strcmp(get_system_locale(), "ja") == 0)
 		return false;
@@ -41,6 +109,184 @@ static bool is_english_mode(void)
 		return true;
 }
 
+/*
+ * ワーカスレッドからのログ出力を可能にする
+ *  - メインスレッドからワーカスレッドの開始前に呼び出す
+ */
+void init_worker_log(void)
+{
+#ifdef WORKER_LOG
+	if (is_worker_log_enabled)
+		return;
+
+#ifdef WIN
+	main_thread_id = GetCurrentThreadId();
+	InitializeCriticalSection(&worker_log_lock);
+#else
+	main_thread = pthread_self();
+#endif
+	is_worker_english_mode = is_english_mode();
+	is_worker_log_enabled = true;
+#endif
+}
+
+/*
+ * ワーカスレッドから出力されたログを出力する
+ *  - メインスレッドから呼び出す
+ */
+void flush_worker_log(void)
+{
+#ifdef WORKER_LOG
+	char *log[WORKER_LOG_MAX];
+	int i, count;
+
+	if (!is_worker_log_enabled)
+		return;
+
+	/* ロック中にプラットフォームのログ関数を呼ばないように取り出す */
+#ifdef WIN
+	EnterCriticalSection(&worker_log_lock);
+#else
+	pthread_mutex_lock(&worker_log_lock);
+#endif
+	count = worker_log_count;
+	for (i = 0; i < count; i++)
+		log[i] = worker_log[i];
+	worker_log_count = 0;
+#ifdef WIN
+	LeaveCriticalSection(&worker_log_lock);
+#else
+	pthread_mutex_unlock(&worker_log_lock);
+#endif
+
+	for (i = 0; i < count; i++) {
+		if (log[i][0] == 'E')
+			log_error("%s", log[i] + 1);
+		else
+			log_info("%s", log[i] + 1);
+		free(log[i]);
+	}
+#endif
+}
+
+/*
+ * 呼び出したワーカスレッドのログを捨てるかを設定する
+ *  - 失敗をメインスレッドで改めて報告するワーカスレッドから呼び出す
+ *  - ログを捨てるワーカスレッドは同時に1つまでとする
+ */
+void discard_worker_log(bool discard)
+{
+#ifdef WORKER_LOG
+	if (!is_worker_thread())
+		return;
+
+#ifdef WIN
+	EnterCriticalSection(&worker_log_lock);
+	discard_thread_id = GetCurrentThreadId();
+#else
+	pthread_mutex_lock(&worker_log_lock);
+	discard_thread = pthread_self();
+#endif
+	is_discard_thread_set = discard;
+#ifdef WIN
+	LeaveCriticalSection(&worker_log_lock);
+#else
+	pthread_mutex_unlock(&worker_log_lock);
+#endif
+#else
+	UNUSED_PARAMETER(discard);
+#endif
+}
+
+#ifdef WORKER_LOG
+/* ワーカスレッドから呼び出されたかチェックする */
+static bool is_worker_thread(void)
+{
+	if (!is_worker_log_enabled)
+		return false;
+#ifdef WIN
+	return GetCurrentThreadId() != main_thread_id;
+#else
+	return !pthread_equal(pthread_self(), main_thread);
+#endif
+}
+
+/*
+ * ワーカスレッドのログを保留する
+ *  - 保留できる数を超えた場合とメモリが確保できない場合は捨てる
+ *  - ログを捨てるワーカスレッドからの呼び出しでは捨てる
+ */
+static bool put_worker_log(char level, const char *s, va_list ap)
+{
+	char buf[WORKER_LOG_BUF_SIZE];
+	char *log;
+
+	buf[0] = level;
+	vsnprintf(buf + 1, sizeof(buf) - 1, s, ap);
+	log = strdup(buf);
+	if (log == NULL)
+		return false;
+
+#ifdef WIN
+	EnterCriticalSection(&worker_log_lock);
+#else
+	pthread_mutex_lock(&worker_log_lock);
+#endif
+#ifdef WIN
+	if (is_discard_thread_set &&
+	    GetCurrentThreadId() == discard_thread_id) {
+#else
+	if (is_discard_thread_set &&
+	    pthread_equal(pthread_self(), discard_thread)) {
+#endif
+		free(log);
+		log = NULL;
+	} else if (worker_log_count < WORKER_LOG_MAX) {
+		worker_log[worker_log_count++] = log;
+		log = NULL;
+	}
+#ifdef WIN
+	LeaveCriticalSection(&worker_log_lock);
+#else
+	pthread_mutex_unlock(&worker_log_lock);
+#endif
+
+	if (log != NULL) {
+		free(log);
+		return false;
+	}
+	return true;
+}
+
+/* ワーカスレッドのERRORログを保留する */
+static bool log_error_worker(const char *s, ...)
+{
+	va_list ap;
+	bool ret;
+
+	va_start(ap, s);
+	ret = put_worker_log('E', s, ap);
+	va_end(ap);
+	return ret;
+}
+
+/* ワーカスレッドのINFOログを保留する */
+static bool log_info_worker(const char *s, ...)
+{
+	va_list ap;
+	bool ret;
+
+	va_start(ap, s);
+	ret = put_worker_log('I', s, ap);
+	va_end(ap);
+	return ret;
+}
+
+/* 以降のログ出力はワーカスレッドから呼び出された場合に保留する */
+#define log_error	(is_worker_thread() ? log_error_worker : log_error)
+#define log_info	(is_worker_thread() ? log_info_worker : log_info)
+#endif
+
 /*
  * APIのエラーを記録する
  */
@@ -147,6 +393,94 @@ void log_memory(void)
 		log_error(U8("メモリの確保に失敗しました。\n"));
 }
 
+/*
+ * ピクセル列のプールの統計を記録する
+ */
+void log_image_pool_stats(unsigned long hit, unsigned long miss,
+			  unsigned long trim, unsigned long peak_kb)
+{
+	if (is_english_mode()) {
+		log_info("Image buffer pool: %lu reused, %lu allocated, "
+			 "%lu released, %lu KB kept at most.\n",
+			 hit, miss, trim, peak_kb);
+	} else {
+		log_info(U8("ピクセル列のプール: 再利用%lu回, 確保%lu回, ")
+			 U8("解放%lu回, 最大保持%luKB\n"),
+			 hit, miss, trim, peak_kb);
+	}
+}
+
+/*
+ * イメージの所有者の種類ごとのメモリ使用量を記録する
+ */
+void log_image_memory_stats(const char *category, unsigned long kb,
+			    int count)
+{
+	if (is_english_mode()) {
+		log_info("Image memory: %s %lu KB in %d images.\n", category,
+			 kb, count);
+	} else {
+		log_info(U8("イメージのメモリ: %s %luKB (%d個)\n"), category,
+			 kb, count);
+	}
+}
+
+/*
+ * 終了時に解放されていないイメージを記録する
+ */
+void log_image_leak(int width, int height, const char *category,
+		    int ref_count)
+{
+	if (is_english_mode()) {
+		log_info("Image leak: %dx%d %s image with reference count %d "
+			 "is not freed.\n", width, height, category,
+			 ref_count);
+	} else {
+		log_info(U8("イメージのリーク: %dx%dの%sのイメージ")
+			 U8("(参照カウント%d)が解放されていません。\n"),
+			 width, height, category, ref_count);
+	}
+}
+
+/*
+ * 描画処理ごとの使用回数を記録する
+ */
+void log_draw_kernel_stats(const char *kernel, unsigned long count)
+{
+	if (is_english_mode())
+		log_info("Draw kernel: %s used %lu times.\n", kernel, count);
+	else
+		log_info(U8("描画処理: %s %lu回\n"), kernel, count);
+}
+
+/*
+ * デコード済みイメージのキャッシュの統計を記録する
+ */
+void log_image_cache_stats(unsigned long hit, unsigned long miss,
+			   unsigned long evict)
+{
+	if (is_english_mode()) {
+		log_info("Image cache: %lu hits, %lu misses, %lu evicted.\n",
+			 hit, miss, evict);
+	} else {
+		log_info(U8("イメージのキャッシュ: ヒット%lu回, ミス%lu回, ")
+			 U8("追い出し%lu回\n"), hit, miss, evict);
+	}
+}
+
+/*
+ * グリフキャッシュの統計を記録する
+ */
+void log_glyph_cache_stats(unsigned long hit, unsigned long miss)
+{
+	if (is_english_mode()) {
+		log_info("Glyph cache: %lu hits, %lu misses.\n", hit, miss);
+	} else {
+		log_info(U8("グリフキャッシュ: ヒット%lu回, ミス%lu回\n"),
+			 hit, miss);
+	}
+}
+
 /*
  * パッケージファイルのエラーを記録する
  */
@@ -596,6 +930,18 @@ void log_script_param_mismatch(const char *name)
 	}
 }
 
+/*
+ * 数値のパラメータが数値でないエラーを記録する
+ */
+void log_script_not_number(const char *param)
+{
+	if (is_english_mode()) {
+		log_error("\"%s\" is not a number.\n", param);
+	} else {
+		log_error(U8("\"%s\"は数値ではありません。\n"), param);
+	}
+}
+
 /*
  * ビデオ再生に失敗した際のエラーを記録する
  */
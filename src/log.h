@@ -17,6 +17,12 @@
  *  - 2022/06/14 Suika2 Pro for Creators
  *  - 2022/07/28 GUIモジュール対応
  *  - 2023/01/06 パラメータ名のエラーを追加
+ *  - 2026/10/19 数値のパラメータのエラーを追加
+ *  - 2026/10/19 ワーカスレッドからの呼び出しに対応
+ *  - 2026/10/19 ピクセル列のプールの統計を追加
+ *  - 2026/10/19 イメージのメモリ使用量とリークを追加
+ *  - 2026/10/19 ワーカスレッドのログの破棄に対応
+ *  - 2026/10/19 描画処理とキャッシュの統計を追加
  */
 
 #ifndef SUIKA_LOG_H
@@ -24,8 +30,15 @@
 
 /*
  * ログを出力してよいのはメインスレッドのみとする。
+ *  - ただしinit_worker_log()の呼び出し後は、ワーカスレッドから呼び出された
+ *    log_*()の出力は保留され、flush_worker_log()で出力される
+ *  - discard_worker_log(true)を呼び出したワーカスレッドの出力は捨てられる
  */
 
+void init_worker_log(void);
+void flush_worker_log(void);
+void discard_worker_log(bool discard);
+
 void log_api_error(const char *api);
 void log_audio_file_error(const char *dir, const char *file);
 void log_dir_file_open(const char *dir, const char *file);
@@ -35,6 +48,16 @@ void log_file_read(const char *dir, const char *file);
 void log_font_file_error(const char *font);
 void log_image_file_error(const char *dir, const char *file);
 void log_memory(void);
+void log_image_pool_stats(unsigned long hit, unsigned long miss,
+			  unsigned long trim, unsigned long peak_kb);
+void log_image_memory_stats(const char *category, unsigned long kb,
+			    int count);
+void log_image_leak(int width, int height, const char *category,
+		    int ref_count);
+void log_draw_kernel_stats(const char *kernel, unsigned long count);
+void log_image_cache_stats(unsigned long hit, unsigned long miss,
+			   unsigned long evict);
+void log_glyph_cache_stats(unsigned long hit, unsigned long miss);
 void log_package_file_error(void);
 void log_duplicated_conf(const char *key);
 void log_undefined_conf(const char *key);
@@ -69,6 +92,7 @@ void log_script_shake_move(const char *move);
 void log_script_enable_disable(const char *param);
 void log_script_final_command(void);
 void log_script_param_mismatch(const char *name);
+void log_script_not_number(const char *param);
 void log_video_error(const char *reason);
 void log_script_choose_no_message(void);
 void log_script_empty_string(void);
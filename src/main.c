@@ -193,6 +193,9 @@ bool game_loop_iter(int *x, int *y, int *w, int *h)
 	/* サウンドのフェード処理を実行する */
 	process_sound_fading();
 
+	/* 使われていないフェード用のレイヤを解放する */
+	release_idle_fade_layer_images();
+
 	/*
 	 * 入力の状態をリセットする
 	 *  - Controlキー押下とドラッグ状態以外は1フレームごとにリセットする
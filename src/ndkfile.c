@@ -8,6 +8,9 @@
 /*
  * [Changes]
  *  - 2016/08/08 作成
+ *  - 2026/10/19 ファイルのメモリマップに対応
+ *  - 2026/10/19 パッケージ内のファイルのハッシュの取得に対応
+ *  - 2026/10/19 読み込み位置の設定に対応
  */
 
 #include "suika.h"
@@ -167,6 +170,46 @@ const char *gets_rfile(struct rfile *rf, char *buf, size_t size)
 	return buf;
 }
 
+/*
+ * ファイル読み込みストリームの読み込み位置を設定する
+ *  - ファイルの内容はメモリ上にあるので、位置を変えるだけでよい
+ */
+bool seek_rfile(struct rfile *rf, uint64_t pos)
+{
+	assert(rf != NULL);
+
+	if (pos > rf->size)
+		return false;
+
+	rf->pos = pos;
+	return true;
+}
+
+/*
+ * ファイルをメモリにマップする
+ *  - ファイルの内容は既にメモリ上にあるので、それを返す
+ */
+const void *map_rfile(struct rfile *rf)
+{
+	assert(rf != NULL);
+
+	if (rf->size == 0)
+		return NULL;
+
+	return rf->buf;
+}
+
+/*
+ * パッケージ内のファイルの内容のハッシュを取得する
+ */
+bool get_rfile_hash(struct rfile *rf, uint64_t *hash)
+{
+	/* Androidではアセットを直接読むのでハッシュを持たない */
+	UNUSED_PARAMETER(rf);
+	UNUSED_PARAMETER(hash);
+	return false;
+}
+
 /*
  * ファイル読み込みストリームを閉じる
  */
@@ -12,11 +12,20 @@
  *  - 2016/07/14 Created
  *  - 2022/05/24 Add obfuscation
  *  - 2022/06/14 Move to Suika2 Pro for Creators
+ *  - 2026/10/19 Add per-entry compression
+ *  - 2026/10/19 Add parallel encoding and incremental build
+ *  - 2026/10/19 Add deduplication of identical contents
+ *  - 2026/10/19 Add conversion of PNG files to raw images
+ *  - 2026/10/19 Update the existing package in place for incremental build
+ *  - 2026/10/19 Store fonts without compression so that they are seekable
  */
 
 #include "suika.h"
 #include "package.h"
 
+#include <zlib.h>
+#include <png.h>
+
 /* Obfuscation Key */
 #include "key.h"
 
@@ -24,13 +33,51 @@
 #include <windows.h>
 #else
 #include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
-/* Size of file count which is written at top of an archive */
-#define FILE_COUNT_BYTES	(8)
+/* Size of magic and file count which are written at top of an archive */
+#define HEADER_BYTES		(8 + 8)
 
 /* Size of file entry */
-#define ENTRY_BYTES		(256 + 8 + 8)
+#define ENTRY_BYTES		(256 + 8 + 8 + 8 + 8 + 8 + 8 + 8)
+
+/* Minimum size of a file to try compression */
+#define COMPRESS_MIN_BYTES	(256)
+
+/* A compressed body is used only if it saves 1/COMPRESS_GAIN_DIV or more */
+#define COMPRESS_GAIN_DIV	(20)
+
+/* Alignment of pixels of uncompressed raw images in an archive */
+#define RAW_IMAGE_ALIGN		(4096)
+
+/* Maximum number of worker threads */
+#define JOBS_MAX		(64)
+
+/* Number of entries which a worker encodes in a batch */
+#define BATCH_PER_JOB		(4)
+
+/* Maximum number of entries in a batch */
+#define BATCH_MAX		(JOBS_MAX * BATCH_PER_JOB)
+
+/* Size of the hash table of written bodies (must be a power of 2) */
+#define BODY_TABLE_SIZE		(FILE_ENTRY_SIZE * 2)
+
+/* Size of the buffers to compare files of entries with the same hash */
+#define COMPARE_BUF_SIZE	(65536)
+
+/* Rewrite the package if 1/REBUILD_WASTE_DIV of it or more becomes unused */
+#define REBUILD_WASTE_DIV	(4)
+
+/* Temporary file name which is renamed to the package file at the end */
+#define TEMPORARY_FILE		PACKAGE_FILE ".tmp"
+
+/* Errors which workers report to the writer */
+#define ENCODE_OK		(0)
+#define ENCODE_ERROR_OPEN	(1)
+#define ENCODE_ERROR_MEMORY	(2)
 
 /* Directory names */
 const char *dir_names[] = {
@@ -41,26 +88,149 @@ const char *dir_names[] = {
 /* Size of directory names */
 #define DIR_COUNT	((int)(sizeof(dir_names) / sizeof(const char *)))
 
+/* Directories of which PNG files are converted to raw images */
+const char *raw_image_dir_names[] = {
+	"bg/", "ch/", "cg/", "rule/"
+};
+
+/* Size of raw image directory names */
+#define RAW_IMAGE_DIR_COUNT \
+	((int)(sizeof(raw_image_dir_names) / sizeof(const char *)))
+
+/* Directory of which files are stored without compression (read by seeking) */
+#define FONT_DIR_NAME	"font/"
+
 /* File entry */
 struct file_entry entry[FILE_ENTRY_SIZE];
 
+/* Whether to compress entries (default: true) */
+bool package_compress = true;
+
+/* Whether to reuse unchanged entries of the existing package */
+bool package_incremental;
+
+/* Number of worker threads (0 for the number of processors) */
+int package_jobs;
+
+/* Whether to convert PNG files to raw images */
+bool package_raw_image;
+
+/* Pixel order of raw images (RAW_IMAGE_ARGB or RAW_IMAGE_ABGR) */
+int package_raw_order;
+
+/* Statistics of the last package creation */
+struct package_stats package_stats;
+
 /* File count */
 static uint64_t file_count;
 
 /* Current processing file's offset in archive file */
 static uint64_t offset;
 
-/* Next random number. */
-static uint64_t next_random;
+/* Initial random number of each entry */
+static uint64_t entry_seed[FILE_ENTRY_SIZE];
+
+/* Entries of the existing package (for incremental build) */
+static struct file_entry *old_entry;
+
+/* Entry count of the existing package */
+static uint64_t old_file_count;
+
+/* Indices of old_entry sorted by name */
+static uint64_t *old_order;
+
+/* Index of an old entry which is reusable for each entry, or -1 */
+static int64_t reuse_index[FILE_ENTRY_SIZE];
+
+/* Whether a reused entry keeps its body where it is in the existing package */
+static bool keep_in_place[FILE_ENTRY_SIZE];
+
+/* End of the bodies in the existing package */
+static uint64_t old_end;
+
+/* Hash table of entries which own written bodies (index + 1, or 0) */
+static uint32_t body_table[BODY_TABLE_SIZE];
+
+/* Base directory */
+static const char *package_base_dir;
+
+/* A batch of entries which workers encode in parallel */
+struct batch {
+	/* Range of entry indices */
+	uint64_t begin;
+	uint64_t end;
+
+	/* Encoded (compressed and obfuscated) bodies */
+	unsigned char *body[BATCH_MAX];
+
+	/* Errors */
+	int error[BATCH_MAX];
+
+	/* Number of workers */
+	int jobs;
+};
+
+/* Memory stream for libpng */
+struct png_source {
+	const unsigned char *buf;
+	size_t size;
+	size_t pos;
+};
+
+/* Argument for a worker thread */
+struct worker_arg {
+	struct batch *batch;
+	int id;
+};
+
+#ifdef WIN
+typedef HANDLE thread_t;
+#else
+typedef pthread_t thread_t;
+#endif
 
 /* forward declaration */
 static bool get_file_names(const char *base_dir, const char *dir);
-static bool get_file_sizes(const char *base_dir);
 static bool write_archive_file(const char *base_dir);
+static bool update_archive_file(const char *base_dir);
 static bool write_file_entries(FILE *fp);
-static bool write_file_bodies(const char *base_dir, FILE *fp);
-static void set_random_seed(uint64_t index);
-static char get_next_random(void);
+static bool write_file_bodies(FILE *fp);
+static void start_batch(struct batch *b, uint64_t begin, thread_t *thread,
+			struct worker_arg *arg);
+static void join_batch(struct batch *b, thread_t *thread);
+static bool write_batch(struct batch *b, FILE *fp);
+static int64_t find_or_add_body(uint64_t index);
+static bool is_same_content(uint64_t a, uint64_t b);
+#ifdef WIN
+static DWORD WINAPI worker_thread(LPVOID p);
+#else
+static void *worker_thread(void *p);
+#endif
+static void encode_entry(struct batch *b, uint64_t index);
+static unsigned char *read_file_body(uint64_t index, int *error);
+static unsigned char *read_old_body(uint64_t index, int *error);
+static unsigned char *deflate_file_body(const unsigned char *src,
+					uint64_t size, int level,
+					uint64_t *stored_size);
+static bool is_compress_target(uint64_t index);
+static bool is_raw_image_target(uint64_t index);
+static unsigned char *convert_png_to_raw(const unsigned char *png,
+					 uint64_t size, uint64_t *raw_size);
+static void png_read_memory(png_structp png_ptr, png_bytep buf,
+			    png_size_t len);
+static uint64_t get_content_hash(const unsigned char *buf, uint64_t size);
+static bool load_old_entries(const char *base_dir);
+static void find_reusable_entries(void);
+static bool find_in_place_entries(void);
+static int cmp_old_order(const void *a, const void *b);
+static int cmp_old_offset(const void *a, const void *b);
+static void cleanup_old_entries(void);
+static void make_path(const char *base_dir, const char *name, char *buf,
+		      size_t size);
+static bool seek_file(FILE *fp, uint64_t pos);
+static int get_jobs(void);
+static void set_random_seeds(uint64_t count);
+static char get_next_random(uint64_t *next_random);
 
 #ifdef WIN
 const wchar_t *conv_utf8_to_utf16(const char *utf8_message);
@@ -72,26 +242,48 @@ const char *conv_utf16_to_utf8(const wchar_t *utf16_message);
  */
 bool create_package(const char *base_dir)
 {
+	bool success;
 	int i;
 
 	file_count = 0;
 	offset = 0;
-	next_random = 0;
+	package_base_dir = base_dir;
+	memset(&package_stats, 0, sizeof(package_stats));
 
 	/* Get list of files. */
 	for (i = 0; i < DIR_COUNT; i++)
 		if (!get_file_names(base_dir, dir_names[i]))
 			return false;
 
-	/* Get all file sizes and decide all offsets in archive. */
-	if (!get_file_sizes(base_dir))
-		return false;
+	/*
+	 * Decide initial random numbers of all entries, including ones
+	 * which only the existing package has.
+	 */
+	set_random_seeds(FILE_ENTRY_SIZE);
+	memset(body_table, 0, sizeof(body_table));
+	memset(keep_in_place, 0, sizeof(keep_in_place));
 
-	/* Write archive file. */
-	if (!write_archive_file(base_dir))
-		return false;
+	/* Find unchanged files in the existing package. */
+	if (package_incremental) {
+		if (load_old_entries(base_dir))
+			find_reusable_entries();
+	} else {
+		for (i = 0; i < (int)file_count; i++)
+			reuse_index[i] = -1;
+	}
 
-	return true;
+	/*
+	 * Update the existing package in place if most of it is reused,
+	 * otherwise write a new archive file.
+	 */
+	if (old_entry != NULL && find_in_place_entries())
+		success = update_archive_file(base_dir);
+	else
+		success = write_archive_file(base_dir);
+
+	cleanup_old_entries();
+
+	return success;
 }
 
 #ifdef WIN
@@ -116,8 +308,19 @@ static bool get_file_names(const char *base_dir, const char *dir)
     {
         if(!(wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
         {
+            if(file_count >= FILE_ENTRY_SIZE)
+            {
+                log_too_many_files();
+                FindClose(hFind);
+                return false;
+            }
             snprintf(entry[file_count].name, FILE_NAME_SIZE, "%s/%s", dir,
 		     conv_utf16_to_utf8(wfd.cFileName));
+            entry[file_count].size =
+                ((uint64_t)wfd.nFileSizeHigh << 32) | wfd.nFileSizeLow;
+            entry[file_count].mtime =
+                ((uint64_t)wfd.ftLastWriteTime.dwHighDateTime << 32) |
+                wfd.ftLastWriteTime.dwLowDateTime;
             file_count++;
 	}
     } while(FindNextFile(hFind, &wfd));
@@ -131,6 +334,7 @@ static bool get_file_names(const char *base_dir, const char *dir)
 {
 	char abspath[1024];
 	struct dirent **names;
+	struct stat st;
 	int i, count;
 
 	/* Make path. */
@@ -142,7 +346,7 @@ static bool get_file_names(const char *base_dir, const char *dir)
 		log_dir_not_found(dir);
 		return false;
 	}
-	if (count > FILE_ENTRY_SIZE) {
+	if (count > FILE_ENTRY_SIZE - (int)file_count) {
 		log_too_many_files();
 		for (i = 0; i < count; i++)
 			free(names[i]);
@@ -157,6 +361,14 @@ static bool get_file_names(const char *base_dir, const char *dir)
 		snprintf(entry[file_count].name, FILE_NAME_SIZE, "%s/%s", dir,
 			 names[i]->d_name);
 		free(names[i]);
+
+		/* Get the size and the modification time. */
+		make_path(base_dir, entry[file_count].name, abspath,
+			  sizeof(abspath));
+		if (stat(abspath, &st) != 0 || S_ISDIR(st.st_mode))
+			continue;
+		entry[file_count].size = (uint64_t)st.st_size;
+		entry[file_count].mtime = (uint64_t)st.st_mtime;
 		file_count++;
 	}
 	free(names);
@@ -164,64 +376,76 @@ static bool get_file_names(const char *base_dir, const char *dir)
 }
 #endif
 
-/* Get sizes of each files. */
-static bool get_file_sizes(const char *base_dir)
+/* Write archive file. */
+static bool write_archive_file(const char *base_dir)
 {
+	char tmppath[1024], abspath[1024];
 	FILE *fp;
-	uint64_t i;
+	bool success;
 
-	/* Get each file size, and calc offsets. */
-	offset = FILE_COUNT_BYTES + ENTRY_BYTES * file_count;
-	for (i = 0; i < file_count; i++) {
-#ifdef WIN
-		UNUSED_PARAMETER(base_dir);
-		char *path = strdup(entry[i].name);
-		char *slash;
-		if (path == NULL) {
-			log_memory();
-			return false;
-		}
-		slash = strchr(path, '/');
-		if (slash == NULL)
-			return false;
-		*slash = '\\';
-		fp = fopen(path, "rb");
-#else
-		char abspath[1024];
-		snprintf(abspath, sizeof(abspath), "%s/%s", base_dir,
-			 entry[i].name);
-		fp = fopen(abspath, "r");
-#endif
-		if (fp == NULL) {
-			log_file_open(entry[i].name);
-			return false;
+	/*
+	 * Write to a temporary file because the existing package may be
+	 * read for an incremental build.
+	 */
+	make_path(base_dir, TEMPORARY_FILE, tmppath, sizeof(tmppath));
+	make_path(base_dir, PACKAGE_FILE, abspath, sizeof(abspath));
+	fp = fopen(tmppath, "wb");
+	if (fp == NULL) {
+		log_file_open(TEMPORARY_FILE);
+		return false;
+	}
+
+	/*
+	 * Write file bodies first because stored sizes are decided by
+	 * compression, then go back to the top and write the header.
+	 */
+	success = false;
+	do {
+		offset = HEADER_BYTES + ENTRY_BYTES * file_count;
+		if (fseek(fp, (long)offset, SEEK_SET) != 0)
+			break;
+		if (!write_file_bodies(fp))
+			break;
+		if (fseek(fp, 0, SEEK_SET) != 0)
+			break;
+		if (!write_file_entries(fp))
+			break;
+		success = true;
+	} while (0);
+
+	if (!success)
+		log_file_write(PACKAGE_FILE);
+
+	fclose(fp);
+
+	/* Replace the package file. */
+	if (success) {
+		remove(abspath);
+		if (rename(tmppath, abspath) != 0) {
+			log_file_write(PACKAGE_FILE);
+			success = false;
 		}
-		fseek(fp, 0, SEEK_END);
-		entry[i].size = (uint64_t)ftell(fp);
-		entry[i].offset = offset;
-		fclose(fp);
-#ifdef WIN
-		free(path);
-#endif
-		offset += entry[i].size;
 	}
-	return true;
+	if (!success)
+		remove(tmppath);
+
+	return success;
 }
 
-/* Write archive file. */
-static bool write_archive_file(const char *base_dir)
+/*
+ * Update the existing archive file in place. (for incremental build)
+ *  - Kept bodies stay where they are, and other bodies are appended.
+ *  - The entry table is written last, so the package remains the old one
+ *    if writing bodies fails.
+ */
+static bool update_archive_file(const char *base_dir)
 {
+	char abspath[1024];
 	FILE *fp;
 	bool success;
 
-#ifdef WIN
-	fp = fopen(PACKAGE_FILE, "wb");
-	UNUSED_PARAMETER(base_dir);
-#else
-	char abspath[1024];
-	snprintf(abspath, sizeof(abspath), "%s/%s", base_dir, PACKAGE_FILE);
-	fp = fopen(abspath, "wb");
-#endif
+	make_path(base_dir, PACKAGE_FILE, abspath, sizeof(abspath));
+	fp = fopen(abspath, "r+b");
 	if (fp == NULL) {
 		log_file_open(PACKAGE_FILE);
 		return false;
@@ -229,32 +453,47 @@ static bool write_archive_file(const char *base_dir)
 
 	success = false;
 	do {
-		if (fwrite(&file_count, sizeof(uint64_t), 1, fp) < 1)
+		offset = old_end;
+		if (offset < HEADER_BYTES + ENTRY_BYTES * file_count)
+			offset = HEADER_BYTES + ENTRY_BYTES * file_count;
+		if (!seek_file(fp, offset))
 			break;
-		if (!write_file_entries(fp))
+		if (!write_file_bodies(fp))
+			break;
+		if (fflush(fp) != 0)
 			break;
-		if (!write_file_bodies(base_dir, fp))
+		if (fseek(fp, 0, SEEK_SET) != 0)
+			break;
+		if (!write_file_entries(fp))
 			break;
 		success = true;
 	} while (0);
 
+	if (fclose(fp) != 0)
+		success = false;
 	if (!success)
 		log_file_write(PACKAGE_FILE);
 
-	return true;
+	return success;
 }
 
 /* Write file entries. */
 static bool write_file_entries(FILE *fp)
 {
 	char xor[FILE_NAME_SIZE];
-	uint64_t i;
+	uint64_t i, magic, next_random;
 	int j;
 
+	magic = PACKAGE_MAGIC_V2;
+	if (fwrite(&magic, sizeof(uint64_t), 1, fp) < 1)
+		return false;
+	if (fwrite(&file_count, sizeof(uint64_t), 1, fp) < 1)
+		return false;
+
 	for (i = 0; i < file_count; i++) {
-		set_random_seed(i);
+		next_random = entry_seed[i];
 		for (j = 0; j < FILE_NAME_SIZE; j++)
-			xor[j] = entry[i].name[j] ^ get_next_random();
+			xor[j] = entry[i].name[j] ^ get_next_random(&next_random);
 
 		if (fwrite(xor, FILE_NAME_SIZE, 1, fp) < 1)
 			return false;
@@ -262,85 +501,990 @@ static bool write_file_entries(FILE *fp)
 			return false;
 		if (fwrite(&entry[i].offset, sizeof(uint64_t), 1, fp) < 1)
 			return false;
+		if (fwrite(&entry[i].stored_size, sizeof(uint64_t), 1, fp) < 1)
+			return false;
+		if (fwrite(&entry[i].flags, sizeof(uint64_t), 1, fp) < 1)
+			return false;
+		if (fwrite(&entry[i].mtime, sizeof(uint64_t), 1, fp) < 1)
+			return false;
+		if (fwrite(&entry[i].hash, sizeof(uint64_t), 1, fp) < 1)
+			return false;
+		if (fwrite(&entry[i].key_index, sizeof(uint64_t), 1, fp) < 1)
+			return false;
 	}
 	return true;
 }
 
-/* Write file bodies. */
-static bool write_file_bodies(const char *base_dir, FILE *fp)
+/*
+ * Write file bodies.
+ *  - Workers encode a batch while the writer writes the previous batch.
+ */
+static bool write_file_bodies(FILE *fp)
 {
-	char buf[8192];
-	FILE *fpin;
-	uint64_t i;
-	size_t len, obf;
+	static struct batch batch[2];
+	thread_t thread[2][JOBS_MAX];
+	struct worker_arg arg[2][JOBS_MAX];
+	int cur;
+	bool success;
 
-	for (i = 0; i < file_count; i++) {
+	cur = 0;
+	start_batch(&batch[cur], 0, thread[cur], arg[cur]);
+
+	success = true;
+	while (batch[cur].begin < batch[cur].end) {
+		/* Wait for the current batch. */
+		join_batch(&batch[cur], thread[cur]);
+
+		/* Start the next batch. */
+		start_batch(&batch[cur ^ 1], batch[cur].end, thread[cur ^ 1],
+			    arg[cur ^ 1]);
+
+		/* Write the current batch in order. */
+		if (success && !write_batch(&batch[cur], fp))
+			success = false;
+
+		cur ^= 1;
+	}
+	return success;
+}
+
+/* Start workers for a batch which begins with the specified entry. */
+static void start_batch(struct batch *b, uint64_t begin, thread_t *thread,
+			struct worker_arg *arg)
+{
+	int i;
+
+	b->jobs = get_jobs();
+	b->begin = begin;
+	b->end = begin + (uint64_t)(b->jobs * BATCH_PER_JOB);
+	if (b->end > file_count)
+		b->end = file_count;
+	if (b->begin >= b->end) {
+		b->begin = b->end;
+		return;
+	}
+
+	for (i = 0; i < b->jobs; i++) {
+		arg[i].batch = b;
+		arg[i].id = i;
 #ifdef WIN
-		char *path = strdup(entry[i].name);
-		char *slash;
-		if (path == NULL) {
-			log_memory();
-			return false;
+		thread[i] = CreateThread(NULL, 0, worker_thread, &arg[i], 0,
+					 NULL);
+		if (thread[i] == NULL)
+			worker_thread(&arg[i]);
+#else
+		if (pthread_create(&thread[i], NULL, worker_thread,
+				   &arg[i]) != 0) {
+			thread[i] = pthread_self();
+			worker_thread(&arg[i]);
+		}
+#endif
+	}
+}
+
+/* Wait for workers of a batch. */
+static void join_batch(struct batch *b, thread_t *thread)
+{
+	int i;
+
+	for (i = 0; i < b->jobs; i++) {
+#ifdef WIN
+		if (thread[i] != NULL) {
+			WaitForSingleObject(thread[i], INFINITE);
+			CloseHandle(thread[i]);
 		}
-		slash = strchr(path, '/');
-		if (slash == NULL)
-			return false;
-		*slash = '\\';
-		fpin = fopen(path, "rb");
-		UNUSED_PARAMETER(base_dir);
 #else
-		char abspath[1024];
-		snprintf(abspath, sizeof(abspath), "%s/%s", base_dir,
-			 entry[i].name);
-		fpin = fopen(abspath, "rb");
+		if (!pthread_equal(thread[i], pthread_self()))
+			pthread_join(thread[i], NULL);
 #endif
-		if (fpin == NULL) {
-			log_file_open(entry[i].name);
-			return false;
+	}
+}
+
+/* Worker thread which encodes entries in a batch. */
+#ifdef WIN
+static DWORD WINAPI worker_thread(LPVOID p)
+#else
+static void *worker_thread(void *p)
+#endif
+{
+	struct worker_arg *arg;
+	uint64_t i;
+
+	arg = p;
+	for (i = arg->batch->begin + (uint64_t)arg->id; i < arg->batch->end;
+	     i += (uint64_t)arg->batch->jobs)
+		encode_entry(arg->batch, i);
+
+#ifdef WIN
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+/* Write encoded bodies of a batch. */
+static bool write_batch(struct batch *b, FILE *fp)
+{
+	static const unsigned char zero[RAW_IMAGE_ALIGN];
+	uint64_t i, pad;
+	int64_t owner;
+	int slot;
+	bool success;
+
+	success = true;
+	for (i = b->begin; i < b->end; i++) {
+		slot = (int)(i - b->begin);
+		if (success) {
+			/* Report an error of the worker. */
+			if (b->error[slot] == ENCODE_ERROR_OPEN) {
+				log_file_open(entry[i].name);
+				success = false;
+			} else if (b->error[slot] == ENCODE_ERROR_MEMORY) {
+				log_memory();
+				success = false;
+			}
 		}
-		set_random_seed(i);
-		do  {
-			len = fread(buf, 1, sizeof(buf), fpin);
-			if (len > 0) {
-				for (obf = 0; obf < len; obf++)
-					buf[obf] ^= get_next_random();
-				if (fwrite(buf, len, 1, fp) < 1) {
+		if (success) {
+			package_stats.file_count++;
+			package_stats.total_size += entry[i].size;
+			if (reuse_index[i] != -1)
+				package_stats.reused_count++;
+
+			/* Share the body if the same content is written. */
+			owner = find_or_add_body(i);
+			if (owner != -1) {
+				entry[i].offset = entry[owner].offset;
+				entry[i].stored_size = entry[owner].stored_size;
+				entry[i].flags = entry[owner].flags;
+				entry[i].key_index = entry[owner].key_index;
+				package_stats.dedup_count++;
+				package_stats.dedup_size += entry[i].stored_size;
+				free(b->body[slot]);
+				b->body[slot] = NULL;
+				continue;
+			}
+
+			if (keep_in_place[i]) {
+				/* The body is already in the package. */
+				package_stats.kept_count++;
+			} else {
+				/* Align pixels of an uncompressed raw image. */
+				if ((entry[i].flags & FILE_ENTRY_RAW_IMAGE) &&
+				    !(entry[i].flags & FILE_ENTRY_DEFLATE)) {
+					pad = (RAW_IMAGE_ALIGN -
+					       (offset + RAW_IMAGE_HEADER_SIZE) %
+					       RAW_IMAGE_ALIGN) % RAW_IMAGE_ALIGN;
+					if (pad > 0 &&
+					    fwrite(zero, (size_t)pad, 1,
+						   fp) < 1) {
+						log_file_write(entry[i].name);
+						success = false;
+					}
+					offset += pad;
+				}
+
+				entry[i].offset = offset;
+				if (success && entry[i].stored_size > 0 &&
+				    fwrite(b->body[slot],
+					   (size_t)entry[i].stored_size, 1,
+					   fp) < 1) {
 					log_file_write(entry[i].name);
-					return false;
+					success = false;
 				}
+				offset += entry[i].stored_size;
 			}
-		} while (len == sizeof(buf));
-#ifdef _WIN32
-		free(path);
-#endif
+
+			package_stats.stored_size += entry[i].stored_size;
+			if (entry[i].flags & FILE_ENTRY_DEFLATE)
+				package_stats.compressed_count++;
+			if (entry[i].flags & FILE_ENTRY_RAW_IMAGE)
+				package_stats.raw_image_count++;
+		}
+		free(b->body[slot]);
+		b->body[slot] = NULL;
+	}
+	return success;
+}
+
+/*
+ * Find an entry which owns a written body of the same content.
+ *  - If not found, the entry is registered as an owner and -1 is returned.
+ */
+static int64_t find_or_add_body(uint64_t index)
+{
+	uint64_t owner;
+	uint32_t slot;
+
+	/* Empty files don't have bodies. */
+	if (entry[index].size == 0)
+		return -1;
+
+	slot = (uint32_t)entry[index].hash & (BODY_TABLE_SIZE - 1);
+	while (body_table[slot] != 0) {
+		owner = body_table[slot] - 1;
+		if (entry[owner].hash == entry[index].hash &&
+		    entry[owner].size == entry[index].size &&
+		    is_same_content(owner, index))
+			return (int64_t)owner;
+		slot = (slot + 1) & (BODY_TABLE_SIZE - 1);
+	}
+	body_table[slot] = (uint32_t)index + 1;
+	return -1;
+}
+
+/*
+ * Check that two entries are made from files of the same content.
+ *  - Hashes may collide, so the files are compared byte by byte.
+ */
+static bool is_same_content(uint64_t a, uint64_t b)
+{
+	static unsigned char buf[2][COMPARE_BUF_SIZE];
+	char path[1024];
+	FILE *fp[2];
+	size_t len[2];
+	bool same;
+
+	/* Raw images converted in different pixel orders are different. */
+	if ((entry[a].flags & (FILE_ENTRY_RAW_IMAGE | FILE_ENTRY_RAW_ABGR)) !=
+	    (entry[b].flags & (FILE_ENTRY_RAW_IMAGE | FILE_ENTRY_RAW_ABGR)))
+		return false;
+
+	make_path(package_base_dir, entry[a].name, path, sizeof(path));
+	fp[0] = fopen(path, "rb");
+	if (fp[0] == NULL)
+		return false;
+	make_path(package_base_dir, entry[b].name, path, sizeof(path));
+	fp[1] = fopen(path, "rb");
+	if (fp[1] == NULL) {
+		fclose(fp[0]);
+		return false;
+	}
+
+	same = true;
+	do {
+		len[0] = fread(buf[0], 1, COMPARE_BUF_SIZE, fp[0]);
+		len[1] = fread(buf[1], 1, COMPARE_BUF_SIZE, fp[1]);
+		if (len[0] != len[1] || memcmp(buf[0], buf[1], len[0]) != 0) {
+			same = false;
+			break;
+		}
+	} while (len[0] > 0);
+
+	fclose(fp[0]);
+	fclose(fp[1]);
+
+	return same;
+}
+
+/*
+ * Read, compress and obfuscate an entry. (called from worker threads)
+ *  - Workers must not write logs, so errors are stored in the batch.
+ */
+static void encode_entry(struct batch *b, uint64_t index)
+{
+	struct file_entry *old;
+	unsigned char *body, *deflated, *raw;
+	uint64_t j, next_random, raw_size;
+	int slot, level;
+
+	slot = (int)(index - b->begin);
+	b->body[slot] = NULL;
+	b->error[slot] = ENCODE_OK;
+
+	/* Refer to the body in the existing package if it is kept. */
+	if (keep_in_place[index]) {
+		old = &old_entry[reuse_index[index]];
+		entry[index].size = old->size;
+		entry[index].offset = old->offset;
+		entry[index].stored_size = old->stored_size;
+		entry[index].flags = old->flags;
+		entry[index].hash = old->hash;
+		entry[index].key_index = old->key_index;
+		return;
+	}
+
+	/* Copy the body from the existing package if unchanged. */
+	if (reuse_index[index] != -1) {
+		b->body[slot] = read_old_body(index, &b->error[slot]);
+		return;
+	}
+
+	/* Read whole the file. */
+	body = read_file_body(index, &b->error[slot]);
+	if (body == NULL)
+		return;
+	entry[index].flags = 0;
+
+	/* Convert a PNG file to a raw image. (keep PNG if failed) */
+	level = Z_BEST_COMPRESSION;
+	if (is_raw_image_target(index)) {
+		raw = convert_png_to_raw(body, entry[index].size, &raw_size);
+		if (raw != NULL) {
+			free(body);
+			body = raw;
+			entry[index].size = raw_size;
+			entry[index].flags |= FILE_ENTRY_RAW_IMAGE;
+			if (package_raw_order == RAW_IMAGE_ABGR)
+				entry[index].flags |= FILE_ENTRY_RAW_ABGR;
+
+			/* Compress lightly to keep loading fast. */
+			level = Z_BEST_SPEED;
+		}
+	}
+
+	entry[index].hash = get_content_hash(body, entry[index].size);
+	entry[index].key_index = index;
+
+	/* Compress the body if it benefits. */
+	entry[index].stored_size = entry[index].size;
+	if (is_compress_target(index)) {
+		deflated = deflate_file_body(body, entry[index].size, level,
+					     &entry[index].stored_size);
+		if (deflated != NULL) {
+			free(body);
+			body = deflated;
+			entry[index].flags |= FILE_ENTRY_DEFLATE;
+		}
+	}
+
+	/* Obfuscate the body. */
+	next_random = entry_seed[index];
+	for (j = 0; j < entry[index].stored_size; j++)
+		body[j] ^= (unsigned char)get_next_random(&next_random);
+
+	b->body[slot] = body;
+}
+
+/* Read whole a file and set its size to the entry. */
+static unsigned char *read_file_body(uint64_t index, int *error)
+{
+	char path[1024];
+	FILE *fpin;
+	unsigned char *body;
+	long len;
+
+	make_path(package_base_dir, entry[index].name, path, sizeof(path));
+	fpin = fopen(path, "rb");
+	if (fpin == NULL) {
+		*error = ENCODE_ERROR_OPEN;
+		return NULL;
+	}
+
+	/* Get the file size. */
+	fseek(fpin, 0, SEEK_END);
+	len = ftell(fpin);
+	fseek(fpin, 0, SEEK_SET);
+	if (len < 0) {
+		*error = ENCODE_ERROR_OPEN;
+		fclose(fpin);
+		return NULL;
+	}
+	entry[index].size = (uint64_t)len;
+
+	/* Read the body. (allocate 1 byte at least for an empty file) */
+	body = malloc((size_t)len + 1);
+	if (body == NULL) {
+		*error = ENCODE_ERROR_MEMORY;
+		fclose(fpin);
+		return NULL;
+	}
+	if (len > 0 && fread(body, (size_t)len, 1, fpin) < 1) {
+		*error = ENCODE_ERROR_OPEN;
+		free(body);
+		fclose(fpin);
+		return NULL;
+	}
+	fclose(fpin);
+
+	return body;
+}
+
+/* Read a stored body from the existing package, and re-obfuscate it. */
+static unsigned char *read_old_body(uint64_t index, int *error)
+{
+	char path[1024];
+	struct file_entry *old;
+	FILE *fpin;
+	unsigned char *body;
+	uint64_t j, old_random, new_random;
+
+	old = &old_entry[reuse_index[index]];
+
+	make_path(package_base_dir, PACKAGE_FILE, path, sizeof(path));
+	fpin = fopen(path, "rb");
+	if (fpin == NULL) {
+		*error = ENCODE_ERROR_OPEN;
+		return NULL;
+	}
+
+	body = malloc((size_t)old->stored_size + 1);
+	if (body == NULL) {
+		*error = ENCODE_ERROR_MEMORY;
+		fclose(fpin);
+		return NULL;
+	}
+	if (!seek_file(fpin, old->offset) ||
+	    (old->stored_size > 0 &&
+	     fread(body, (size_t)old->stored_size, 1, fpin) < 1)) {
+		*error = ENCODE_ERROR_OPEN;
+		free(body);
 		fclose(fpin);
+		return NULL;
+	}
+	fclose(fpin);
+
+	/* Re-obfuscate only if the keystream of the entry has moved. */
+	if (old->key_index != index) {
+		old_random = entry_seed[old->key_index];
+		new_random = entry_seed[index];
+		for (j = 0; j < old->stored_size; j++) {
+			body[j] ^= (unsigned char)
+				(get_next_random(&old_random) ^
+				 get_next_random(&new_random));
+		}
+	}
+
+	entry[index].size = old->size;
+	entry[index].stored_size = old->stored_size;
+	entry[index].flags = old->flags;
+	entry[index].hash = old->hash;
+	entry[index].key_index = index;
+
+	return body;
+}
+
+/* Compress a file body, and return NULL if it doesn't benefit. */
+static unsigned char *deflate_file_body(const unsigned char *src,
+					uint64_t size, int level,
+					uint64_t *stored_size)
+{
+	z_stream z;
+	unsigned char *dst;
+	uLong bound;
+	int ret;
+
+	/* Small files and too large files are stored as is. */
+	if (size < COMPRESS_MIN_BYTES || size > 0x7fffffff)
+		return NULL;
+
+	memset(&z, 0, sizeof(z));
+	if (deflateInit2(&z, level, Z_DEFLATED,
+			 FILE_DEFLATE_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return NULL;
+
+	bound = deflateBound(&z, (uLong)size);
+	dst = malloc(bound);
+	if (dst == NULL) {
+		deflateEnd(&z);
+		return NULL;
 	}
+
+	z.next_in = (Bytef *)src;
+	z.avail_in = (uInt)size;
+	z.next_out = dst;
+	z.avail_out = (uInt)bound;
+	ret = deflate(&z, Z_FINISH);
+	*stored_size = z.total_out;
+	deflateEnd(&z);
+
+	/* Use the compressed body only if it is enough smaller. */
+	if (ret != Z_STREAM_END ||
+	    *stored_size + size / COMPRESS_GAIN_DIV >= size) {
+		*stored_size = size;
+		free(dst);
+		return NULL;
+	}
+
+	return dst;
+}
+
+/*
+ * Check whether an entry is to be compressed.
+ *  - Fonts are not compressed because the engine reads them by seeking
+ *    instead of loading whole the files.
+ */
+static bool is_compress_target(uint64_t index)
+{
+	if (!package_compress)
+		return false;
+
+	return strncmp(entry[index].name, FONT_DIR_NAME,
+		       strlen(FONT_DIR_NAME)) != 0;
+}
+
+/* Check whether an entry is a PNG file to be converted to a raw image. */
+static bool is_raw_image_target(uint64_t index)
+{
+	const char *name;
+	size_t len;
+	int i;
+
+	if (!package_raw_image)
+		return false;
+
+	name = entry[index].name;
+	len = strlen(name);
+	if (len < 4 || strcmp(name + len - 4, ".png") != 0)
+		return false;
+
+	for (i = 0; i < RAW_IMAGE_DIR_COUNT; i++) {
+		if (strncmp(name, raw_image_dir_names[i],
+			    strlen(raw_image_dir_names[i])) == 0)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Convert a PNG file to a raw image. Return NULL if it can't.
+ *  - Transformations must be the same as the PNG reader of the engine.
+ */
+static unsigned char *convert_png_to_raw(const unsigned char *png,
+					 uint64_t size, uint64_t *raw_size)
+{
+	png_structp png_ptr;
+	png_infop info_ptr;
+	struct png_source src;
+	png_bytep * volatile rows;
+	unsigned char * volatile raw;
+	uint32_t header[(RAW_IMAGE_HEADER_SIZE - 8) / sizeof(uint32_t)];
+	png_byte color_type, bit_depth;
+	bool bgr;
+	int width, height, y;
+
+	if (size < 8 || png_sig_cmp((png_const_bytep)png, 0, 8) != 0)
+		return NULL;
+
+	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+					 NULL);
+	if (png_ptr == NULL)
+		return NULL;
+	info_ptr = png_create_info_struct(png_ptr);
+	if (info_ptr == NULL) {
+		png_destroy_read_struct(&png_ptr, NULL, NULL);
+		return NULL;
+	}
+
+	rows = NULL;
+	raw = NULL;
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		free(rows);
+		free(raw);
+		return NULL;
+	}
+
+	src.buf = png;
+	src.size = (size_t)size;
+	src.pos = 8;
+	png_set_read_fn(png_ptr, &src, png_read_memory);
+	png_set_sig_bytes(png_ptr, 8);
+	png_read_info(png_ptr, info_ptr);
+
+	width = (int)png_get_image_width(png_ptr, info_ptr);
+	height = (int)png_get_image_height(png_ptr, info_ptr);
+	color_type = png_get_color_type(png_ptr, info_ptr);
+	bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+
+	/* ARGB pixels are BGRA in byte order. */
+	bgr = package_raw_order == RAW_IMAGE_ARGB;
+
+	/* Convert to 32-bit RGBA or BGRA. */
+	switch(color_type) {
+	case PNG_COLOR_TYPE_GRAY:
+		png_set_gray_to_rgb(png_ptr);
+		png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+		png_read_update_info(png_ptr, info_ptr);
+		break;
+	case PNG_COLOR_TYPE_PALETTE:
+		if (bgr)
+			png_set_bgr(png_ptr);
+		png_set_palette_to_rgb(png_ptr);
+		png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+		png_read_update_info(png_ptr, info_ptr);
+		break;
+	case PNG_COLOR_TYPE_RGB:
+		if (bgr)
+			png_set_bgr(png_ptr);
+		if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
+			png_set_tRNS_to_alpha(png_ptr);
+		} else {
+			png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+			png_read_update_info(png_ptr, info_ptr);
+		}
+		break;
+	case PNG_COLOR_TYPE_RGB_ALPHA:
+		if (bgr)
+			png_set_bgr(png_ptr);
+		break;
+	case PNG_COLOR_TYPE_GRAY_ALPHA:
+		png_set_gray_to_rgb(png_ptr);
+		png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+		png_read_update_info(png_ptr, info_ptr);
+		break;
+	default:
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		return NULL;
+	}
+	if (bit_depth == 16)
+		png_set_strip_16(png_ptr);
+
+	/* Allocate the raw image. */
+	*raw_size = RAW_IMAGE_HEADER_SIZE +
+		(uint64_t)width * (uint64_t)height * 4;
+	raw = malloc((size_t)*raw_size);
+	rows = malloc(sizeof(png_bytep) * (size_t)height);
+	if (raw == NULL || rows == NULL) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		free(rows);
+		free(raw);
+		return NULL;
+	}
+
+	/* Make the header. */
+	memset(header, 0, sizeof(header));
+	header[0] = (uint32_t)width;
+	header[1] = (uint32_t)height;
+	header[2] = (uint32_t)package_raw_order;
+	memcpy(raw, RAW_IMAGE_MAGIC, 8);
+	memcpy(raw + 8, header, sizeof(header));
+
+	/* Decode pixels. */
+	for (y = 0; y < height; y++) {
+		rows[y] = raw + RAW_IMAGE_HEADER_SIZE +
+			(size_t)width * 4 * (size_t)y;
+	}
+	png_read_image(png_ptr, rows);
+
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	free(rows);
+
+	return raw;
+}
+
+/* Read callback for libpng. */
+static void png_read_memory(png_structp png_ptr, png_bytep buf,
+			    png_size_t len)
+{
+	struct png_source *src;
+
+	src = png_get_io_ptr(png_ptr);
+	if (len > src->size - src->pos)
+		png_error(png_ptr, "Unexpected end of file");
+
+	memcpy(buf, src->buf + src->pos, len);
+	src->pos += len;
+}
+
+/* Calculate the hash of a content. (FNV-1a) */
+static uint64_t get_content_hash(const unsigned char *buf, uint64_t size)
+{
+	uint64_t hash, i;
+
+	hash = 0xcbf29ce484222325ULL;
+	for (i = 0; i < size; i++) {
+		hash ^= buf[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/*
+ * Load entries of the existing package.
+ *  - Only version 2 packages have modification times.
+ */
+static bool load_old_entries(const char *base_dir)
+{
+	char path[1024];
+	FILE *fp;
+	uint64_t i, magic, next_random, seed, lsb;
+	int j;
+
+	for (i = 0; i < file_count; i++)
+		reuse_index[i] = -1;
+
+	make_path(base_dir, PACKAGE_FILE, path, sizeof(path));
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return false;
+	if (fread(&magic, sizeof(uint64_t), 1, fp) < 1 ||
+	    magic != PACKAGE_MAGIC_V2 ||
+	    fread(&old_file_count, sizeof(uint64_t), 1, fp) < 1 ||
+	    old_file_count > FILE_ENTRY_SIZE) {
+		fclose(fp);
+		return false;
+	}
+
+	old_entry = malloc(sizeof(struct file_entry) * (old_file_count + 1));
+	old_order = malloc(sizeof(uint64_t) * (old_file_count + 1));
+	if (old_entry == NULL || old_order == NULL) {
+		log_memory();
+		fclose(fp);
+		cleanup_old_entries();
+		return false;
+	}
+
+	old_end = HEADER_BYTES + ENTRY_BYTES * old_file_count;
+	seed = OBFUSCATION_KEY;
+	for (i = 0; i < old_file_count; i++) {
+		if (fread(old_entry[i].name, FILE_NAME_SIZE, 1, fp) < 1 ||
+		    fread(&old_entry[i].size, sizeof(uint64_t), 1, fp) < 1 ||
+		    fread(&old_entry[i].offset, sizeof(uint64_t), 1, fp) < 1 ||
+		    fread(&old_entry[i].stored_size, sizeof(uint64_t), 1,
+			  fp) < 1 ||
+		    fread(&old_entry[i].flags, sizeof(uint64_t), 1, fp) < 1 ||
+		    fread(&old_entry[i].mtime, sizeof(uint64_t), 1, fp) < 1 ||
+		    fread(&old_entry[i].hash, sizeof(uint64_t), 1, fp) < 1 ||
+		    fread(&old_entry[i].key_index, sizeof(uint64_t), 1,
+			  fp) < 1 ||
+		    old_entry[i].key_index >= old_file_count)
+			break;
+
+		next_random = seed;
+		for (j = 0; j < FILE_NAME_SIZE; j++)
+			old_entry[i].name[j] ^= get_next_random(&next_random);
+		old_entry[i].name[FILE_NAME_SIZE - 1] = '\0';
+		old_order[i] = i;
+		if (old_end < old_entry[i].offset + old_entry[i].stored_size)
+			old_end = old_entry[i].offset + old_entry[i].stored_size;
+
+		seed ^= 0xafcb8f2ff4fff33fULL;
+		lsb = seed >> 63;
+		seed = (seed << 1) | lsb;
+	}
+	fclose(fp);
+	if (i != old_file_count) {
+		cleanup_old_entries();
+		return false;
+	}
+
+	/* Sort by name. */
+	qsort(old_order, (size_t)old_file_count, sizeof(uint64_t),
+	      cmp_old_order);
+
 	return true;
 }
 
-/* Set random seed. */
-static void set_random_seed(uint64_t index)
+/* Find old entries which have the same name, size and modification time. */
+static void find_reusable_entries(void)
+{
+	struct file_entry *old;
+	uint64_t i, lo, hi, mid;
+	int cmp;
+
+	for (i = 0; i < file_count; i++) {
+		reuse_index[i] = -1;
+
+		/* Binary search by name. */
+		lo = 0;
+		hi = old_file_count;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			cmp = strcmp(old_entry[old_order[mid]].name,
+				     entry[i].name);
+			if (cmp == 0) {
+				lo = mid;
+				break;
+			}
+			if (cmp < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo >= old_file_count)
+			continue;
+		old = &old_entry[old_order[lo]];
+		if (strcmp(old->name, entry[i].name) != 0)
+			continue;
+
+		/* Check that the file is unchanged. */
+		if (old->mtime == 0 || old->mtime != entry[i].mtime)
+			continue;
+		if (old->flags & FILE_ENTRY_RAW_IMAGE) {
+			/*
+			 * The size of a converted raw image differs from its
+			 * PNG file, so check that the conversion is the same.
+			 */
+			if (!is_raw_image_target(i))
+				continue;
+			if (((old->flags & FILE_ENTRY_RAW_ABGR) != 0) !=
+			    (package_raw_order == RAW_IMAGE_ABGR))
+				continue;
+		} else {
+			if (old->size != entry[i].size ||
+			    is_raw_image_target(i))
+				continue;
+		}
+
+		/* Don't reuse a compressed body if compression is disabled. */
+		if (!is_compress_target(i) && (old->flags & FILE_ENTRY_DEFLATE))
+			continue;
+
+		reuse_index[i] = (int64_t)old_order[lo];
+	}
+}
+
+/*
+ * Decide reused entries which keep their bodies in place.
+ *  - Return false if too much of the existing package would be unused, so
+ *    that the package is rewritten.
+ */
+static bool find_in_place_entries(void)
 {
-	uint64_t i, lsb;
+	uint64_t *order, i, count, table_end, used, prev;
+	struct file_entry *old;
+
+	order = malloc(sizeof(uint64_t) * (file_count + 1));
+	if (order == NULL) {
+		log_memory();
+		return false;
+	}
 
-	next_random = OBFUSCATION_KEY;
-	for (i = 0; i < index; i++) {
-		next_random ^= 0xafcb8f2ff4fff33fULL;
-		lsb = next_random >> 63;
-		next_random = (next_random << 1) | lsb;
+	/* Collect entries of which bodies can stay. */
+	table_end = HEADER_BYTES + ENTRY_BYTES * file_count;
+	count = 0;
+	for (i = 0; i < file_count; i++) {
+		if (reuse_index[i] == -1)
+			continue;
+
+		/*
+		 * Move a body which the larger entry table overwrites, or
+		 * which is encrypted with a keystream beyond the entries.
+		 */
+		old = &old_entry[reuse_index[i]];
+		if (old->offset < table_end || old->key_index >= file_count)
+			continue;
+
+		keep_in_place[i] = true;
+		order[count++] = i;
+	}
+
+	/* Sum the sizes of the kept bodies. (count shared bodies once) */
+	qsort(order, (size_t)count, sizeof(uint64_t), cmp_old_offset);
+	used = HEADER_BYTES + ENTRY_BYTES * old_file_count;
+	prev = 0;
+	for (i = 0; i < count; i++) {
+		old = &old_entry[reuse_index[order[i]]];
+		if (i == 0 || old->offset != prev)
+			used += old->stored_size;
+		prev = old->offset;
+	}
+	free(order);
+
+	/* Rewrite the package if the unused space is too large. */
+	if ((old_end - used) * REBUILD_WASTE_DIV >= old_end) {
+		memset(keep_in_place, 0, sizeof(keep_in_place));
+		return false;
+	}
+	return true;
+}
+
+/* Compare offsets of old entries which reused entries refer to. */
+static int cmp_old_offset(const void *a, const void *b)
+{
+	uint64_t oa, ob;
+
+	oa = old_entry[reuse_index[*(const uint64_t *)a]].offset;
+	ob = old_entry[reuse_index[*(const uint64_t *)b]].offset;
+	if (oa < ob)
+		return -1;
+	if (oa > ob)
+		return 1;
+	return 0;
+}
+
+/* Compare names of old entries. */
+static int cmp_old_order(const void *a, const void *b)
+{
+	return strcmp(old_entry[*(const uint64_t *)a].name,
+		      old_entry[*(const uint64_t *)b].name);
+}
+
+/* Free entries of the existing package. */
+static void cleanup_old_entries(void)
+{
+	free(old_entry);
+	free(old_order);
+	old_entry = NULL;
+	old_order = NULL;
+	old_file_count = 0;
+}
+
+/* Make a path of a file in the base directory. */
+static void make_path(const char *base_dir, const char *name, char *buf,
+		      size_t size)
+{
+#ifdef WIN
+	char *slash;
+
+	UNUSED_PARAMETER(base_dir);
+
+	snprintf(buf, size, "%s", name);
+	slash = strchr(buf, '/');
+	if (slash != NULL)
+		*slash = '\\';
+#else
+	snprintf(buf, size, "%s/%s", base_dir, name);
+#endif
+}
+
+/* Seek to a 64-bit position. */
+static bool seek_file(FILE *fp, uint64_t pos)
+{
+#ifdef WIN
+	return _fseeki64(fp, (__int64)pos, SEEK_SET) == 0;
+#else
+	return fseeko(fp, (off_t)pos, SEEK_SET) == 0;
+#endif
+}
+
+/* Get the number of worker threads. */
+static int get_jobs(void)
+{
+	int jobs;
+
+	jobs = package_jobs;
+	if (jobs <= 0) {
+#ifdef WIN
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		jobs = (int)si.dwNumberOfProcessors;
+#else
+		jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	}
+	if (jobs < 1)
+		jobs = 1;
+	if (jobs > JOBS_MAX)
+		jobs = JOBS_MAX;
+	return jobs;
+}
+
+/* Set initial random numbers of entries. */
+static void set_random_seeds(uint64_t count)
+{
+	uint64_t i, next, lsb;
+
+	/* The seed of an entry is derived from the seed of the previous. */
+	next = OBFUSCATION_KEY;
+	for (i = 0; i < count; i++) {
+		entry_seed[i] = next;
+		next ^= 0xafcb8f2ff4fff33fULL;
+		lsb = next >> 63;
+		next = (next << 1) | lsb;
 	}
 }
 
 /* Get next random number. */
-char get_next_random(void)
+static char get_next_random(uint64_t *next_random)
 {
 	char ret;
 
-	ret = (char)next_random;
+	ret = (char)*next_random;
 
-	next_random = (((OBFUSCATION_KEY & 0xff00) * next_random +
-			(OBFUSCATION_KEY & 0xff)) % OBFUSCATION_KEY) ^
-		      0xfcbfaff8f2f4f3f0;
+	*next_random = (((OBFUSCATION_KEY & 0xff00) * *next_random +
+			 (OBFUSCATION_KEY & 0xff)) % OBFUSCATION_KEY) ^
+		       0xfcbfaff8f2f4f3f0;
 
 	return ret;
 }
@@ -10,6 +10,11 @@
  *
  * [Changes]
  *  - 2022/06/14 作成
+ *  - 2026/10/19 エントリ単位の圧縮に対応
+ *  - 2026/10/19 並列化と差分作成に対応
+ *  - 2026/10/19 重複排除に対応
+ *  - 2026/10/19 生ピクセル形式への変換に対応
+ *  - 2026/10/19 差分作成で既存のパッケージを直接更新するようにした
  */
 
 #ifndef SUIKA_PACKAGE_H
@@ -17,6 +22,54 @@
 
 #include "types.h"
 
+/* パッケージ作成の統計情報 */
+struct package_stats {
+	/* ファイル数 */
+	uint64_t file_count;
+
+	/* 圧縮したファイル数 */
+	uint64_t compressed_count;
+
+	/* 既存のパッケージから再利用したファイル数 */
+	uint64_t reused_count;
+
+	/* 既存のパッケージ内の位置のまま再利用したファイル数 */
+	uint64_t kept_count;
+
+	/* 元のファイルサイズの合計 */
+	uint64_t total_size;
+
+	/* パッケージに格納したサイズの合計 */
+	uint64_t stored_size;
+
+	/* 他のファイルと本体を共有したファイル数 */
+	uint64_t dedup_count;
+
+	/* 本体の共有によって削減したサイズの合計 */
+	uint64_t dedup_size;
+
+	/* 生ピクセル形式に変換したイメージの数 */
+	uint64_t raw_image_count;
+};
+
+/* エントリを圧縮するか (デフォルトはtrue) */
+extern bool package_compress;
+
+/* 既存のパッケージから変更のないエントリを再利用するか */
+extern bool package_incremental;
+
+/* ワーカスレッドの数 (0ならプロセッサ数) */
+extern int package_jobs;
+
+/* PNGファイルを生ピクセル形式に変換するか */
+extern bool package_raw_image;
+
+/* 生ピクセル形式のピクセル値の形式 (RAW_IMAGE_ARGB or RAW_IMAGE_ABGR) */
+extern int package_raw_order;
+
+/* 最後に作成したパッケージの統計情報 */
+extern struct package_stats package_stats;
+
 /* パッケージを作成する */
 bool create_package(const char *base_dir);
 
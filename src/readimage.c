@@ -11,50 +11,1289 @@
 #include "suika.h"
 
 /* readjpeg.h */
-struct image *create_image_from_file_jpeg(const char *dir, const char *file);
+struct image *create_image_from_file_jpeg(const char *dir, const char *file,
+					  int scale_denom);
+
+#ifndef USE_DEBUGGER
+/* デコード済みイメージのキャッシュのハッシュ表のサイズ */
+#define IMAGE_CACHE_BUCKETS		(256)
+
+/* デコード済みイメージのキャッシュの容量のデフォルト値 */
+#define IMAGE_CACHE_DEFAULT_LIMIT	(32 * 1024 * 1024)
+
+/*
+ * イメージの先読みと一括読み込みをスレッドで行うか
+ *  - Androidのopen_rfile()はメインスレッドのJNIEnvを使うので行わない
+ */
+#if !defined(EM) && !defined(SWITCH) && !defined(ANDROID)
+#define PREFETCH_THREAD
+#ifdef WIN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#endif
+
+/* 一括読み込みでデコードするスレッドの最大数(メインスレッドを含む) */
+#define PRELOAD_THREAD_MAX		(4)
+
+/*
+ * デコード済みイメージのキャッシュのエントリ
+ *  - キャッシュがイメージの参照を1つ持ち、ステージ等とイメージを共有する
+ *  - キャッシュ以外から参照されていないものだけを追い出しの対象にする
+ */
+struct image_cache {
+	/* キー ("dir/file") */
+	char *key;
+	uint32_t hash;
+
+	/* イメージ */
+	struct image *img;
+
+	/* ピクセル列のサイズ */
+	size_t bytes;
+
+	/*
+	 * 先読みされてまだ使われていないか
+	 *  - 先読みのキューが置き換えられると、新しいキューにないものは
+	 *    falseに戻る
+	 */
+	bool is_prefetched;
+
+	/* テクスチャが未作成か(先読みスレッドでデコードされた場合) */
+	bool need_upload;
+
+	/* エラーを出力済みか(デコードに失敗した記録のみ) */
+	bool is_reported;
+
+	/* ハッシュ表のチェイン */
+	struct image_cache *hash_next;
+
+	/* LRUリスト (先頭が最も新しい) */
+	struct image_cache *lru_prev;
+	struct image_cache *lru_next;
+};
+
+/* デコード済みイメージのキャッシュ */
+static struct image_cache *image_cache_bucket[IMAGE_CACHE_BUCKETS];
+static struct image_cache *image_cache_lru_head;
+static struct image_cache *image_cache_lru_tail;
+static size_t image_cache_bytes;
+
+/* キャッシュのヒット数、ミス数、追い出し数 */
+static uint64_t image_cache_hit;
+static uint64_t image_cache_miss;
+static uint64_t image_cache_evict;
+
+/*
+ * 先読みと一括読み込みでデコードに失敗したファイル(imgはNULL)
+ *  - 同じファイルを繰り返し先読みしないように記録する
+ *  - 先読みスレッドのエラーは捨てられるので、メインスレッドで要求された
+ *    ときにデコードし直してエラーを出力する
+ *  - 一括読み込みのエラーは出力済みなので、重ねて出力しない
+ *  - hash_nextでつなぐ
+ */
+static struct image_cache *image_cache_failed;
+
+#ifdef PREFETCH_THREAD
+/*
+ * 先読みスレッドが追い出したエントリ
+ *  - テクスチャの破棄はメインスレッドで行う必要があるため、破棄を遅らせる
+ *  - hash_nextでつなぐ
+ */
+static struct image_cache *image_cache_garbage;
+
+/*
+ * キャッシュのロックとデコード待ちのロック (先読みスレッドの実行中のみ
+ * 用いる)
+ *  - デコード自体は並行して行えるので、デコード待ちのロックは先読み
+ *    スレッドがデコード中のファイルをメインスレッドが待つためだけに使う
+ */
+#ifdef WIN
+static CRITICAL_SECTION image_cache_lock;
+static CRITICAL_SECTION image_decode_lock;
+static bool is_image_lock_initialized;
+#else
+static pthread_mutex_t image_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t image_decode_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* 先読みスレッド */
+#ifdef WIN
+static HANDLE prefetch_handle;
+#else
+static pthread_t prefetch_tid;
+#endif
+
+/* 先読みスレッドを開始したか */
+static bool is_prefetch_running;
+
+/* 先読みスレッドが終了したか (キャッシュのロック中に更新する) */
+static bool is_prefetch_finished;
+
+/* 先読みするファイルのキュー (キャッシュのロック中に更新する) */
+static char **prefetch_queue;
+static int prefetch_count;
+static int prefetch_pos;
+
+/* 先読みスレッドがデコード中のキー (キャッシュのロック中に更新する) */
+static const char *prefetch_decoding_key;
 
 /*
- * ファイルスコープ変数
+ * 一括読み込みのスレッドの担当
+ *  - スレッドindexはindex, index + stride, ...番目のファイルをデコードする
+ *  - 担当が固定なのでロックを使わず、結果はスレッドの実行順序によらない
  */
-static struct rfile *rf;
-static png_structp png_ptr;
-static png_infop info_ptr;
-static png_bytep *rows;
-static int width;
-static int height;
-static struct image *image;
+struct preload_task {
+	char **key;
+	struct image **img;
+	int count;
+	int index;
+	int stride;
+#ifdef WIN
+	HANDLE handle;
+#else
+	pthread_t tid;
+#endif
+	bool is_started;
+};
+#endif
+#endif
+
+/*
+ * PNGデコーダのコンテキスト
+ *  - デコードごとにスタック上に確保し、複数のスレッドから同時に使える
+ */
+struct png_reader {
+	struct rfile *rf;
+	png_structp png_ptr;
+	png_infop info_ptr;
+	png_bytep *rows;
+	int width;
+	int height;
+	bool has_alpha;
+	int alpha_type;
+	struct image *image;
+};
 
 /*
  * 前方参照
  */
+static struct image *decode_image_file(const char *dir, const char *file);
+#ifndef USE_DEBUGGER
+static char *make_image_cache_key(const char *dir, const char *file,
+				  uint32_t *hash);
+static uint32_t get_image_cache_hash(const char *key);
+static struct image_cache *find_image_cache(const char *key, uint32_t hash);
+static struct image *take_image_cache(struct image_cache *ic);
+static bool insert_image_cache(char *key, uint32_t hash, struct image *img,
+			       bool is_prefetched);
+static size_t get_image_cache_limit(void);
+static size_t get_image_cache_bytes(struct image *img);
+static void link_image_cache_lru(struct image_cache *ic);
+static void unlink_image_cache_lru(struct image_cache *ic);
+static void unlink_image_cache(struct image_cache *ic);
+static void remove_image_cache(struct image_cache *ic);
+static void free_image_cache(struct image_cache *ic);
+static void defer_free_image_cache(struct image_cache *ic);
+static void free_image_cache_garbage(void);
+static struct image *decode_image_key(const char *key);
+static bool is_prefetch_decoding(const char *key);
+static struct image_cache **find_prefetch_failure(const char *key,
+						   uint32_t hash);
+static bool take_prefetch_failure(const char *key, uint32_t hash,
+				  bool *is_reported);
+static void stop_prefetch(void);
+#ifdef PREFETCH_THREAD
+#ifdef WIN
+static DWORD WINAPI prefetch_thread(LPVOID param);
+#else
+static void *prefetch_thread(void *param);
+#endif
+static void run_prefetch(void);
+static void add_prefetch_failure(char *key, uint32_t hash, bool is_reported);
+static void expire_prefetched_images(void);
+#ifdef WIN
+static DWORD WINAPI preload_thread(LPVOID param);
+#else
+static void *preload_thread(void *param);
+#endif
+static void run_preload(struct preload_task *task);
+static int get_preload_thread_count(int count);
+static void free_prefetch_queue(void);
+#endif
+static void lock_image_cache(void);
+static void unlock_image_cache(void);
+static void lock_image_decode(void);
+static void unlock_image_decode(void);
+#endif
+static void upload_image(struct image *img);
 static bool is_jpg_ext(const char *str);
-static struct image *cleanup(void);
-static bool read_image_file(const char *dir, const char *file);
-static bool check_signature(void);
-static bool read_header(void);
+static struct image *cleanup(struct png_reader *r);
+static bool read_image_file(struct png_reader *r, const char *dir,
+			    const char *file);
+static bool check_signature(struct png_reader *r, bool *is_raw);
+static bool read_header(struct png_reader *r);
 static void read_callback(png_structp png_ptr, png_bytep buf, png_size_t len);
-static bool read_body(void);
+static bool read_body(struct png_reader *r);
+static bool read_raw_image(struct png_reader *r);
 
 /*
  * イメージをファイルから読み込む
+ *  - キャッシュにあればデコードせずに共有する
+ *  - 返したイメージはdestroy_image()で参照を手放す
  */
 struct image *create_image_from_file(const char *dir, const char *file)
 {
+#ifndef USE_DEBUGGER
+	struct image_cache *ic;
+	struct image *img;
+	char *key;
+	uint32_t hash;
+	bool is_reported;
+
+	/* キーを作成する */
+	key = make_image_cache_key(dir, file, &hash);
+	if (key == NULL)
+		return NULL;
+
+	/* キャッシュを検索する */
+	lock_image_cache();
+	free_image_cache_garbage();
+	ic = find_image_cache(key, hash);
+	if (ic != NULL) {
+		img = take_image_cache(ic);
+		unlock_image_cache();
+		free(key);
+		return img;
+	}
+
+	/*
+	 * 先読みスレッドが同じファイルをデコード中の場合は終わるのを待って、
+	 * その結果を用いる
+	 */
+	if (is_prefetch_decoding(key)) {
+		unlock_image_cache();
+		lock_image_decode();
+		unlock_image_decode();
+		lock_image_cache();
+		ic = find_image_cache(key, hash);
+		if (ic != NULL) {
+			img = take_image_cache(ic);
+			unlock_image_cache();
+			free(key);
+			return img;
+		}
+	}
+
+	/*
+	 * 一括読み込みでデコードに失敗していればエラーは出力済みである
+	 *  - 先読みスレッドで失敗していれば、記録を取り除いてデコードし直し、
+	 *    ここで初めてエラーを出力する
+	 */
+	if (take_prefetch_failure(key, hash, &is_reported) && is_reported) {
+		unlock_image_cache();
+		free(key);
+		return NULL;
+	}
+	image_cache_miss++;
+	unlock_image_cache();
+
+	/* デコードする(先読みスレッドのデコードと並行してよい) */
+	img = decode_image_file(dir, file);
+	if (img == NULL) {
+		free(key);
+		return NULL;
+	}
+
+	/* テクスチャを作成する */
+	upload_image(img);
+
+	/*
+	 * キャッシュに追加する(keyの所有権は移る)
+	 *  - デコード中に先読みスレッドが追加していた場合はそちらを用いる
+	 */
+	lock_image_cache();
+	ic = find_image_cache(key, hash);
+	if (ic != NULL) {
+		destroy_image(img);
+		img = take_image_cache(ic);
+		free(key);
+	} else {
+		insert_image_cache(key, hash, img, false);
+	}
+	unlock_image_cache();
+
+	return img;
+#else
+	struct image *img;
+
+	/* デバッガでは編集されたファイルを読み直すためキャッシュしない */
+	img = decode_image_file(dir, file);
+	if (img != NULL)
+		upload_image(img);
+	return img;
+#endif
+}
+
+/*
+ * イメージをファイルから縮小して読み込む
+ *  - JPEGはDCTの段階で幅と高さを1/scale_denom(切り上げ)にしてデコードする
+ *  - JPEG以外は等倍でデコードするので、呼び出し元は幅と高さを確認する
+ *  - サムネイル等の一時的な用途を想定し、キャッシュには格納しない
+ */
+struct image *create_image_from_file_scaled(const char *dir, const char *file,
+					    int scale_denom)
+{
+	struct image *img;
+
+	assert(scale_denom == 1 || scale_denom == 2 || scale_denom == 4 ||
+	       scale_denom == 8);
+
+	if (is_jpg_ext(file))
+		img = create_image_from_file_jpeg(dir, file, scale_denom);
+	else
+		img = decode_image_file(dir, file);
+	if (img == NULL)
+		return NULL;
+
+	/* テクスチャを作成する */
+	upload_image(img);
+
+	return img;
+}
+
+/*
+ * デコード済みイメージのキャッシュを空にする
+ */
+void cleanup_image_cache(void)
+{
+#ifndef USE_DEBUGGER
+	stop_prefetch();
+	while (image_cache_lru_head != NULL)
+		remove_image_cache(image_cache_lru_head);
+	free_image_cache_garbage();
+	while (take_prefetch_failure(NULL, 0, NULL))
+		;
+	assert(image_cache_bytes == 0);
+#endif
+}
+
+/*
+ * デコード済みイメージのキャッシュの統計を取得する
+ */
+void get_image_cache_stats(uint64_t *hit, uint64_t *miss, uint64_t *evict)
+{
+#ifndef USE_DEBUGGER
+	lock_image_cache();
+	*hit = image_cache_hit;
+	*miss = image_cache_miss;
+	*evict = image_cache_evict;
+	unlock_image_cache();
+#else
+	*hit = 0;
+	*miss = 0;
+	*evict = 0;
+#endif
+}
+
+/*
+ * キャッシュが共有するイメージのピクセル列のサイズの変化を反映する
+ *  - イメージをRGB565形式に変換した後に呼び出す
+ *  - キャッシュにないイメージの場合は何もしない
+ */
+void update_image_cache_bytes(struct image *img)
+{
+#ifndef USE_DEBUGGER
+	struct image_cache *ic;
+
+	lock_image_cache();
+	for (ic = image_cache_lru_head; ic != NULL; ic = ic->lru_next) {
+		if (ic->img != img)
+			continue;
+		image_cache_bytes -= ic->bytes;
+		ic->bytes = get_image_cache_bytes(img);
+		image_cache_bytes += ic->bytes;
+		break;
+	}
+	unlock_image_cache();
+#else
+	UNUSED_PARAMETER(img);
+#endif
+}
+
+/*
+ * イメージを別スレッドで先読みしてキャッシュに格納する
+ *  - 先読み中のキューは置き換える
+ *  - キャッシュの容量を超える分は先読みしない
+ */
+void prefetch_images(const char **dir, const char **file, int count)
+{
+#if !defined(USE_DEBUGGER) && defined(PREFETCH_THREAD)
+	struct image_cache *ic;
+	char **queue;
+	uint32_t hash;
+	int i, n;
+
+	/* キャッシュにないファイルのキューを作成する */
+	queue = malloc(sizeof(char *) * (size_t)(count > 0 ? count : 1));
+	if (queue == NULL) {
+		log_memory();
+		return;
+	}
+	n = 0;
+	lock_image_cache();
+	expire_prefetched_images();
+	for (i = 0; i < count; i++) {
+		queue[n] = make_image_cache_key(dir[i], file[i], &hash);
+		if (queue[n] == NULL)
+			break;
+		ic = find_image_cache(queue[n], hash);
+		if (ic != NULL) {
+			/* 新しいキューのファイルは追い出さないようにする */
+			ic->is_prefetched = true;
+			free(queue[n]);
+			continue;
+		}
+		if (find_prefetch_failure(queue[n], hash) != NULL) {
+			free(queue[n]);
+			continue;
+		}
+		n++;
+	}
+	unlock_image_cache();
+	if (n == 0) {
+		free(queue);
+		return;
+	}
+
+	/* 実行中のスレッドがあればキューを置き換える */
+	if (is_prefetch_running) {
+		lock_image_cache();
+		if (!is_prefetch_finished) {
+			free_prefetch_queue();
+			prefetch_queue = queue;
+			prefetch_count = n;
+			prefetch_pos = 0;
+			unlock_image_cache();
+			return;
+		}
+		unlock_image_cache();
+
+		/* 終了済みのスレッドを回収する */
+		stop_prefetch();
+	}
+
+	/* キューを設定する */
+	prefetch_queue = queue;
+	prefetch_count = n;
+	prefetch_pos = 0;
+	is_prefetch_finished = false;
+
+	/* スレッドの開始前からロックを有効にする */
+	is_prefetch_running = true;
+
+	/* 先読みスレッドからログ関数を呼び出せるようにする */
+	init_worker_log();
+
+	/* スレッドを開始する */
+#ifdef WIN
+	if (!is_image_lock_initialized) {
+		InitializeCriticalSection(&image_cache_lock);
+		InitializeCriticalSection(&image_decode_lock);
+		is_image_lock_initialized = true;
+	}
+	prefetch_handle = CreateThread(NULL, 0, prefetch_thread, NULL, 0,
+				       NULL);
+	if (prefetch_handle == NULL) {
+		is_prefetch_running = false;
+		free_prefetch_queue();
+		return;
+	}
+#else
+	if (pthread_create(&prefetch_tid, NULL, prefetch_thread, NULL) != 0) {
+		is_prefetch_running = false;
+		free_prefetch_queue();
+		return;
+	}
+#endif
+#else
+	UNUSED_PARAMETER(dir);
+	UNUSED_PARAMETER(file);
+	UNUSED_PARAMETER(count);
+#endif
+}
+
+/*
+ * イメージの先読みを取り消す
+ *  - デコード中のイメージはキャッシュに格納される
+ *  - 先読み済みのイメージは追い出しの対象に戻す
+ */
+void cancel_image_prefetch(void)
+{
+#if !defined(USE_DEBUGGER) && defined(PREFETCH_THREAD)
+	if (!is_prefetch_running)
+		return;
+
+	lock_image_cache();
+	free_prefetch_queue();
+	expire_prefetched_images();
+	unlock_image_cache();
+#endif
+}
+
+/*
+ * 複数のイメージを並列にデコードしてキャッシュに格納する
+ *  - 全てのデコードが終わるまで戻らない
+ *  - 続けてcreate_image_from_file()を呼ぶとキャッシュにヒットする
+ *  - 結果をキャッシュに格納する順序は引数の順序に従う
+ *  - デコードに失敗したファイルのエラーはここで出力され、その後の
+ *    create_image_from_file()はエラーを重ねて出力せずにNULLを返す
+ */
+void preload_images(const char **dir, const char **file, int count)
+{
+#if !defined(USE_DEBUGGER) && defined(PREFETCH_THREAD)
+	struct preload_task task[PRELOAD_THREAD_MAX];
+	struct image **img;
+	char **key;
+	uint32_t hash;
+	int i, j, n, threads;
+
+	if (count <= 1)
+		return;
+
+	/* キャッシュにないファイルのキーを重複を除いて作成する */
+	key = malloc(sizeof(char *) * (size_t)count);
+	img = malloc(sizeof(struct image *) * (size_t)count);
+	if (key == NULL || img == NULL) {
+		log_memory();
+		free(key);
+		free(img);
+		return;
+	}
+	n = 0;
+	lock_image_cache();
+	for (i = 0; i < count; i++) {
+		key[n] = make_image_cache_key(dir[i], file[i], &hash);
+		if (key[n] == NULL)
+			break;
+		for (j = 0; j < n; j++)
+			if (strcmp(key[j], key[n]) == 0)
+				break;
+		if (j < n || find_image_cache(key[n], hash) != NULL ||
+		    find_prefetch_failure(key[n], hash) != NULL) {
+			free(key[n]);
+			continue;
+		}
+		img[n++] = NULL;
+	}
+	unlock_image_cache();
+	if (n == 0) {
+		free(key);
+		free(img);
+		return;
+	}
+
+	/* スレッドを開始する(0番目はメインスレッドが担当する) */
+	threads = get_preload_thread_count(n);
+	if (threads > 1)
+		init_worker_log();
+	for (i = 0; i < threads; i++) {
+		task[i].key = key;
+		task[i].img = img;
+		task[i].count = n;
+		task[i].index = i;
+		task[i].stride = threads;
+		task[i].is_started = false;
+		if (i == 0)
+			continue;
+#ifdef WIN
+		task[i].handle = CreateThread(NULL, 0, preload_thread,
+					      &task[i], 0, NULL);
+		task[i].is_started = task[i].handle != NULL;
+#else
+		task[i].is_started = pthread_create(&task[i].tid, NULL,
+						    preload_thread,
+						    &task[i]) == 0;
+#endif
+	}
+
+	/* メインスレッドの担当分と、開始できなかったスレッドの担当分を行う */
+	run_preload(&task[0]);
+	for (i = 1; i < threads; i++)
+		if (!task[i].is_started)
+			run_preload(&task[i]);
+
+	/* スレッドの終了を待つ */
+	for (i = 1; i < threads; i++) {
+		if (!task[i].is_started)
+			continue;
+#ifdef WIN
+		WaitForSingleObject(task[i].handle, INFINITE);
+		CloseHandle(task[i].handle);
+#else
+		pthread_join(task[i].tid, NULL);
+#endif
+	}
+	flush_worker_log();
+
+	/*
+	 * 引数の順にキャッシュに追加して、キャッシュの参照だけを残す
+	 *  - デコード中に先読みスレッドが追加していた場合は捨てる
+	 */
+	lock_image_cache();
+	for (i = 0; i < n; i++) {
+		hash = get_image_cache_hash(key[i]);
+		if (img[i] == NULL) {
+			add_prefetch_failure(key[i], hash, true);
+		} else if (find_image_cache(key[i], hash) != NULL) {
+			destroy_image(img[i]);
+			free(key[i]);
+		} else {
+			insert_image_cache(key[i], hash, img[i], true);
+			destroy_image(img[i]);
+		}
+	}
+	unlock_image_cache();
+
+	free(key);
+	free(img);
+#else
+	UNUSED_PARAMETER(dir);
+	UNUSED_PARAMETER(file);
+	UNUSED_PARAMETER(count);
+#endif
+}
+
+#ifndef USE_DEBUGGER
+/* キャッシュのキーとハッシュ値を作成する */
+static char *make_image_cache_key(const char *dir, const char *file,
+				  uint32_t *hash)
+{
+	char *key;
+	size_t dir_len, file_len;
+
+	dir_len = strlen(dir);
+	file_len = strlen(file);
+	key = malloc(dir_len + file_len + 2);
+	if (key == NULL) {
+		log_memory();
+		return NULL;
+	}
+	memcpy(key, dir, dir_len);
+	key[dir_len] = '/';
+	memcpy(key + dir_len + 1, file, file_len + 1);
+
+	*hash = get_image_cache_hash(key);
+
+	return key;
+}
+
+/* キーのハッシュ値を求める (FNV-1a) */
+static uint32_t get_image_cache_hash(const char *key)
+{
+	uint32_t h;
+
+	h = 2166136261U;
+	while (*key != '\0') {
+		h ^= (unsigned char)*key++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/* キャッシュを検索する */
+static struct image_cache *find_image_cache(const char *key, uint32_t hash)
+{
+	struct image_cache *ic;
+
+	for (ic = image_cache_bucket[hash % IMAGE_CACHE_BUCKETS]; ic != NULL;
+	     ic = ic->hash_next) {
+		if (ic->hash == hash && strcmp(ic->key, key) == 0)
+			return ic;
+	}
+	return NULL;
+}
+
+/*
+ * ヒットしたエントリのイメージの参照を取得する
+ *  - メインスレッドからキャッシュのロック中に呼び出す
+ */
+static struct image *take_image_cache(struct image_cache *ic)
+{
+	/* 先読みスレッドでデコードされた場合はテクスチャを作成する */
+	if (ic->need_upload) {
+		upload_image(ic->img);
+		ic->need_upload = false;
+	}
+	ic->is_prefetched = false;
+
+	/* LRUリストの先頭に移動する */
+	unlink_image_cache_lru(ic);
+	link_image_cache_lru(ic);
+	image_cache_hit++;
+
+	return ref_image(ic->img);
+}
+
+/*
+ * キャッシュに追加する
+ *  - キャッシュのロック中に呼び出す
+ *  - 先読みの場合は先読み済みで未使用のエントリを追い出さず、容量を超える
+ *    場合は追加せずにfalseを返す
+ */
+static bool insert_image_cache(char *key, uint32_t hash, struct image *img,
+			       bool is_prefetched)
+{
+	struct image_cache *ic, *prev;
+	size_t bytes, limit;
+	int bucket;
+
+	bytes = get_image_cache_bytes(img);
+	limit = get_image_cache_limit();
+
+	/* 容量を超える分を使われていない古いものから追い出す */
+	ic = image_cache_lru_tail;
+	while (ic != NULL && image_cache_bytes + bytes > limit) {
+		prev = ic->lru_prev;
+		if (get_image_ref_count(ic->img) == 1 &&
+		    !(is_prefetched && ic->is_prefetched)) {
+			unlink_image_cache(ic);
+			if (is_prefetched)
+				defer_free_image_cache(ic);
+			else
+				free_image_cache(ic);
+			image_cache_evict++;
+		}
+		ic = prev;
+	}
+
+	ic = malloc(sizeof(struct image_cache));
+	if (ic == NULL) {
+		log_memory();
+		free(key);
+		return false;
+	}
+	ic->key = key;
+	ic->hash = hash;
+	ic->img = ref_image(img);
+	ic->bytes = bytes;
+	ic->is_prefetched = is_prefetched;
+	ic->need_upload = is_prefetched;
+
+	/* 容量を超える場合はキャッシュしない */
+	if (image_cache_bytes + bytes > limit) {
+		if (is_prefetched)
+			defer_free_image_cache(ic);
+		else
+			free_image_cache(ic);
+		return false;
+	}
+
+	/* キャッシュだけが参照している間はキャッシュのものとして数える */
+	set_image_cached(img, true);
+
+	/* ハッシュ表とLRUリストに追加する */
+	bucket = (int)(hash % IMAGE_CACHE_BUCKETS);
+	ic->hash_next = image_cache_bucket[bucket];
+	image_cache_bucket[bucket] = ic;
+	link_image_cache_lru(ic);
+	image_cache_bytes += bytes;
+	return true;
+}
+
+/* キャッシュで数えるピクセル列のサイズを取得する */
+static size_t get_image_cache_bytes(struct image *img)
+{
+	size_t bytes;
+
+	bytes = (size_t)get_image_width(img) * (size_t)get_image_height(img);
+	if (is_image_rgb565(img))
+		return bytes * sizeof(uint16_t);
+	return bytes * sizeof(pixel_t);
+}
+
+/* キャッシュの容量を取得する */
+static size_t get_image_cache_limit(void)
+{
+	if (conf_image_cache_size > 0)
+		return (size_t)conf_image_cache_size * 1024;
+	return IMAGE_CACHE_DEFAULT_LIMIT;
+}
+
+/* キャッシュのエントリをLRUリストの先頭に追加する */
+static void link_image_cache_lru(struct image_cache *ic)
+{
+	ic->lru_prev = NULL;
+	ic->lru_next = image_cache_lru_head;
+	if (image_cache_lru_head != NULL)
+		image_cache_lru_head->lru_prev = ic;
+	else
+		image_cache_lru_tail = ic;
+	image_cache_lru_head = ic;
+}
+
+/* キャッシュのエントリをLRUリストから外す */
+static void unlink_image_cache_lru(struct image_cache *ic)
+{
+	if (ic->lru_prev != NULL)
+		ic->lru_prev->lru_next = ic->lru_next;
+	else
+		image_cache_lru_head = ic->lru_next;
+	if (ic->lru_next != NULL)
+		ic->lru_next->lru_prev = ic->lru_prev;
+	else
+		image_cache_lru_tail = ic->lru_prev;
+}
+
+/* キャッシュのエントリをハッシュ表とLRUリストから外す */
+static void unlink_image_cache(struct image_cache *ic)
+{
+	struct image_cache **pp;
+
+	/* ハッシュ表から外す */
+	for (pp = &image_cache_bucket[ic->hash % IMAGE_CACHE_BUCKETS];
+	     *pp != ic; pp = &(*pp)->hash_next)
+		;
+	*pp = ic->hash_next;
+
+	/* LRUリストから外す */
+	unlink_image_cache_lru(ic);
+
+	image_cache_bytes -= ic->bytes;
+	set_image_cached(ic->img, false);
+}
+
+/* キャッシュのエントリを削除する(メインスレッド用) */
+static void remove_image_cache(struct image_cache *ic)
+{
+	unlink_image_cache(ic);
+	free_image_cache(ic);
+}
+
+/* 外したエントリを解放する(イメージの参照を手放す) */
+static void free_image_cache(struct image_cache *ic)
+{
+	destroy_image(ic->img);
+	free(ic->key);
+	free(ic);
+}
+
+/*
+ * 外したエントリの解放をメインスレッドに任せる(先読みスレッド用)
+ *  - テクスチャの破棄はメインスレッドで行う必要があるため
+ */
+static void defer_free_image_cache(struct image_cache *ic)
+{
+#ifdef PREFETCH_THREAD
+	ic->hash_next = image_cache_garbage;
+	image_cache_garbage = ic;
+#else
+	free_image_cache(ic);
+#endif
+}
+
+/* 解放を任されたエントリを解放する(メインスレッド用) */
+static void free_image_cache_garbage(void)
+{
+#ifdef PREFETCH_THREAD
+	struct image_cache *ic;
+
+	while (image_cache_garbage != NULL) {
+		ic = image_cache_garbage;
+		image_cache_garbage = ic->hash_next;
+		free_image_cache(ic);
+	}
+#endif
+}
+
+/*
+ * キー("dir/file")のファイルをデコードする
+ *  - キーは他のスレッドから参照されるので、書き換えずにディレクトリ名を
+ *    複製する
+ */
+static struct image *decode_image_key(const char *key)
+{
+	struct image *img;
+	const char *file;
+	char *dir;
+	size_t dir_len;
+
+	file = strchr(key, '/');
+	assert(file != NULL);
+	dir_len = (size_t)(file - key);
+	dir = malloc(dir_len + 1);
+	if (dir == NULL) {
+		log_memory();
+		return NULL;
+	}
+	memcpy(dir, key, dir_len);
+	dir[dir_len] = '\0';
+	img = decode_image_file(dir, file + 1);
+	free(dir);
+	return img;
+}
+
+/* 先読みスレッドがデコード中であるか(キャッシュのロック中に呼び出す) */
+static bool is_prefetch_decoding(const char *key)
+{
+#ifdef PREFETCH_THREAD
+	return prefetch_decoding_key != NULL &&
+		strcmp(prefetch_decoding_key, key) == 0;
+#else
+	UNUSED_PARAMETER(key);
+	return false;
+#endif
+}
+
+/*
+ * 先読みでデコードに失敗したファイルの記録を検索する
+ *  - キャッシュのロック中に呼び出す
+ *  - keyがNULLの場合は先頭の記録を返す
+ */
+static struct image_cache **find_prefetch_failure(const char *key,
+						   uint32_t hash)
+{
+	struct image_cache **pp;
+
+	for (pp = &image_cache_failed; *pp != NULL; pp = &(*pp)->hash_next) {
+		if (key == NULL)
+			return pp;
+		if ((*pp)->hash == hash && strcmp((*pp)->key, key) == 0)
+			return pp;
+	}
+	return NULL;
+}
+
+/*
+ * 先読みでデコードに失敗したファイルの記録を取り除く
+ *  - is_reportedにはエラーを出力済みかを返す(NULLでもよい)
+ */
+static bool take_prefetch_failure(const char *key, uint32_t hash,
+				  bool *is_reported)
+{
+	struct image_cache **pp, *ic;
+
+	pp = find_prefetch_failure(key, hash);
+	if (pp == NULL)
+		return false;
+
+	ic = *pp;
+	*pp = ic->hash_next;
+	if (is_reported != NULL)
+		*is_reported = ic->is_reported;
+	free(ic->key);
+	free(ic);
+	return true;
+}
+
+/* イメージの先読みを中止してスレッドを回収する */
+static void stop_prefetch(void)
+{
+#ifdef PREFETCH_THREAD
+	if (!is_prefetch_running)
+		return;
+
+	/* キューを空にしてスレッドの終了を待つ */
+	lock_image_cache();
+	free_prefetch_queue();
+	unlock_image_cache();
+#ifdef WIN
+	WaitForSingleObject(prefetch_handle, INFINITE);
+	CloseHandle(prefetch_handle);
+#else
+	pthread_join(prefetch_tid, NULL);
+#endif
+	is_prefetch_running = false;
+#endif
+}
+
+#ifdef PREFETCH_THREAD
+/* 先読みスレッド */
+#ifdef WIN
+static DWORD WINAPI prefetch_thread(LPVOID param)
+#else
+static void *prefetch_thread(void *param)
+#endif
+{
+	UNUSED_PARAMETER(param);
+
+	/* エラーはメインスレッドで要求されたときに出力する */
+	discard_worker_log(true);
+	run_prefetch();
+	discard_worker_log(false);
+
+#ifdef WIN
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+/*
+ * 先読みスレッドの本体
+ *  - キューの先頭から順にデコードしてキャッシュに格納する
+ *  - デコードはメインスレッドと並行して行い、デコード中のファイルを
+ *    メインスレッドが要求した場合はデコード待ちのロックで待たせる
+ *  - テクスチャはメインスレッドでヒットしたときに作成する
+ */
+static void run_prefetch(void)
+{
+	struct image *img;
+	char *key;
+	uint32_t hash;
+	bool found;
+
+	while (1) {
+		/* キューから取り出す */
+		lock_image_cache();
+		if (prefetch_queue == NULL || prefetch_pos >= prefetch_count) {
+			is_prefetch_finished = true;
+			unlock_image_cache();
+			break;
+		}
+		key = prefetch_queue[prefetch_pos];
+		prefetch_queue[prefetch_pos] = NULL;
+		prefetch_pos++;
+		unlock_image_cache();
+
+		/*
+		 * キャッシュ済みか失敗済みであればスキップし、そうでなければ
+		 * デコード中のファイルとして公開する
+		 */
+		hash = get_image_cache_hash(key);
+		lock_image_decode();
+		lock_image_cache();
+		found = find_image_cache(key, hash) != NULL ||
+			find_prefetch_failure(key, hash) != NULL;
+		if (!found)
+			prefetch_decoding_key = key;
+		unlock_image_cache();
+		if (found) {
+			unlock_image_decode();
+			free(key);
+			continue;
+		}
+
+		/* デコードする */
+		img = decode_image_key(key);
+
+		/*
+		 * キャッシュに追加して、キャッシュの参照だけを残す
+		 *  - 容量を超える場合はキューを空にする
+		 *  - デコード中にメインスレッドが追加していた場合は捨てる
+		 */
+		lock_image_cache();
+		prefetch_decoding_key = NULL;
+		if (img == NULL) {
+			add_prefetch_failure(key, hash, false);
+		} else if (find_image_cache(key, hash) != NULL) {
+			destroy_image(img);
+			free(key);
+		} else {
+			if (!insert_image_cache(key, hash, img, true))
+				free_prefetch_queue();
+			destroy_image(img);
+		}
+		unlock_image_cache();
+		unlock_image_decode();
+	}
+}
+
+/* 先読みのデコードの失敗を記録する(キャッシュのロック中に呼び出す) */
+static void add_prefetch_failure(char *key, uint32_t hash, bool is_reported)
+{
+	struct image_cache *ic;
+
+	ic = malloc(sizeof(struct image_cache));
+	if (ic == NULL) {
+		free(key);
+		return;
+	}
+	memset(ic, 0, sizeof(struct image_cache));
+	ic->key = key;
+	ic->hash = hash;
+	ic->is_reported = is_reported;
+	ic->hash_next = image_cache_failed;
+	image_cache_failed = ic;
+}
+
+/*
+ * 先読み済みで未使用のエントリを追い出しの対象に戻す
+ *  - キャッシュのロック中に呼び出す
+ *  - 古いキューで先読みしたものが新しい先読みで追い出されずに残り続けない
+ *    ようにする
+ */
+static void expire_prefetched_images(void)
+{
+	struct image_cache *ic;
+
+	for (ic = image_cache_lru_head; ic != NULL; ic = ic->lru_next)
+		ic->is_prefetched = false;
+}
+
+/* 一括読み込みのスレッド */
+#ifdef WIN
+static DWORD WINAPI preload_thread(LPVOID param)
+#else
+static void *preload_thread(void *param)
+#endif
+{
+	run_preload(param);
+
+#ifdef WIN
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+/* 一括読み込みのスレッドの担当分をデコードする */
+static void run_preload(struct preload_task *task)
+{
+	int i;
+
+	for (i = task->index; i < task->count; i += task->stride)
+		task->img[i] = decode_image_key(task->key[i]);
+}
+
+/* 一括読み込みに使うスレッドの数を求める */
+static int get_preload_thread_count(int count)
+{
+	int cpus;
+
+#ifdef WIN
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	cpus = (int)si.dwNumberOfProcessors;
+#else
+	cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (cpus > PRELOAD_THREAD_MAX)
+		cpus = PRELOAD_THREAD_MAX;
+	if (cpus > count)
+		cpus = count;
+	if (cpus < 1)
+		cpus = 1;
+	return cpus;
+}
+
+/* 先読みのキューを解放する(キャッシュのロック中に呼び出す) */
+static void free_prefetch_queue(void)
+{
+	int i;
+
+	if (prefetch_queue == NULL)
+		return;
+	for (i = prefetch_pos; i < prefetch_count; i++)
+		free(prefetch_queue[i]);
+	free(prefetch_queue);
+	prefetch_queue = NULL;
+	prefetch_count = 0;
+	prefetch_pos = 0;
+}
+#endif
+
+/* キャッシュをロックする */
+static void lock_image_cache(void)
+{
+#ifdef PREFETCH_THREAD
+	if (!is_prefetch_running)
+		return;
+#ifdef WIN
+	EnterCriticalSection(&image_cache_lock);
+#else
+	pthread_mutex_lock(&image_cache_lock);
+#endif
+#endif
+}
+
+/* キャッシュをアンロックする */
+static void unlock_image_cache(void)
+{
+#ifdef PREFETCH_THREAD
+	if (!is_prefetch_running)
+		return;
+#ifdef WIN
+	LeaveCriticalSection(&image_cache_lock);
+#else
+	pthread_mutex_unlock(&image_cache_lock);
+#endif
+#endif
+}
+
+/* デコーダをロックする */
+static void lock_image_decode(void)
+{
+#ifdef PREFETCH_THREAD
+	if (!is_prefetch_running)
+		return;
+#ifdef WIN
+	EnterCriticalSection(&image_decode_lock);
+#else
+	pthread_mutex_lock(&image_decode_lock);
+#endif
+#endif
+}
+
+/* デコーダをアンロックする */
+static void unlock_image_decode(void)
+{
+#ifdef PREFETCH_THREAD
+	if (!is_prefetch_running)
+		return;
+#ifdef WIN
+	LeaveCriticalSection(&image_decode_lock);
+#else
+	pthread_mutex_unlock(&image_decode_lock);
+#endif
+#endif
+}
+#endif
+
+/*
+ * テクスチャを作成する
+ *  - デコーダはピクセル列に直接書き込むので、メインスレッドでロックと
+ *    アンロックを行ってテクスチャに反映する
+ *  - ピクセル列は変更しないので、デコード時に判定したアルファ値の種類を
+ *    ロックの後で戻す
+ */
+static void upload_image(struct image *img)
+{
+	int alpha_type;
+
+	alpha_type = get_image_alpha_type(img);
+	lock_image(img);
+	unlock_image(img);
+	set_image_alpha_type(img, alpha_type);
+}
+
+/*
+ * イメージファイルをデコードする
+ *  - ワーカスレッドから呼び出してもよい
+ */
+static struct image *decode_image_file(const char *dir, const char *file)
+{
+	struct png_reader r;
+
 	/* JPEGファイルの場合は別なルーチンを使う */
 	if (is_jpg_ext(file))
-		return create_image_from_file_jpeg(dir, file);
+		return create_image_from_file_jpeg(dir, file, 1);
 
 	/* ファイルを読み込む */
-	if (!read_image_file(dir, file)) {
+	memset(&r, 0, sizeof(r));
+	if (!read_image_file(&r, dir, file)) {
 		/* 失敗した場合、イメージを破棄する */
-		if (image != NULL) {
-			destroy_image(image);
-			image = NULL;
+		if (r.image != NULL) {
+			destroy_image(r.image);
+			r.image = NULL;
 		}
 	}
 
 	/* イメージを返す */
-	return cleanup();
+	return cleanup(&r);
 }
 
 /* 拡張子がJPGであるかチェックする */
@@ -71,76 +1310,89 @@ static bool is_jpg_ext(const char *str)
 	return false;
 }
 
-/* ローカル変数をクリアする */
-static struct image *cleanup(void)
+/* コンテキストをクリアする */
+static struct image *cleanup(struct png_reader *r)
 {
 	struct image *result;
 
 	result = NULL;
-	if (rf != NULL) {
-		close_rfile(rf);
-		rf = NULL;
+	if (r->rf != NULL) {
+		close_rfile(r->rf);
+		r->rf = NULL;
 	}
-	if (rows != NULL) {
-		free(rows);
-		rows = NULL;
+	if (r->rows != NULL) {
+		free(r->rows);
+		r->rows = NULL;
 	}
-	if (png_ptr != NULL) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-		png_ptr = NULL;
-		info_ptr = NULL;
+	if (r->png_ptr != NULL) {
+		png_destroy_read_struct(&r->png_ptr, &r->info_ptr, NULL);
+		r->png_ptr = NULL;
+		r->info_ptr = NULL;
 	}
-	if (image != NULL) {
-		result = image;
-		image = NULL;
+	if (r->image != NULL) {
+		result = r->image;
+		r->image = NULL;
 	}
 	return result;
 }
 
 /* イメージファイルを読み込む */
-static bool read_image_file(const char *dir, const char *file)
+static bool read_image_file(struct png_reader *r, const char *dir,
+			    const char *file)
 {
-	rf = open_rfile(dir, file, false);
-	if (rf == NULL)
+	bool is_raw;
+
+	r->rf = open_rfile(dir, file, false);
+	if (r->rf == NULL)
 		return false;
 
-	if (!check_signature()) {
+	if (!check_signature(r, &is_raw)) {
 		log_image_file_error(dir, file);
 		return false;
 	}
 
-	if (!read_header()) {
+	/* 生ピクセル形式の場合はデコードせずに読み込む */
+	if (is_raw) {
+		if (!read_raw_image(r)) {
+			log_image_file_error(dir, file);
+			return false;
+		}
+		return true;
+	}
+
+	if (!read_header(r)) {
 		log_image_file_error(dir, file);
 		return false;
 	}
 
-	image = create_image(width, height);
-	if (image == NULL)
+	r->image = create_image(r->width, r->height);
+	if (r->image == NULL)
 		return false;
 
-	lock_image(image);
-
-	if (!read_body()) {
+	/* ピクセル列に直接デコードする(テクスチャは呼び出し元で作成する) */
+	if (!read_body(r)) {
 		log_image_file_error(dir, file);
-		unlock_image(image);
 		return false;
 	}
 
-	unlock_image(image);
-
 	return true;
 }
 
 /* シグネチャをチェックする */
-static bool check_signature(void)
+static bool check_signature(struct png_reader *r, bool *is_raw)
 {
 	png_byte buf[8];
 	size_t len;
 
-	len = read_rfile(rf, buf, 8);
+	len = read_rfile(r->rf, buf, 8);
 	if (len == 0)
 		return false;
 
+	/* 生ピクセル形式であるか */
+	*is_raw = len == 8 && memcmp(buf, RAW_IMAGE_MAGIC, 8) == 0;
+	if (*is_raw)
+		return true;
+
 	if (png_sig_cmp(buf, 0, len))
 		return false;
 
@@ -148,36 +1400,44 @@ static bool check_signature(void)
 }
 
 /* ヘッダを読み込む */
-static bool read_header(void)
+static bool read_header(struct png_reader *r)
 {
+	png_structp png_ptr;
+	png_infop info_ptr;
 	png_byte color_type, bit_depth;
 
-	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
-					 NULL);
-	if (png_ptr == NULL)
+	r->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+					    NULL);
+	if (r->png_ptr == NULL)
 		return false;
+	png_ptr = r->png_ptr;
 
-	info_ptr = png_create_info_struct(png_ptr);
-	if (info_ptr == NULL) {
-		png_destroy_read_struct(&png_ptr, NULL, NULL);
+	r->info_ptr = png_create_info_struct(png_ptr);
+	if (r->info_ptr == NULL) {
+		png_destroy_read_struct(&r->png_ptr, NULL, NULL);
 		return false;
 	}
+	info_ptr = r->info_ptr;
 
 	if (setjmp(png_jmpbuf(png_ptr))) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		png_destroy_read_struct(&r->png_ptr, &r->info_ptr, NULL);
 		return false;
 	}
 
-	png_set_read_fn(png_ptr, rf, read_callback);
+	png_set_read_fn(png_ptr, r->rf, read_callback);
 	png_set_sig_bytes(png_ptr, 8);
 	png_read_info(png_ptr, info_ptr);
 
 	/* サイズ、カラータイプ、ビット幅を取得する */
-	width = (int)png_get_image_width(png_ptr, info_ptr);
-	height = (int)png_get_image_height(png_ptr, info_ptr);
+	r->width = (int)png_get_image_width(png_ptr, info_ptr);
+	r->height = (int)png_get_image_height(png_ptr, info_ptr);
 	color_type = png_get_color_type(png_ptr, info_ptr);
 	bit_depth = png_get_bit_depth(png_ptr, info_ptr);
 
+	/* アルファチャンネルも透過色もなければ走査せずに不透明とする */
+	r->has_alpha = (color_type & PNG_COLOR_MASK_ALPHA) != 0 ||
+		png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS) != 0;
+
 	/* パレットの場合はRGBに変換する */
 	switch(color_type) {
 	case PNG_COLOR_TYPE_GRAY:
@@ -239,30 +1499,110 @@ static void read_callback(png_structp png_ptr, png_bytep buf, png_size_t len)
 }
 
 /* イメージ本体を読み込む */
-static bool read_body(void)
+static bool read_body(struct png_reader *r)
 {
 	int y;
 	pixel_t *pixels;
 	
-	if (setjmp(png_jmpbuf(png_ptr))) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	if (setjmp(png_jmpbuf(r->png_ptr))) {
+		png_destroy_read_struct(&r->png_ptr, &r->info_ptr, NULL);
 		return false;
 	}
 
-	rows = malloc(sizeof(png_bytep) * (size_t)height);
-	if (rows == NULL)
+	r->rows = malloc(sizeof(png_bytep) * (size_t)r->height);
+	if (r->rows == NULL)
 		return false;
 
-	assert(png_get_rowbytes(png_ptr, info_ptr) == (size_t)(width*4));
+	assert(png_get_rowbytes(r->png_ptr, r->info_ptr) ==
+	       (size_t)(r->width * 4));
 
 #ifdef _MSC_VER
 #pragma warning(disable:6386)
 #endif
-	pixels = get_image_pixels(image);
-	for (y = 0; y < height; y++)
-		rows[y] = (png_bytep)&pixels[width * y];
+	pixels = get_image_pixels(r->image);
+	for (y = 0; y < r->height; y++)
+		r->rows[y] = (png_bytep)&pixels[r->width * y];
+
+	/* アルファ値がない場合 */
+	if (!r->has_alpha) {
+		png_read_image(r->png_ptr, r->rows);
+		set_image_alpha_type(r->image, IMAGE_ALPHA_OPAQUE);
+		return true;
+	}
+
+	/*
+	 * アルファ値の種類を判定する
+	 *  - インタレースでなければ1行デコードするごとにキャッシュに載っている
+	 *    うちに判定する
+	 */
+	r->alpha_type = IMAGE_ALPHA_OPAQUE;
+	if (png_get_interlace_type(r->png_ptr, r->info_ptr) ==
+	    PNG_INTERLACE_NONE) {
+		for (y = 0; y < r->height; y++) {
+			png_read_row(r->png_ptr, r->rows[y], NULL);
+			r->alpha_type = scan_image_alpha_type(
+				(pixel_t *)r->rows[y], (size_t)r->width,
+				r->alpha_type);
+		}
+	} else {
+		png_read_image(r->png_ptr, r->rows);
+		r->alpha_type = scan_image_alpha_type(
+			pixels, (size_t)r->width * (size_t)r->height,
+			r->alpha_type);
+	}
+	set_image_alpha_type(r->image, r->alpha_type);
+
+	return true;
+}
+
+/*
+ * 生ピクセル形式のイメージを読み込む
+ *  - ピクセル列をイメージに直接読み込む
+ */
+static bool read_raw_image(struct png_reader *r)
+{
+	uint32_t header[(RAW_IMAGE_HEADER_SIZE - 8) / sizeof(uint32_t)];
+	pixel_t *pixels, p;
+	size_t size, i;
+	uint32_t order;
+
+	/* マジックより後のヘッダを読み込む */
+	if (read_rfile(r->rf, header, sizeof(header)) < sizeof(header))
+		return false;
+	r->width = (int)header[0];
+	r->height = (int)header[1];
+	order = header[2];
+	if (r->width <= 0 || r->height <= 0 ||
+	    (order != RAW_IMAGE_ARGB && order != RAW_IMAGE_ABGR))
+		return false;
+
+	r->image = create_image(r->width, r->height);
+	if (r->image == NULL)
+		return false;
+
+	/* ピクセル列を読み込む */
+	pixels = get_image_pixels(r->image);
+	size = (size_t)r->width * (size_t)r->height;
+	if (read_rfile(r->rf, pixels, size * sizeof(pixel_t)) <
+	    size * sizeof(pixel_t))
+		return false;
+
+	/* 実行時のピクセル形式と異なる場合はRとBを入れ替える */
+	if ((order == RAW_IMAGE_ABGR) !=
+	    (make_pixel_slow(0, 0xff, 0, 0) == 0xff)) {
+		for (i = 0; i < size; i++) {
+			p = pixels[i];
+			pixels[i] = make_pixel_fast(get_pixel_a(p),
+						    get_pixel_c3(p),
+						    get_pixel_c2(p),
+						    get_pixel_c1(p));
+		}
+	}
 
-	png_read_image(png_ptr, rows);
+	/* アルファ値の種類を判定する */
+	set_image_alpha_type(r->image,
+			     scan_image_alpha_type(pixels, size,
+						   IMAGE_ALPHA_OPAQUE));
 
 	return true;
 }
@@ -7,107 +7,281 @@
 
 #include "suika.h"
 
+#include <setjmp.h>
 #include <jpeglib.h>
+#include <jerror.h>
+
+/* ファイルから一度に読み込むサイズ */
+#define INPUT_BUF_SIZE		(4096)
+
+/* 一度にデコードする行数の最大値 */
+#define ROWS_PER_BATCH		(16)
 
 /*
- * イメージをJPEGファイルから読み込む
+ * JPEGデコーダのコンテキスト
+ *  - デコードごとにスタック上に確保し、複数のスレッドから同時に使える
+ *  - libjpegのエラーはexit()せずにlongjmp()で戻るので、setjmp()の後で
+ *    変更する変数はここに置く
  */
-struct image *create_image_from_file_jpeg(const char *dir, const char *file)
-{
+struct jpeg_reader {
 	struct jpeg_decompress_struct jpeg;
 	struct jpeg_error_mgr jerr;
+	struct jpeg_source_mgr src;
+	jmp_buf env;
+	bool is_created;
 	struct rfile *rf;
-	struct image *img;
-	pixel_t *p;
-	unsigned char *raw_data;
+	JOCTET buf[INPUT_BUF_SIZE];
 	unsigned char *line;
-	size_t file_size;
-	unsigned int width, height, x, y;
-	int components;
+	struct image *img;
+};
 
-	/* ファイルを開く */
-	rf = open_rfile(dir, file, false);
-	if (rf == NULL)
-		return NULL;
+/*
+ * 前方参照
+ */
+static struct image *decode_jpeg(struct jpeg_reader *r, const char *dir,
+				 const char *file, int scale_denom);
+static bool get_direct_color_space(J_COLOR_SPACE *cs);
+static void read_rows_direct(struct jpeg_reader *r);
+static void read_rows_convert(struct jpeg_reader *r);
+static void init_source(j_decompress_ptr cinfo);
+static boolean fill_input_buffer(j_decompress_ptr cinfo);
+static void skip_input_data(j_decompress_ptr cinfo, long num_bytes);
+static void term_source(j_decompress_ptr cinfo);
+static void error_exit(j_common_ptr cinfo);
+static void cleanup(struct jpeg_reader *r);
 
-	/* ファイルのサイズを取得する */
-	file_size = get_rfile_size(rf);
+/*
+ * イメージをJPEGファイルから読み込む
+ *  - ワーカスレッドから呼び出してもよい
+ *  - scale_denomに2, 4, 8を指定するとDCTの段階で縮小してデコードする
+ */
+struct image *create_image_from_file_jpeg(const char *dir, const char *file,
+					  int scale_denom)
+{
+	struct jpeg_reader r;
+	struct image *img;
 
-	/* ファイル全体を読み込むメモリを確保する */
-	raw_data = malloc(file_size);
-	if (raw_data == NULL) {
-		log_memory();
-		close_rfile(rf);
+	memset(&r, 0, sizeof(r));
+	img = decode_jpeg(&r, dir, file, scale_denom);
+	cleanup(&r);
+
+	return img;
+}
+
+/* デコードする */
+static struct image *decode_jpeg(struct jpeg_reader *r, const char *dir,
+				 const char *file, int scale_denom)
+{
+	J_COLOR_SPACE cs;
+	bool is_direct;
+
+	/* ファイルを開く */
+	r->rf = open_rfile(dir, file, false);
+	if (r->rf == NULL)
 		return NULL;
-	}
 
-	/* ファイル全体を読み込む */
-	if (read_rfile(rf, raw_data, file_size) < file_size) {
+	/* デコード中のエラーはここに戻る */
+	r->jpeg.err = jpeg_std_error(&r->jerr);
+	r->jerr.error_exit = error_exit;
+	if (setjmp(r->env)) {
 		log_image_file_error(dir, file);
-		free(raw_data);
-		close_rfile(rf);
+		if (r->img != NULL) {
+			destroy_image(r->img);
+			r->img = NULL;
+		}
 		return NULL;
 	}
-	close_rfile(rf);
-
-	/* デコードを開始する */
-	jpeg_create_decompress(&jpeg);
-	jpeg_mem_src(&jpeg, raw_data, file_size);
-	jpeg.err = jpeg_std_error(&jerr);
-	jpeg_read_header(&jpeg, TRUE);
-	jpeg_start_decompress(&jpeg);
-
-	/* 画像サイズとチャネル数を取得する */
-	width = jpeg.output_width;
-	height = jpeg.output_height;
-	components = jpeg.out_color_components;
-	if (components != 3) {
-		log_image_file_error(dir, file);
-		free(raw_data);
-		jpeg_destroy_decompress(&jpeg);
-		return NULL;
+
+	/* ファイルを少しずつ読み込みながらデコードする */
+	jpeg_create_decompress(&r->jpeg);
+	r->is_created = true;
+	r->src.init_source = init_source;
+	r->src.fill_input_buffer = fill_input_buffer;
+	r->src.skip_input_data = skip_input_data;
+	r->src.resync_to_restart = jpeg_resync_to_restart;
+	r->src.term_source = term_source;
+	r->jpeg.src = &r->src;
+	jpeg_read_header(&r->jpeg, TRUE);
+
+	/* 縮小する場合 */
+	if (scale_denom > 1) {
+		r->jpeg.scale_num = 1;
+		r->jpeg.scale_denom = (unsigned int)scale_denom;
 	}
 
-	/* デコード結果のピクセル列を1行格納するメモリを確保する */
-	line = malloc(width * height * 3);
-	if (line == NULL) {
-		log_memory();
-		free(raw_data);
-		jpeg_destroy_decompress(&jpeg);
+	/* ピクセルのバイト順で直接出力できる場合は変換を省く */
+	is_direct = r->jpeg.jpeg_color_space != JCS_GRAYSCALE &&
+		get_direct_color_space(&cs);
+	if (is_direct)
+		r->jpeg.out_color_space = cs;
+	else
+		r->jpeg.out_color_space = JCS_RGB;
+	jpeg_start_decompress(&r->jpeg);
+	if (!is_direct && r->jpeg.out_color_components != 3) {
+		log_image_file_error(dir, file);
 		return NULL;
 	}
 
 	/* 画像を作成する */
-	img = create_image((int)width, (int)height);
-	if (img == NULL) {
+	r->img = create_image((int)r->jpeg.output_width,
+			      (int)r->jpeg.output_height);
+	if (r->img == NULL) {
 		log_memory();
-		free(line);
-		free(raw_data);
-		jpeg_destroy_decompress(&jpeg);
 		return NULL;
 	}
 
-	/* 行ごとにデコードする */
-	lock_image(img);
-	p = get_image_pixels(img);
-	for (y = 0; y < height; y++) {
+	/* 行ごとにデコードする(テクスチャは呼び出し元で作成する) */
+	if (is_direct) {
+		read_rows_direct(r);
+	} else {
+		/* デコード結果のピクセル列を1行格納するメモリを確保する */
+		r->line = malloc(r->jpeg.output_width * 3);
+		if (r->line == NULL) {
+			log_memory();
+			destroy_image(r->img);
+			r->img = NULL;
+			return NULL;
+		}
+		read_rows_convert(r);
+	}
+	jpeg_finish_decompress(&r->jpeg);
+
+	/* JPEGにはアルファ値がない */
+	set_image_alpha_type(r->img, IMAGE_ALPHA_OPAQUE);
+
+	return r->img;
+}
+
+/*
+ * ピクセル列のバイト順に一致するlibjpegの出力形式を求める
+ *  - RGBX/BGRXでは4バイト目が埋められる保証がないので、アルファ値に255が
+ *    入ることが保証されるRGBA/BGRAを用いる
+ */
+static bool get_direct_color_space(J_COLOR_SPACE *cs)
+{
+#ifdef JCS_ALPHA_EXTENSIONS
+	pixel_t p;
+	unsigned char *b;
+
+	/* 赤=1, 緑=2, 青=3, アルファ=4のピクセルのバイト順を調べる */
+	p = make_pixel_slow(4, 1, 2, 3);
+	b = (unsigned char *)&p;
+	if (b[0] == 1 && b[1] == 2 && b[2] == 3 && b[3] == 4) {
+		*cs = JCS_EXT_RGBA;
+		return true;
+	}
+	if (b[0] == 3 && b[1] == 2 && b[2] == 1 && b[3] == 4) {
+		*cs = JCS_EXT_BGRA;
+		return true;
+	}
+#else
+	UNUSED_PARAMETER(cs);
+#endif
+	return false;
+}
+
+/* イメージのピクセル列に直接デコードする */
+static void read_rows_direct(struct jpeg_reader *r)
+{
+	JSAMPROW rows[ROWS_PER_BATCH];
+	pixel_t *pixels;
+	JDIMENSION y, n, i, width;
+
+	pixels = get_image_pixels(r->img);
+	width = r->jpeg.output_width;
+	while (r->jpeg.output_scanline < r->jpeg.output_height) {
+		y = r->jpeg.output_scanline;
+		n = r->jpeg.output_height - y;
+		if (n > ROWS_PER_BATCH)
+			n = ROWS_PER_BATCH;
+		for (i = 0; i < n; i++)
+			rows[i] = (JSAMPROW)&pixels[(size_t)width * (y + i)];
+		jpeg_read_scanlines(&r->jpeg, rows, n);
+	}
+}
+
+/* 1行ずつRGBでデコードしてピクセル値に変換する */
+static void read_rows_convert(struct jpeg_reader *r)
+{
+	pixel_t *p;
+	JDIMENSION x, width;
+
+	p = get_image_pixels(r->img);
+	width = r->jpeg.output_width;
+	while (r->jpeg.output_scanline < r->jpeg.output_height) {
 		/* 1行デコードする */
-		jpeg_read_scanlines(&jpeg, &line, 1);
+		jpeg_read_scanlines(&r->jpeg, &r->line, 1);
 
 		/* イメージにコピーする */
 		for (x = 0; x < width; x++) {
 			*p++ = make_pixel_slow(255,
-					       line[x * 3],
-					       line[x * 3 + 1],
-					       line[x * 3 + 2]);
+					       r->line[x * 3],
+					       r->line[x * 3 + 1],
+					       r->line[x * 3 + 2]);
 		}
 	}
-	unlock_image(img);
+}
+
+/* 読み込みを開始する */
+static void init_source(j_decompress_ptr cinfo)
+{
+	UNUSED_PARAMETER(cinfo);
+}
+
+/* ファイルから次のデータを読み込む */
+static boolean fill_input_buffer(j_decompress_ptr cinfo)
+{
+	struct jpeg_reader *r;
+	size_t len;
+
+	r = (struct jpeg_reader *)cinfo;
+	len = read_rfile(r->rf, r->buf, INPUT_BUF_SIZE);
+	if (len == 0) {
+		/* 途中で終わっているファイルはエラーとする */
+		ERREXIT(cinfo, JERR_INPUT_EOF);
+	}
+	r->src.next_input_byte = r->buf;
+	r->src.bytes_in_buffer = len;
+	return TRUE;
+}
 
-	/* 終了処理を行う */
-	free(line);
-	free(raw_data);
-	jpeg_destroy_decompress(&jpeg);
+/* データを読み飛ばす */
+static void skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+	struct jpeg_reader *r;
 
-	return img;
+	r = (struct jpeg_reader *)cinfo;
+	if (num_bytes <= 0)
+		return;
+	while (num_bytes > (long)r->src.bytes_in_buffer) {
+		num_bytes -= (long)r->src.bytes_in_buffer;
+		fill_input_buffer(cinfo);
+	}
+	r->src.next_input_byte += (size_t)num_bytes;
+	r->src.bytes_in_buffer -= (size_t)num_bytes;
+}
+
+/* 読み込みを終了する */
+static void term_source(j_decompress_ptr cinfo)
+{
+	UNUSED_PARAMETER(cinfo);
+}
+
+/* libjpegのエラーでexit()せずにsetjmp()の位置へ戻る */
+static void error_exit(j_common_ptr cinfo)
+{
+	struct jpeg_reader *r;
+
+	r = (struct jpeg_reader *)cinfo;
+	longjmp(r->env, 1);
+}
+
+/* コンテキストをクリアする */
+static void cleanup(struct jpeg_reader *r)
+{
+	if (r->is_created)
+		jpeg_destroy_decompress(&r->jpeg);
+	if (r->rf != NULL)
+		close_rfile(r->rf);
+	free(r->line);
 }
@@ -17,6 +17,7 @@
  *  - 2021/07/29 クイックセーブ・ロードに対応
  *  - 2022/06/09 デバッガに対応
  *  - 2022/08/07 GUIに機能を移管
+ *  - 2026/10/19 ロード時に背景とキャラクタを並列にデコードする
  */
 
 #include "suika.h"
@@ -476,6 +477,7 @@ static bool serialize_thumb(struct wfile *wf, int index)
 						 conf_save_data_thumb_height);
 		if (save_thumb[index] == NULL)
 			return false;
+		set_image_category(save_thumb[index], IMAGE_CATEGORY_THUMB);
 	}
 	lock_image(save_thumb[index]);
 	draw_image(save_thumb[index], 0, 0, get_thumb_image(),
@@ -773,6 +775,9 @@ static bool deserialize_command(struct rfile *rf)
 	if (!load_script(s))
 		return false;
 
+	/* 既読フラグをロードする */
+	load_seen();
+
 	if (read_rfile(rf, &n, sizeof(n)) < sizeof(n))
 		return false;
 
@@ -791,56 +796,79 @@ static bool deserialize_command(struct rfile *rf)
 /* ステージのデシリアライズを行う */
 static bool deserialize_stage(struct rfile *rf)
 {
-	char s[1024];
+	char bg[1024];
+	char ch[CH_ALL_LAYERS][1024];
+	int m[CH_ALL_LAYERS], n[CH_ALL_LAYERS], o[CH_ALL_LAYERS];
+	const char *dir[CH_ALL_LAYERS + 1], *file[CH_ALL_LAYERS + 1];
 	struct image *img;
-	int m, n, o, i;
+	int i, count;
 
-	if (gets_rfile(rf, s, sizeof(s)) == NULL)
+	/* 背景とキャラクタのファイル名と位置を先に読み込む */
+	if (gets_rfile(rf, bg, sizeof(bg)) == NULL)
 		return false;
+	for (i = 0; i < CH_ALL_LAYERS; i++) {
+		if (read_rfile(rf, &m[i], sizeof(m[i])) < sizeof(m[i]))
+			return false;
+		if (read_rfile(rf, &n[i], sizeof(n[i])) < sizeof(n[i]))
+			return false;
+		if (read_rfile(rf, &o[i], sizeof(o[i])) < sizeof(o[i]))
+			return false;
+		if (gets_rfile(rf, ch[i], sizeof(ch[i])) == NULL)
+			return false;
+		assert(strcmp(ch[i], "") != 0);
+	}
 
-	if (strcmp(s, "none") == 0) {
+	/* 画像ファイルを並列にデコードしておく */
+	count = 0;
+	if (strcmp(bg, "none") != 0 && bg[0] != '#') {
+		dir[count] = BG_DIR;
+		file[count] = bg;
+		count++;
+	}
+	for (i = 0; i < CH_ALL_LAYERS; i++) {
+		if (strcmp(ch[i], "none") != 0) {
+			dir[count] = CH_DIR;
+			file[count] = ch[i];
+			count++;
+		}
+	}
+	preload_images(dir, file, count);
+
+	/* 背景を設定する */
+	if (strcmp(bg, "none") == 0) {
 		set_bg_file_name(NULL);
 		img = create_initial_bg();
 		if (img == NULL)
 			return false;;
-	} else if (s[0] == '#') {
-		set_bg_file_name(s);
+	} else if (bg[0] == '#') {
+		set_bg_file_name(bg);
 		img = create_image_from_color_string(conf_window_width,
 						     conf_window_height,
-						     &s[1]);
+						     &bg[1]);
 		if (img == NULL)
 			return false;
 	} else {
-		set_bg_file_name(s);
-		img = create_image_from_file(BG_DIR, s);
+		set_bg_file_name(bg);
+		img = create_image_from_file(BG_DIR, bg);
 		if (img == NULL)
 			return false;
 	}
 
 	change_bg_immediately(img);
 
+	/* キャラクタを設定する */
 	for (i = 0; i < CH_ALL_LAYERS; i++) {
-		if (read_rfile(rf, &m, sizeof(m)) < sizeof(n))
-			return false;
-		if (read_rfile(rf, &n, sizeof(n)) < sizeof(m))
-			return false;
-		if (read_rfile(rf, &o, sizeof(o)) < sizeof(o))
-			return false;
-		if (gets_rfile(rf, s, sizeof(s)) == NULL)
-			return false;
-
-		assert(strcmp(s, "") != 0);
-		if (strcmp(s, "none") == 0) {
+		if (strcmp(ch[i], "none") == 0) {
 			set_ch_file_name(i, NULL);
 			img = NULL;
 		} else {
-			set_ch_file_name(i, s);
-			img = create_image_from_file(CH_DIR, s);
+			set_ch_file_name(i, ch[i]);
+			img = create_image_from_file(CH_DIR, ch[i]);
 			if (img == NULL)
 				return false;
 		}
 
-		change_ch_immediately(i, img, m, n, o);
+		change_ch_immediately(i, img, m[i], n[i], o[i]);
 	}
 
 	return true;
@@ -971,6 +999,7 @@ static void load_basic_save_data_file(struct rfile *rf, int index)
 					 conf_save_data_thumb_height);
 	if (save_thumb[index] == NULL)
 		return;
+	set_image_category(save_thumb[index], IMAGE_CATEGORY_THUMB);
 	lock_image(save_thumb[index]);
 	dst = get_image_pixels(save_thumb[index]);
 	src = tmp_pixels;
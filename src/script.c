@@ -30,6 +30,13 @@
  *  - 2022/10/19 ローケルに対応
  *  - 2023/01/06 日本語コマンド名、パラメータ名指定、カギカッコに対応
  *  - 2023/01/14 スタートアップファイル/ラインに対応
+ *  - 2026/10/19 メッセージの文字のグリフの先読みに対応
+ *  - 2026/10/19 コンパイル済みスクリプトのキャッシュに対応
+ *  - 2026/10/19 コマンド配列を可変長にして文字列をプールに詰めた
+ *  - 2026/10/19 ラベルのハッシュ表に対応
+ *  - 2026/10/19 数値のパラメータをロード時に変換するようにした
+ *  - 2026/10/19 複数のスクリプトの常駐に対応
+ *  - 2026/10/19 この先で使うイメージの先読みに対応
  */
 
 #include "suika.h"
@@ -43,26 +50,141 @@
 
 /*
  * コマンド配列
+ *  - スクリプトの大きさに合わせて確保し、文字列は1つのプールに詰めて
+ *    オフセットで参照する
+ *  - キャッシュファイルにはこの形式のまま書き出し、ロード時はマップする
  */
 
 /* コマンドの引数の最大数(コマンド名も含める) */
 #define PARAM_SIZE	(137)
 
+/* 省略されたパラメータを表すオフセット */
+#define PARAM_NULL	(0xffffffff)
+
 /* コマンド配列 */
 static struct command {
+	int32_t type;
+	int32_t line;
+	uint32_t text;		/* 行の内容のオフセット */
+	uint32_t param_top;	/* パラメータ表の先頭のインデックス */
+	uint32_t param_count;	/* パラメータの数 */
+	char locale[4];
+} *cmd;
+
+/* コマンドの数と確保済みの数(キャッシュを参照している場合は0) */
+static int cmd_size;
+static int cmd_alloc;
+
+/* パラメータ表 */
+static struct param_slot {
+	uint32_t ofs;		/* 文字列プール内のオフセット */
+	int32_t value;		/* 数値のパラメータを変換した値 */
+} *param_slot;
+static uint32_t param_slot_size;
+static uint32_t param_slot_alloc;
+
+/* 文字列プール */
+static char *pool;
+static uint32_t pool_size;
+static uint32_t pool_alloc;
+
+/* パース中のコマンド(パースが終わったらコマンド配列に格納する) */
+static struct parsed_command {
 	int type;
 	int line;
 	char *text;
 	char *param[PARAM_SIZE];
 	char locale[3];
-} cmd[SCRIPT_CMD_SIZE];
+} parsed;
 
-/* コマンドの数 */
-static int cmd_size;
+/*
+ * コンパイル済みスクリプトのキャッシュ
+ *  - コマンド配列、パラメータ表、文字列プールをセーブディレクトリに
+ *    保存し、次回からはパースせずにマップして参照する
+ *  - ソースの内容のハッシュとサイズが一致する場合のみ用いる
+ *
+ * struct script_cache_header header;
+ * struct command cmd[header.cmd_count];
+ * struct param_slot param[header.param_count];
+ * char pool[header.pool_size];         // NUL終端の文字列の並び
+ */
+
+/* キャッシュのマジックナンバー ("SCC1") */
+#define SCRIPT_CACHE_MAGIC	(0x31434353)
+
+/* キャッシュの形式のバージョン(パースの結果が変わる場合にも上げる) */
+#define SCRIPT_CACHE_VERSION	(2)
+
+/* キャッシュのヘッダ */
+struct script_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_hash;	/* ソースの内容のハッシュ(FNV-1a) */
+	uint64_t source_size;	/* ソースのサイズ */
+	uint32_t name;		/* スクリプト名のオフセット */
+	uint32_t cmd_count;	/* コマンドの数 */
+	uint32_t line_count;	/* 行数 */
+	uint32_t param_count;	/* パラメータ表の要素数 */
+	uint32_t pool_size;	/* 文字列プールのサイズ */
+	uint32_t reserved;
+};
+
+/*
+ * ラベルのハッシュ表
+ *  - ラベルのコマンドのインデックスを開番地法で格納する(空きは-1)
+ *  - 同じ名前のラベルが複数ある場合は先頭のものを登録する
+ */
+static int *label_index;
+static uint32_t label_index_size;	/* 2のべき乗 */
+
+#ifndef USE_DEBUGGER
+/* コマンド配列が参照しているキャッシュ(マップできない場合はcache_buf) */
+static struct rfile *cache_rfile;
+static void *cache_buf;
+#endif
 
 /* 行数 */
 int script_lines;
 
+#ifndef USE_DEBUGGER
+/* 常駐させるスクリプトの数のデフォルト値 */
+#define SCRIPT_RESIDENT_COUNT_DEFAULT	(4)
+
+/* 常駐させるスクリプトの合計サイズの上限(KB)のデフォルト値 */
+#define SCRIPT_RESIDENT_SIZE_DEFAULT	(8192)
+
+/*
+ * 常駐スクリプト
+ *  - ロードし直したスクリプトを破棄せずに保持しておき、再度ロードされた
+ *    ときはパースせずに状態を入れ替える
+ *  - 現在のスクリプトを含めた個数と、現在のスクリプト以外の合計サイズが
+ *    上限を超えたら最も前に使ったものから破棄する
+ */
+
+/* スクリプトごとの状態 */
+struct script_state {
+	char *name;
+	struct command *cmd;
+	int cmd_size;
+	int cmd_alloc;
+	struct param_slot *param_slot;
+	uint32_t param_slot_size;
+	uint32_t param_slot_alloc;
+	char *pool;
+	uint32_t pool_size;
+	uint32_t pool_alloc;
+	int *label_index;
+	uint32_t label_index_size;
+	struct rfile *cache_rfile;
+	void *cache_buf;
+	int lines;
+};
+
+/* 常駐しているスクリプト(先頭が最も最近使ったもの) */
+static struct script_state *resident;
+static int resident_count;
+#endif
+
 #ifdef USE_DEBUGGER
 /* コメント行のテキスト */
 #define SCRIPT_LINE_SIZE	(65536)
@@ -329,6 +451,127 @@ struct param_item {
 
 #define PARAM_TBL_SIZE	(sizeof(param_tbl) / sizeof(struct param_item))
 
+/*
+ * 数値のパラメータ
+ *  - ロード時に変換とチェックを行い、get_int_param()とget_float_param()は
+ *    変換済みの値を返す
+ *  - 変更した場合はSCRIPT_CACHE_VERSIONを上げること
+ */
+
+/* パラメータの種類 */
+#define PARAM_KIND_STRING	(0)
+#define PARAM_KIND_INT		(1)
+#define PARAM_KIND_FLOAT	(2)
+
+static struct numeric_param_item {
+	int type;		/* コマンドのタイプ */
+	int param_index;	/* 最初のパラメータのインデックス */
+	int kind;		/* パラメータの種類 */
+	int count;		/* 繰り返しの数 */
+	int stride;		/* 繰り返しの間隔 */
+} numeric_param_tbl[] = {
+	{COMMAND_BG, BG_PARAM_SPAN, PARAM_KIND_FLOAT, 1, 0},
+	{COMMAND_CH, CH_PARAM_SPAN, PARAM_KIND_FLOAT, 1, 0},
+	{COMMAND_CH, CH_PARAM_OFFSET_X, PARAM_KIND_INT, 1, 0},
+	{COMMAND_CH, CH_PARAM_OFFSET_Y, PARAM_KIND_INT, 1, 0},
+	{COMMAND_CHA, CHA_PARAM_SPAN, PARAM_KIND_FLOAT, 1, 0},
+	{COMMAND_CHA, CHA_PARAM_OFFSET_X, PARAM_KIND_INT, 1, 0},
+	{COMMAND_CHA, CHA_PARAM_OFFSET_Y, PARAM_KIND_INT, 1, 0},
+	{COMMAND_CHS, CHS_PARAM_SPAN, PARAM_KIND_FLOAT, 1, 0},
+	{COMMAND_SHAKE, SHAKE_PARAM_SPAN, PARAM_KIND_FLOAT, 1, 0},
+	{COMMAND_SHAKE, SHAKE_PARAM_TIMES, PARAM_KIND_INT, 1, 0},
+	{COMMAND_SHAKE, SHAKE_PARAM_AMOUNT, PARAM_KIND_INT, 1, 0},
+	{COMMAND_VOL, VOL_PARAM_VOL, PARAM_KIND_FLOAT, 1, 0},
+	{COMMAND_VOL, VOL_PARAM_SPAN, PARAM_KIND_FLOAT, 1, 0},
+	{COMMAND_WAIT, WAIT_PARAM_SPAN, PARAM_KIND_FLOAT, 1, 0},
+
+	/* @menuのボタン(16個) */
+	{COMMAND_MENU, MENU_PARAM_X1, PARAM_KIND_INT, 16, 5},
+	{COMMAND_MENU, MENU_PARAM_Y1, PARAM_KIND_INT, 16, 5},
+	{COMMAND_MENU, MENU_PARAM_W1, PARAM_KIND_INT, 16, 5},
+	{COMMAND_MENU, MENU_PARAM_H1, PARAM_KIND_INT, 16, 5},
+
+	/* @retrospectの色とサイズとサムネイル(12個) */
+	{COMMAND_RETROSPECT, RETROSPECT_PARAM_HIDE_R, PARAM_KIND_INT, 1, 0},
+	{COMMAND_RETROSPECT, RETROSPECT_PARAM_HIDE_G, PARAM_KIND_INT, 1, 0},
+	{COMMAND_RETROSPECT, RETROSPECT_PARAM_HIDE_B, PARAM_KIND_INT, 1, 0},
+	{COMMAND_RETROSPECT, RETROSPECT_PARAM_WIDTH, PARAM_KIND_INT, 1, 0},
+	{COMMAND_RETROSPECT, RETROSPECT_PARAM_HEIGHT, PARAM_KIND_INT, 1, 0},
+	{COMMAND_RETROSPECT, RETROSPECT_PARAM_X1, PARAM_KIND_INT, 12, 4},
+	{COMMAND_RETROSPECT, RETROSPECT_PARAM_Y1, PARAM_KIND_INT, 12, 4},
+};
+
+#define NUMERIC_PARAM_TBL_SIZE	\
+	(sizeof(numeric_param_tbl) / sizeof(struct numeric_param_item))
+
+/* コマンドのタイプとパラメータのインデックスごとの種類 */
+static unsigned char param_kind[COMMAND_MAX][PARAM_SIZE];
+static bool is_param_kind_initialized;
+
+#ifndef USE_DEBUGGER
+/*
+ * イメージの先読み
+ *  - 実行位置からこの先のコマンドを調べ、使われるイメージを別スレッドで
+ *    デコードしておく
+ *  - ジャンプ先のラベルは実行されるかわからないが、分岐の両方を辿る
+ */
+
+/* 先読みで調べるコマンドの数のデフォルト値 */
+#define PREFETCH_COMMAND_COUNT_DEFAULT	(64)
+
+/* 先読みするイメージの最大数 */
+#define PREFETCH_IMAGE_MAX		(32)
+
+/* 先読みで辿る分岐の最大数 */
+#define PREFETCH_BRANCH_MAX		(16)
+
+/* イメージのファイル名のパラメータ */
+static struct prefetch_image_item {
+	int type;		/* コマンドのタイプ */
+	int param_index;	/* パラメータのインデックス */
+	const char *dir;	/* ディレクトリ(NULLはフェードのルール) */
+} prefetch_image_tbl[] = {
+	{COMMAND_BG, BG_PARAM_FILE, BG_DIR},
+	{COMMAND_BG, BG_PARAM_METHOD, NULL},
+	{COMMAND_CH, CH_PARAM_FILE, CH_DIR},
+	{COMMAND_CH, CH_PARAM_METHOD, NULL},
+	{COMMAND_CHS, CHS_PARAM_CENTER, CH_DIR},
+	{COMMAND_CHS, CHS_PARAM_RIGHT, CH_DIR},
+	{COMMAND_CHS, CHS_PARAM_LEFT, CH_DIR},
+	{COMMAND_CHS, CHS_PARAM_BACK, CH_DIR},
+	{COMMAND_CHS, CHS_PARAM_BG, BG_DIR},
+	{COMMAND_CHS, CHS_PARAM_METHOD, NULL},
+	{COMMAND_MENU, MENU_PARAM_BG_FILE, BG_DIR},
+	{COMMAND_MENU, MENU_PARAM_FG_FILE, BG_DIR},
+	{COMMAND_RETROSPECT, RETROSPECT_PARAM_BG_FILE, BG_DIR},
+	{COMMAND_RETROSPECT, RETROSPECT_PARAM_FG_FILE, BG_DIR},
+};
+
+#define PREFETCH_IMAGE_TBL_SIZE	\
+	(sizeof(prefetch_image_tbl) / sizeof(struct prefetch_image_item))
+
+/* 分岐先のラベルのパラメータ */
+static struct prefetch_branch_item {
+	int type;		/* コマンドのタイプ */
+	int param_index;	/* 最初のパラメータのインデックス */
+	int count;		/* 繰り返しの数 */
+	int stride;		/* 繰り返しの間隔 */
+} prefetch_branch_tbl[] = {
+	{COMMAND_IF, IF_PARAM_LABEL, 1, 0},
+	{COMMAND_GOSUB, GOSUB_PARAM_LABEL, 1, 0},
+	{COMMAND_SELECT, SELECT_PARAM_LABEL1, 3, 1},
+	{COMMAND_CHOOSE, CHOOSE_PARAM_LABEL1, 8, 2},
+	{COMMAND_MENU, MENU_PARAM_LABEL1, 16, 5},
+	{COMMAND_RETROSPECT, RETROSPECT_PARAM_LABEL1, 12, 4},
+};
+
+#define PREFETCH_BRANCH_TBL_SIZE \
+	(sizeof(prefetch_branch_tbl) / sizeof(struct prefetch_branch_item))
+
+/* 次に先読みを行うコマンド番号 */
+static int prefetch_next_index;
+#endif
+
 /*
  * コマンド実行ポインタ
  */
@@ -364,15 +607,61 @@ int startup_line;
  * 前方参照
  */
 static bool read_script_from_file(const char *fname);
-static bool parse_insn(int index, const char *fname, int line,
+static bool parse_insn(const char *fname, int line,
 		       const char *buf, int locale_offset);
 static char *strtok_escape(char *buf, bool *escaped);
-static bool parse_serif(int index, const char *fname, int line,
+static bool parse_serif(const char *fname, int line,
 			const char *buf, int locale_offset);
-static bool parse_message(int index, const char *fname, int line,
+static bool parse_message(const char *fname, int line,
 			  const char *buf, int locale_offset);
-static bool parse_label(int index, const char *fname, int line,
+static bool parse_label(const char *fname, int line,
 			const char *buf, int locale_offset);
+#ifdef USE_DEBUGGER
+static void set_parse_error_command(void);
+#endif
+static bool store_command(int index);
+static uint32_t add_pool_string(const char *s);
+static void clear_parsed_command(void);
+static void shrink_command_array(void);
+static const char *get_param(int index, int param_index);
+static const struct param_slot *get_param_slot(int index, int param_index);
+static void init_param_kind(void);
+static bool is_valid_number(const char *s, int kind);
+#ifndef USE_DEBUGGER
+static bool get_source_hash(struct rfile *rf, uint64_t *hash, uint64_t *size,
+			    bool *consumed);
+static bool load_script_cache(const char *fname, uint64_t hash,
+			      uint64_t size);
+static bool check_script_cache(const unsigned char *data, size_t data_size,
+			       const char *fname, uint64_t hash,
+			       uint64_t size);
+static void save_script_cache(const char *fname, uint64_t hash,
+			      uint64_t size);
+static const char *get_script_cache_file_name(const char *fname);
+#endif
+static uint64_t get_fnv1a_hash(const void *data, size_t size);
+static bool build_label_index(void);
+static int find_label(const char *label);
+#ifndef USE_DEBUGGER
+static void park_current_script(void);
+static bool take_resident_script(const char *fname,
+				 struct script_state *st);
+static void evict_resident_scripts(void);
+static void save_script_state(struct script_state *st);
+static void restore_script_state(const struct script_state *st);
+static void free_script_state(struct script_state *st);
+static size_t get_script_state_size(const struct script_state *st);
+#endif
+#ifndef USE_DEBUGGER
+static void update_prefetch(bool is_jump);
+static void prefetch_script_images(void);
+static void add_prefetch_images(int index, const char **dir,
+				const char **file, int *count);
+static void add_prefetch_branches(int index, int *branch, int *count);
+#endif
+static void prewarm_script_glyphs(void);
+static bool add_prewarm_chars(const char *s, unsigned char *added,
+			      uint32_t **list, int *count, int *size);
 
 /*
  * 初期化
@@ -418,42 +707,56 @@ bool init_script(void)
  */
 void cleanup_script(void)
 {
-	int i, j;
-
-	for (i = 0; i < SCRIPT_CMD_SIZE; i++) {
-		/* コマンドタイプをクリアする */
-		cmd[i].type = COMMAND_MIN;
-
-		/* 行の内容を解放する */
-		if (cmd[i].text != NULL) {
-			free(cmd[i].text);
-			cmd[i].text = NULL;
-		}
+#ifndef USE_DEBUGGER
+	struct script_state st;
+	int i;
 
-		/* 引数の本体を解放する */
-		if (cmd[i].param[0] != NULL) {
-			free(cmd[i].param[0]);
-			cmd[i].param[0] = NULL;
-		}
+	/* 現在のスクリプトを破棄する */
+	save_script_state(&st);
+	free_script_state(&st);
+	clear_parsed_command();
+
+	/* 常駐しているスクリプトを破棄する */
+	for (i = 0; i < resident_count; i++)
+		free_script_state(&resident[i]);
+	free(resident);
+	resident = NULL;
+	resident_count = 0;
+#else
+	int i;
 
-		/* 引数の参照をNULLで上書きする */
-		for (j = 1; j < PARAM_SIZE; j++)
-			cmd[i].param[j] = NULL;
-	}
+	/* コマンド配列を解放する */
+	free(cmd);
+	free(param_slot);
+	free(pool);
+	cmd = NULL;
+	cmd_size = 0;
+	cmd_alloc = 0;
+	param_slot = NULL;
+	param_slot_size = 0;
+	param_slot_alloc = 0;
+	pool = NULL;
+	pool_size = 0;
+	pool_alloc = 0;
+	clear_parsed_command();
+
+	/* ラベルのハッシュ表を解放する */
+	free(label_index);
+	label_index = NULL;
+	label_index_size = 0;
 
-#ifdef USE_DEBUGGER
 	for (i = 0; i < script_lines; i++) {
 		if (comment_text[i] != NULL) {
 			free(comment_text[i]);
 			comment_text[i] = NULL;
 		}
 	}
-#endif
 
 	if (cur_script != NULL) {
 		free(cur_script);
 		cur_script = NULL;
 	}
+#endif
 }
 
 /*
@@ -465,8 +768,35 @@ void cleanup_script(void)
  */
 bool load_script(const char *fname)
 {
+#ifndef USE_DEBUGGER
+	struct script_state st;
+	bool is_resident;
+
+	/* 前のスクリプトのイメージの先読みを取り消す */
+	cancel_image_prefetch();
+
+	/* 常駐しているスクリプトであれば取り出す */
+	is_resident = take_resident_script(fname, &st);
+
+	/* 現在のスクリプトを常駐させる */
+	park_current_script();
+
+	/* 取り出したスクリプトに入れ替える */
+	if (is_resident) {
+		restore_script_state(&st);
+		cur_index = 0;
+		set_return_point(-1);
+		prewarm_script_glyphs();
+		update_prefetch(true);
+		return true;
+	}
+#else
 	/* 現在のスクリプトを破棄する */
 	cleanup_script();
+#endif
+
+	/* 数値のパラメータの種類の表を作成する */
+	init_param_kind();
 
 	/* スクリプト名を保存する */
 	cur_index = 0;
@@ -495,18 +825,450 @@ bool load_script(const char *fname)
 #endif
 	}
 
+	/* ラベルのハッシュ表を作成する */
+	if (!build_label_index())
+		return false;
+
 	/* リターンポイントを無効にする */
 	set_return_point(-1);
 
+	/* メッセージとセリフの文字のグリフを先読みする */
+	prewarm_script_glyphs();
+
 #ifdef USE_DEBUGGER
 	if (dbg_is_stop_requested())
 		dbg_stop();
 	update_debug_info(true);
+#else
+	/* 先頭から使われるイメージを先読みする */
+	update_prefetch(true);
 #endif
 
 	return true;
 }
 
+#ifndef USE_DEBUGGER
+/* 現在のスクリプトを常駐スクリプトの先頭に移す */
+static void park_current_script(void)
+{
+	struct script_state st, *new_resident;
+	int max;
+
+	/* 現在のスクリプトを取り出す */
+	save_script_state(&st);
+	clear_parsed_command();
+
+	/* ロードに失敗していた場合と常駐させない設定の場合は破棄する */
+	max = get_script_resident_count() - 1;
+	if (st.name == NULL || st.cmd_size == 0 || st.label_index == NULL ||
+	    max <= 0) {
+		free_script_state(&st);
+		return;
+	}
+
+	/* 配列を確保する */
+	if (resident == NULL) {
+		new_resident = malloc(sizeof(struct script_state) *
+				      (size_t)max);
+		if (new_resident == NULL) {
+			free_script_state(&st);
+			return;
+		}
+		resident = new_resident;
+	}
+
+	/* 先頭に挿入する(あふれた分は後で破棄する) */
+	if (resident_count == max) {
+		free_script_state(&resident[max - 1]);
+		resident_count--;
+	}
+	memmove(&resident[1], &resident[0],
+		sizeof(struct script_state) * (size_t)resident_count);
+	resident[0] = st;
+	resident_count++;
+
+	/* メモリの上限を超えた分を破棄する */
+	evict_resident_scripts();
+}
+
+/* 常駐しているスクリプトであれば取り出す */
+static bool take_resident_script(const char *fname,
+				 struct script_state *st)
+{
+	int i;
+
+	for (i = 0; i < resident_count; i++) {
+		if (strcmp(resident[i].name, fname) != 0)
+			continue;
+
+		/* 常駐スクリプトから取り除く */
+		*st = resident[i];
+		memmove(&resident[i], &resident[i + 1],
+			sizeof(struct script_state) *
+			(size_t)(resident_count - i - 1));
+		resident_count--;
+		return true;
+	}
+	return false;
+}
+
+/* 合計サイズが上限を超えていれば古いものから破棄する */
+static void evict_resident_scripts(void)
+{
+	size_t total, limit;
+	int i;
+
+	limit = (size_t)get_script_resident_size() * 1024;
+	total = 0;
+	for (i = 0; i < resident_count; i++) {
+		total += get_script_state_size(&resident[i]);
+		if (total > limit)
+			break;
+	}
+	while (resident_count > i) {
+		resident_count--;
+		free_script_state(&resident[resident_count]);
+	}
+}
+
+/* 現在のスクリプトの状態を取り出して空にする */
+static void save_script_state(struct script_state *st)
+{
+	st->name = cur_script;
+	st->cmd = cmd;
+	st->cmd_size = cmd_size;
+	st->cmd_alloc = cmd_alloc;
+	st->param_slot = param_slot;
+	st->param_slot_size = param_slot_size;
+	st->param_slot_alloc = param_slot_alloc;
+	st->pool = pool;
+	st->pool_size = pool_size;
+	st->pool_alloc = pool_alloc;
+	st->label_index = label_index;
+	st->label_index_size = label_index_size;
+	st->cache_rfile = cache_rfile;
+	st->cache_buf = cache_buf;
+	st->lines = script_lines;
+
+	cur_script = NULL;
+	cmd = NULL;
+	cmd_size = 0;
+	cmd_alloc = 0;
+	param_slot = NULL;
+	param_slot_size = 0;
+	param_slot_alloc = 0;
+	pool = NULL;
+	pool_size = 0;
+	pool_alloc = 0;
+	label_index = NULL;
+	label_index_size = 0;
+	cache_rfile = NULL;
+	cache_buf = NULL;
+	script_lines = 0;
+}
+
+/* 状態を現在のスクリプトにする */
+static void restore_script_state(const struct script_state *st)
+{
+	assert(cur_script == NULL && cmd == NULL);
+
+	cur_script = st->name;
+	cmd = st->cmd;
+	cmd_size = st->cmd_size;
+	cmd_alloc = st->cmd_alloc;
+	param_slot = st->param_slot;
+	param_slot_size = st->param_slot_size;
+	param_slot_alloc = st->param_slot_alloc;
+	pool = st->pool;
+	pool_size = st->pool_size;
+	pool_alloc = st->pool_alloc;
+	label_index = st->label_index;
+	label_index_size = st->label_index_size;
+	cache_rfile = st->cache_rfile;
+	cache_buf = st->cache_buf;
+	script_lines = st->lines;
+}
+
+/* 状態を破棄する(キャッシュを参照している配列は解放しない) */
+static void free_script_state(struct script_state *st)
+{
+	if (st->cmd_alloc > 0)
+		free(st->cmd);
+	if (st->param_slot_alloc > 0)
+		free(st->param_slot);
+	if (st->pool_alloc > 0)
+		free(st->pool);
+	free(st->label_index);
+	if (st->cache_rfile != NULL)
+		close_rfile(st->cache_rfile);
+	free(st->cache_buf);
+	free(st->name);
+	memset(st, 0, sizeof(struct script_state));
+}
+
+/* 状態が使用しているメモリのサイズを求める */
+static size_t get_script_state_size(const struct script_state *st)
+{
+	size_t size;
+
+	size = sizeof(struct command) *
+		(size_t)(st->cmd_alloc > 0 ? st->cmd_alloc : st->cmd_size);
+	size += sizeof(struct param_slot) *
+		(st->param_slot_alloc > 0 ? st->param_slot_alloc :
+		 st->param_slot_size);
+	size += st->pool_alloc > 0 ? st->pool_alloc : st->pool_size;
+	size += sizeof(int) * st->label_index_size;
+	return size;
+}
+#endif
+
+#ifndef USE_DEBUGGER
+/*
+ * 必要であればイメージの先読みを開始する
+ *  - ジャンプした場合と、前回調べた範囲の半分まで進んだ場合に調べ直す
+ */
+static void update_prefetch(bool is_jump)
+{
+	if (conf_image_prefetch_disable)
+		return;
+
+	if (is_jump || cur_index >= prefetch_next_index)
+		prefetch_script_images();
+}
+
+/* この先で使われるイメージを調べて先読みする */
+static void prefetch_script_images(void)
+{
+	const char *dir[PREFETCH_IMAGE_MAX];
+	const char *file[PREFETCH_IMAGE_MAX];
+	int branch[PREFETCH_BRANCH_MAX];
+	const char *label;
+	int max, rest, count, branch_count, branch_pos, index, target;
+
+	max = conf_image_prefetch_count > 0 ? conf_image_prefetch_count :
+		PREFETCH_COMMAND_COUNT_DEFAULT;
+	prefetch_next_index = cur_index + max / 2;
+
+	/* 実行位置から調べ始め、分岐先は後で調べる */
+	count = 0;
+	branch[0] = cur_index;
+	branch_count = 1;
+	branch_pos = 0;
+	rest = max;
+	while (branch_pos < branch_count && rest > 0 &&
+	       count < PREFETCH_IMAGE_MAX) {
+		index = branch[branch_pos++];
+		for (; index < cmd_size && rest > 0; index++, rest--) {
+			add_prefetch_images(index, dir, file, &count);
+			add_prefetch_branches(index, branch, &branch_count);
+
+			/* @gotoはジャンプ先を続けて調べる */
+			if (cmd[index].type == COMMAND_GOTO) {
+				label = get_param(index, GOTO_PARAM_LABEL);
+				target = label != NULL ? find_label(label) : -1;
+				if (target == -1 || target == index)
+					break;
+				index = target - 1;
+				continue;
+			}
+
+			/* ここより先には進まない */
+			if (cmd[index].type == COMMAND_LOAD ||
+			    cmd[index].type == COMMAND_RETURN)
+				break;
+		}
+	}
+
+	/* 別スレッドでデコードする */
+	prefetch_images(dir, file, count);
+}
+
+/* コマンドで使われるイメージを先読みのリストに追加する */
+static void add_prefetch_images(int index, const char **dir,
+				const char **file, int *count)
+{
+	const char *f, *d;
+	int i, j, method;
+
+	for (i = 0; i < (int)PREFETCH_IMAGE_TBL_SIZE; i++) {
+		if (prefetch_image_tbl[i].type != cmd[index].type)
+			continue;
+		if (*count == PREFETCH_IMAGE_MAX)
+			return;
+
+		f = get_param(index, prefetch_image_tbl[i].param_index);
+		if (f == NULL)
+			continue;
+
+		d = prefetch_image_tbl[i].dir;
+		if (d == NULL) {
+			/* フェードのルールの場合 */
+			method = get_fade_method(f);
+			if (method != FADE_METHOD_RULE &&
+			    method != FADE_METHOD_MELT)
+				continue;
+			f += 5;
+			d = RULE_DIR;
+		}
+
+		/* イメージを使わない指定の場合 */
+		if (f[0] == '\0' || f[0] == '#' || strcmp(f, "none") == 0 ||
+		    strcmp(f, "stay") == 0 || strcmp(f, U8("消去")) == 0 ||
+		    strcmp(f, U8("消す")) == 0 ||
+		    strcmp(f, U8("変更なし")) == 0)
+			continue;
+
+		/* 重複を除く */
+		for (j = 0; j < *count; j++) {
+			if (dir[j] == d && strcmp(file[j], f) == 0)
+				break;
+		}
+		if (j < *count)
+			continue;
+
+		dir[*count] = d;
+		file[*count] = f;
+		(*count)++;
+	}
+}
+
+/* コマンドの分岐先を先読みで調べるリストに追加する */
+static void add_prefetch_branches(int index, int *branch, int *count)
+{
+	const struct prefetch_branch_item *item;
+	const char *label;
+	int i, j, target;
+
+	for (i = 0; i < (int)PREFETCH_BRANCH_TBL_SIZE; i++) {
+		item = &prefetch_branch_tbl[i];
+		if (item->type != cmd[index].type)
+			continue;
+		for (j = 0; j < item->count; j++) {
+			if (*count == PREFETCH_BRANCH_MAX)
+				return;
+			label = get_param(index,
+					  item->param_index + item->stride * j);
+			if (label == NULL)
+				continue;
+			target = find_label(label);
+			if (target != -1)
+				branch[(*count)++] = target;
+		}
+	}
+}
+#endif
+
+/* メッセージとセリフに含まれる文字のグリフを先読みする */
+static void prewarm_script_glyphs(void)
+{
+	unsigned char *added;
+	uint32_t *list;
+	int count, size, i;
+
+	/* BMPの文字を追加済みかのビットマップを確保する */
+	added = calloc(0x10000 / 8, 1);
+	if (added == NULL) {
+		log_memory();
+		return;
+	}
+
+	/* 出現順に重複なく文字を集める */
+	list = NULL;
+	count = 0;
+	size = 0;
+	for (i = 0; i < cmd_size; i++) {
+		if (cmd[i].type == COMMAND_MESSAGE) {
+			if (!add_prewarm_chars(get_param(i, MESSAGE_PARAM_MESSAGE),
+					       added, &list, &count, &size))
+				break;
+		} else if (cmd[i].type == COMMAND_SERIF) {
+			if (!add_prewarm_chars(get_param(i, SERIF_PARAM_NAME),
+					       added, &list, &count, &size))
+				break;
+			if (!add_prewarm_chars(get_param(i, SERIF_PARAM_MESSAGE),
+					       added, &list, &count, &size))
+				break;
+		}
+	}
+
+	/* 別スレッドでラスタライズする */
+	prewarm_glyphs(list, count);
+	free(list);
+	free(added);
+}
+
+/* 先読みする文字のリストに文字列の文字を追加する */
+static bool add_prewarm_chars(const char *s, unsigned char *added,
+			      uint32_t **list, int *count, int *size)
+{
+	uint32_t *new_list;
+	uint32_t c;
+	int mblen, i;
+
+	if (s == NULL)
+		return true;
+
+	while (*s != '\0') {
+		mblen = utf8_to_utf32(s, &c);
+		if (mblen == -1)
+			return true;
+		s += mblen;
+
+		/* 制御文字とスペースは描画しない */
+		if (c <= CHAR_SPACE)
+			continue;
+
+		/* 既に追加されていればスキップする */
+		if (c < 0x10000) {
+			if (added[c / 8] & (1 << (c % 8)))
+				continue;
+			added[c / 8] |= (unsigned char)(1 << (c % 8));
+		} else {
+			for (i = *count - 1; i >= 0; i--)
+				if ((*list)[i] == c)
+					break;
+			if (i >= 0)
+				continue;
+		}
+
+		/* 追加する */
+		if (*count == *size) {
+			new_list = realloc(*list, sizeof(uint32_t) *
+					   (size_t)(*size == 0 ? 256 : *size * 2));
+			if (new_list == NULL) {
+				log_memory();
+				return false;
+			}
+			*list = new_list;
+			*size = *size == 0 ? 256 : *size * 2;
+		}
+		(*list)[(*count)++] = c;
+	}
+	return true;
+}
+
+#ifndef USE_DEBUGGER
+/*
+ * 常駐させるスクリプトの数を取得する(現在のスクリプトを含む)
+ */
+int get_script_resident_count(void)
+{
+	if (conf_script_resident_count > 0)
+		return conf_script_resident_count;
+	return SCRIPT_RESIDENT_COUNT_DEFAULT;
+}
+
+/*
+ * 常駐させるスクリプトの合計サイズの上限(KB)を取得する
+ */
+int get_script_resident_size(void)
+{
+	if (conf_script_resident_size > 0)
+		return conf_script_resident_size;
+	return SCRIPT_RESIDENT_SIZE_DEFAULT;
+}
+#endif
+
 /*
  * スクリプトファイル名を取得する
  */
@@ -537,6 +1299,8 @@ bool move_to_command_index(int index)
 	if (dbg_is_stop_requested())
 		dbg_stop();
 	update_debug_info(false);
+#else
+	update_prefetch(true);
 #endif
 
 	return true;
@@ -557,6 +1321,8 @@ bool move_to_next_command(void)
 	if (dbg_is_stop_requested())
 		dbg_stop();
 	update_debug_info(false);
+#else
+	update_prefetch(false);
 #endif
 
 	return true;
@@ -567,28 +1333,24 @@ bool move_to_next_command(void)
  */
 bool move_to_label(const char *label)
 {
-	struct command *c;
 	int i;
 
 	/* ラベルを探す */
-	for (i = 0; i < cmd_size; i++) {
-		/* ラベルでないコマンドをスキップする */
-		c = &cmd[i];
-		if (c->type != COMMAND_LABEL)
-			continue;
+	i = find_label(label);
 
-		/* ラベルがみつかった場合 */
-		if (strcmp(c->param[LABEL_PARAM_LABEL], label) == 0) {
-			cur_index = i;
+	/* ラベルがみつかった場合 */
+	if (i != -1) {
+		cur_index = i;
 
 #ifdef USE_DEBUGGER
-			if (dbg_is_stop_requested())
-				dbg_stop();
-			update_debug_info(false);
+		if (dbg_is_stop_requested())
+			dbg_stop();
+		update_debug_info(false);
+#else
+		update_prefetch(true);
 #endif
 
-			return true;
-		}
+		return true;
 	}
 
 	/* エラーを出力する */
@@ -662,11 +1424,7 @@ int get_line_num(void)
  */
 const char *get_line_string(void)
 {
-	struct command *c;
-
-	c = &cmd[cur_index];
-
-	return c->text;
+	return pool + cmd[cur_index].text;
 }
 
 /*
@@ -703,19 +1461,19 @@ const char *get_command_locale(void)
  */
 const char *get_string_param(int index)
 {
-	struct command *c;
+	const char *s;
 
 	assert(cur_index < cmd_size);
 	assert(index < PARAM_SIZE);
 
-	c = &cmd[cur_index];
+	s = get_param(cur_index, index);
 
 	/* パラメータが省略された場合 */
-	if (c->param[index] == NULL)
+	if (s == NULL)
 		return "";
 
 	/* 文字列を返す */
-	return c->param[index];
+	return s;
 }
 
 /*
@@ -723,19 +1481,23 @@ const char *get_string_param(int index)
  */
 int get_int_param(int index)
 {
-	struct command *c;
+	const struct param_slot *slot;
 
 	assert(cur_index < cmd_size);
 	assert(index < PARAM_SIZE);
 
-	c = &cmd[cur_index];
+	slot = get_param_slot(cur_index, index);
 
 	/* パラメータが省略された場合 */
-	if (c->param[index] == NULL)
+	if (slot == NULL)
 		return 0;
 
+	/* ロード時に変換した値を返す */
+	if (param_kind[cmd[cur_index].type][index] == PARAM_KIND_INT)
+		return slot->value;
+
 	/* 整数に変換して返す */
-	return atoi(c->param[index]);
+	return atoi(pool + slot->ofs);
 }
 
 /*
@@ -743,19 +1505,26 @@ int get_int_param(int index)
  */
 float get_float_param(int index)
 {
-	struct command *c;
+	const struct param_slot *slot;
+	float f;
 
 	assert(cur_index < cmd_size);
 	assert(index < PARAM_SIZE);
 
-	c = &cmd[cur_index];
+	slot = get_param_slot(cur_index, index);
 
 	/* パラメータが省略された場合 */
-	if (c->param[index] == NULL)
+	if (slot == NULL)
 		return 0.0f;
 
+	/* ロード時に変換した値を返す */
+	if (param_kind[cmd[cur_index].type][index] == PARAM_KIND_FLOAT) {
+		memcpy(&f, &slot->value, sizeof(float));
+		return f;
+	}
+
 	/* 浮動小数点数に変換して返す */
-	return (float)atof(c->param[index]);
+	return (float)atof(pool + slot->ofs);
 }
 
 /*
@@ -787,6 +1556,10 @@ static bool read_script_from_file(const char *fname)
 	int line;
 	int top;
 	bool result;
+#ifndef USE_DEBUGGER
+	uint64_t hash, size;
+	bool has_hash, consumed;
+#endif
 
 #ifdef USE_DEBUGGER
 	error_count = 0;
@@ -797,6 +1570,23 @@ static bool read_script_from_file(const char *fname)
 	if (rf == NULL)
 		return false;
 
+#ifndef USE_DEBUGGER
+	/* ソースのハッシュが一致するキャッシュがあればパースせずに使う */
+	has_hash = get_source_hash(rf, &hash, &size, &consumed);
+	if (has_hash && load_script_cache(fname, hash, size)) {
+		close_rfile(rf);
+		return true;
+	}
+
+	/* ハッシュを求めるために読み込んだ場合は開き直す */
+	if (consumed) {
+		close_rfile(rf);
+		rf = open_rfile(SCRIPT_DIR, fname, false);
+		if (rf == NULL)
+			return false;
+	}
+#endif
+
 	/* 行ごとに処理する */
 	cmd_size = 0;
 	line = 0;
@@ -824,12 +1614,12 @@ static bool read_script_from_file(const char *fname)
 		/* ロケールを処理する */
 		top = 0;
 		if (strlen(buf) > 4 && buf[0] == '+' && buf[3] == '+') {
-			cmd[cmd_size].locale[0] = buf[1];
-			cmd[cmd_size].locale[1] = buf[2];
-			cmd[cmd_size].locale[2] = '\0';
+			parsed.locale[0] = buf[1];
+			parsed.locale[1] = buf[2];
+			parsed.locale[2] = '\0';
 			top = BUF_OFS;
 		} else {
-			cmd[cmd_size].locale[0] = '\0';
+			parsed.locale[0] = '\0';
 		}
 
 		/* 行頭の文字で仕分けする */
@@ -849,10 +1639,10 @@ static bool read_script_from_file(const char *fname)
 			break;
 		case '@':
 			/* 命令行をパースする */
-			if (!parse_insn(cmd_size, fname, line, buf, top)) {
+			if (!parse_insn(fname, line, buf, top)) {
 #ifdef USE_DEBUGGER
 				if (is_parse_error) {
-					cmd_size++;
+					result = store_command(cmd_size);
 					is_parse_error = false;
 				} else {
 					result = false;
@@ -861,15 +1651,15 @@ static bool read_script_from_file(const char *fname)
 				result = false;
 #endif
 			} else {
-				cmd_size++;
+				result = store_command(cmd_size);
 			}
 			break;
 		case '*':
 			/* セリフ行をパースする */
-			if (!parse_serif(cmd_size, fname, line, buf, top)) {
+			if (!parse_serif(fname, line, buf, top)) {
 #ifdef USE_DEBUGGER
 				if (is_parse_error) {
-					cmd_size++;
+					result = store_command(cmd_size);
 					is_parse_error = false;
 				} else {
 					result = false;
@@ -878,15 +1668,15 @@ static bool read_script_from_file(const char *fname)
 				result = false;
 #endif
 			} else {
-				cmd_size++;
+				result = store_command(cmd_size);
 			}
 			break;
 		case ':':
 			/* ラベル行をパースする */
-			if (!parse_label(cmd_size, fname, line, buf, top)) {
+			if (!parse_label(fname, line, buf, top)) {
 #ifdef USE_DEBUGGER
 				if (is_parse_error) {
-					cmd_size++;
+					result = store_command(cmd_size);
 					is_parse_error = false;
 				} else {
 					result = false;
@@ -895,15 +1685,15 @@ static bool read_script_from_file(const char *fname)
 				result = false;
 #endif
 			} else {
-				cmd_size++;
+				result = store_command(cmd_size);
 			}
 			break;
 		default:
 			/* メッセージ行をパースする */
-			if (!parse_message(cmd_size, fname, line, buf, top)) {
+			if (!parse_message(fname, line, buf, top)) {
 #ifdef USE_DEBUGGER
 				if (is_parse_error) {
-					cmd_size++;
+					result = store_command(cmd_size);
 					is_parse_error = false;
 				} else {
 					result = false;
@@ -912,7 +1702,7 @@ static bool read_script_from_file(const char *fname)
 				result = false;
 #endif
 			} else {
-				cmd_size++;
+				result = store_command(cmd_size);
 			}
 			break;
 		}
@@ -923,14 +1713,337 @@ static bool read_script_from_file(const char *fname)
 
 	close_rfile(rf);
 
+	/* 失敗した場合に途中までパースしたコマンドを解放する */
+	clear_parsed_command();
+
+	/* 余分に確保した領域を縮める */
+	shrink_command_array();
+
+#ifndef USE_DEBUGGER
+	/* パースに成功したらキャッシュを作成する */
+	if (result && has_hash)
+		save_script_cache(fname, hash, size);
+#endif
+
 	return result;
 }
 
+#ifndef USE_DEBUGGER
+/*
+ * コンパイル済みスクリプトのキャッシュ
+ */
+
+/* ソースの内容のハッシュとサイズを求める */
+static bool get_source_hash(struct rfile *rf, uint64_t *hash, uint64_t *size,
+			    bool *consumed)
+{
+	const void *data;
+	void *buf;
+	size_t len;
+
+	*consumed = false;
+	len = get_rfile_size(rf);
+	*size = len;
+
+	/* パッケージにハッシュが記録されていればそれを使う */
+	if (get_rfile_hash(rf, hash))
+		return true;
+
+	/* マップできればストリームを消費せずに求める */
+	data = map_rfile(rf);
+	if (data != NULL) {
+		*hash = get_fnv1a_hash(data, len);
+		return true;
+	}
+
+	/* 全体を読み込んで求める */
+	*consumed = true;
+	buf = malloc(len > 0 ? len : 1);
+	if (buf == NULL)
+		return false;
+	if (read_rfile(rf, buf, len) != len) {
+		free(buf);
+		return false;
+	}
+	*hash = get_fnv1a_hash(buf, len);
+	free(buf);
+	return true;
+}
+
+/* キャッシュを読み込んでコマンド配列として参照する */
+static bool load_script_cache(const char *fname, uint64_t hash,
+			      uint64_t size)
+{
+	const struct script_cache_header *h;
+	const unsigned char *data;
+	struct rfile *rf;
+	void *buf;
+	size_t file_size;
+
+	/* キャッシュファイルを開く(なければ何も出力しない) */
+	rf = open_rfile(SAVE_DIR, get_script_cache_file_name(fname), true);
+	if (rf == NULL)
+		return false;
+	file_size = get_rfile_size(rf);
+
+	/* マップできなければ読み込む */
+	buf = NULL;
+	data = map_rfile(rf);
+	if (data == NULL) {
+		buf = malloc(file_size > 0 ? file_size : 1);
+		if (buf == NULL ||
+		    read_rfile(rf, buf, file_size) != file_size) {
+			free(buf);
+			close_rfile(rf);
+			return false;
+		}
+		close_rfile(rf);
+		rf = NULL;
+		data = buf;
+	}
+
+	/* 内容を検証する(古いか壊れていればパースし直す) */
+	if (!check_script_cache(data, file_size, fname, hash, size)) {
+		if (rf != NULL)
+			close_rfile(rf);
+		free(buf);
+		return false;
+	}
+
+	/* コマンド配列としてそのまま参照する */
+	h = (const struct script_cache_header *)data;
+	cmd = (struct command *)(h + 1);
+	cmd_size = (int)h->cmd_count;
+	param_slot = (struct param_slot *)(cmd + cmd_size);
+	param_slot_size = h->param_count;
+	pool = (char *)(param_slot + param_slot_size);
+	pool_size = h->pool_size;
+	script_lines = (int)h->line_count;
+
+	/* キャッシュはcleanup_script()まで保持する */
+	cache_rfile = rf;
+	cache_buf = buf;
+	return true;
+}
+
+/* キャッシュの内容を検証する */
+static bool check_script_cache(const unsigned char *data, size_t data_size,
+			       const char *fname, uint64_t hash,
+			       uint64_t size)
+{
+	const struct script_cache_header *h;
+	const struct command *c;
+	const struct param_slot *pt;
+	const char *pl;
+	uint32_t i, j;
+
+	/* ヘッダを検証する */
+	if (data_size < sizeof(struct script_cache_header))
+		return false;
+	h = (const struct script_cache_header *)data;
+	if (h->magic != SCRIPT_CACHE_MAGIC ||
+	    h->version != SCRIPT_CACHE_VERSION ||
+	    h->source_hash != hash ||
+	    h->source_size != size)
+		return false;
+	if (h->cmd_count == 0 || h->cmd_count > SCRIPT_CMD_SIZE ||
+	    h->line_count > SCRIPT_CMD_SIZE ||
+	    h->param_count > (uint32_t)SCRIPT_CMD_SIZE * PARAM_SIZE ||
+	    h->pool_size == 0)
+		return false;
+	if (data_size != sizeof(struct script_cache_header) +
+	    h->cmd_count * sizeof(struct command) +
+	    h->param_count * sizeof(struct param_slot) + h->pool_size)
+		return false;
+
+	/* 文字列プールが終端されていて、スクリプト名が一致するか */
+	c = (const struct command *)(h + 1);
+	pt = (const struct param_slot *)(c + h->cmd_count);
+	pl = (const char *)(pt + h->param_count);
+	if (pl[h->pool_size - 1] != '\0')
+		return false;
+	if (h->name >= h->pool_size || strcmp(pl + h->name, fname) != 0)
+		return false;
+
+	/* コマンドを検証する */
+	for (i = 0; i < h->cmd_count; i++) {
+		if (c[i].type <= COMMAND_MIN || c[i].type >= COMMAND_MAX)
+			return false;
+		if (c[i].text >= h->pool_size)
+			return false;
+		if (c[i].param_count > PARAM_SIZE ||
+		    c[i].param_top > h->param_count ||
+		    c[i].param_count > h->param_count - c[i].param_top)
+			return false;
+		for (j = 0; j < c[i].param_count; j++) {
+			if (pt[c[i].param_top + j].ofs != PARAM_NULL &&
+			    pt[c[i].param_top + j].ofs >= h->pool_size)
+				return false;
+		}
+		if (c[i].locale[sizeof(c[i].locale) - 1] != '\0')
+			return false;
+	}
+
+	return true;
+}
+
+/* コマンド配列をキャッシュに書き出す */
+static void save_script_cache(const char *fname, uint64_t hash,
+			      uint64_t size)
+{
+	struct script_cache_header h;
+	struct wfile *wf;
+	const char *name;
+	size_t len, total, written;
+
+	if (cmd_size == 0)
+		return;
+
+	/* 文字列プールの後ろにスクリプト名を置く */
+	len = strlen(fname) + 1;
+	if (len >= PARAM_NULL - pool_size)
+		return;
+
+	/* ヘッダを作成する */
+	memset(&h, 0, sizeof(h));
+	h.magic = SCRIPT_CACHE_MAGIC;
+	h.version = SCRIPT_CACHE_VERSION;
+	h.source_hash = hash;
+	h.source_size = size;
+	h.name = pool_size;
+	h.cmd_count = (uint32_t)cmd_size;
+	h.line_count = (uint32_t)script_lines;
+	h.param_count = param_slot_size;
+	h.pool_size = pool_size + (uint32_t)len;
+
+	/* 書き出す(失敗したら壊れたキャッシュを残さない) */
+	name = get_script_cache_file_name(fname);
+	make_sav_dir();
+	wf = open_wfile(SAVE_DIR, name);
+	if (wf == NULL)
+		return;
+	total = sizeof(h) + sizeof(struct command) * (size_t)cmd_size +
+		sizeof(struct param_slot) * param_slot_size + pool_size + len;
+	written = write_wfile(wf, &h, sizeof(h));
+	written += write_wfile(wf, cmd,
+			       sizeof(struct command) * (size_t)cmd_size);
+	written += write_wfile(wf, param_slot,
+			       sizeof(struct param_slot) * param_slot_size);
+	written += write_wfile(wf, pool, pool_size);
+	written += write_wfile(wf, fname, len);
+	close_wfile(wf);
+	if (written != total)
+		remove_file(SAVE_DIR, name);
+}
+
+/* キャッシュのファイル名を求める */
+static const char *get_script_cache_file_name(const char *fname)
+{
+	static char name[32];
+	uint64_t h;
+
+	h = get_fnv1a_hash(fname, strlen(fname));
+	snprintf(name, sizeof(name), "%08lx%08lx.scc",
+		 (unsigned long)(h >> 32), (unsigned long)(h & 0xffffffff));
+	return name;
+}
+#endif
+
+/* FNV-1aハッシュを求める(パッケージに記録されるものと同じ) */
+static uint64_t get_fnv1a_hash(const void *data, size_t size)
+{
+	const unsigned char *p;
+	uint64_t hash;
+	size_t i;
+
+	p = data;
+	hash = 0xcbf29ce484222325ULL;
+	for (i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/*
+ * ラベルのハッシュ表
+ */
+
+/* ラベルのハッシュ表を作成する */
+static bool build_label_index(void)
+{
+	const char *name;
+	uint32_t size, h;
+	int i, count;
+
+	free(label_index);
+	label_index = NULL;
+	label_index_size = 0;
+
+	/* ラベルの数の2倍以上の大きさにする */
+	count = 0;
+	for (i = 0; i < cmd_size; i++)
+		if (cmd[i].type == COMMAND_LABEL)
+			count++;
+	for (size = 16; size < (uint32_t)count * 2; size *= 2)
+		;
+
+	label_index = malloc(sizeof(int) * size);
+	if (label_index == NULL) {
+		log_memory();
+		return false;
+	}
+	label_index_size = size;
+	for (h = 0; h < size; h++)
+		label_index[h] = -1;
+
+	/* ラベルを登録する */
+	for (i = 0; i < cmd_size; i++) {
+		if (cmd[i].type != COMMAND_LABEL)
+			continue;
+		name = get_param(i, LABEL_PARAM_LABEL);
+		if (name == NULL)
+			continue;
+
+		/* 空きか同名のラベルがみつかるまで線形探査する */
+		h = (uint32_t)get_fnv1a_hash(name, strlen(name)) & (size - 1);
+		while (label_index[h] != -1) {
+			if (strcmp(get_param(label_index[h], LABEL_PARAM_LABEL),
+				   name) == 0)
+				break;
+			h = (h + 1) & (size - 1);
+		}
+		if (label_index[h] == -1)
+			label_index[h] = i;
+	}
+
+	return true;
+}
+
+/* ラベルのコマンドのインデックスを求める(みつからなければ-1) */
+static int find_label(const char *label)
+{
+	uint32_t h;
+
+	if (label_index == NULL)
+		return -1;
+
+	h = (uint32_t)get_fnv1a_hash(label, strlen(label)) &
+		(label_index_size - 1);
+	while (label_index[h] != -1) {
+		if (strcmp(get_param(label_index[h], LABEL_PARAM_LABEL),
+			   label) == 0)
+			return label_index[h];
+		h = (h + 1) & (label_index_size - 1);
+	}
+	return -1;
+}
+
 /* 命令行をパースする */
-static bool parse_insn(int index, const char *file, int line, const char *buf,
+static bool parse_insn(const char *file, int line, const char *buf,
 		       int locale_offset)
 {
-	struct command *c;
+	struct parsed_command *c;
 	char *tp;
 	int i, j, len, min = 0, max = 0;
 	bool escaped;
@@ -939,7 +2052,7 @@ static bool parse_insn(int index, const char *file, int line, const char *buf,
 	UNUSED_PARAMETER(file);
 #endif
 
-	c = &cmd[index];
+	c = &parsed;
 
 	/* 行番号とオリジナルの行を保存しておく */
 	c->line = line;
@@ -972,8 +2085,7 @@ static bool parse_insn(int index, const char *file, int line, const char *buf,
 		log_script_command_not_found(c->param[0]);
 #ifdef USE_DEBUGGER
 		is_parse_error = true;
-		cmd[index].text[0] = '!';
-		set_error_command(index, cmd[index].text);
+		set_parse_error_command();
 		if(error_count++ == 0)
 			log_command_update_error();
 #else
@@ -991,8 +2103,7 @@ static bool parse_insn(int index, const char *file, int line, const char *buf,
 			log_script_empty_string();
 #ifdef USE_DEBUGGER
 			is_parse_error = true;
-			cmd[index].text[0] = '!';
-			set_error_command(index, cmd[index].text);
+			set_parse_error_command();
 			if(error_count++ == 0)
 				log_command_update_error();
 #else
@@ -1033,8 +2144,7 @@ static bool parse_insn(int index, const char *file, int line, const char *buf,
 			log_script_param_mismatch(tp);
 #ifdef USE_DEBUGGER
 			is_parse_error = true;
-			cmd[index].text[0] = '!';
-			set_error_command(index, cmd[index].text);
+			set_parse_error_command();
 			if(error_count++ == 0)
 				log_command_update_error();
 #else
@@ -1049,8 +2159,7 @@ static bool parse_insn(int index, const char *file, int line, const char *buf,
 		log_script_too_few_param(min, i - 1);
 #ifdef USE_DEBUGGER
 		is_parse_error = true;
-		cmd[index].text[0] = '!';
-		set_error_command(index, cmd[index].text);
+		set_parse_error_command();
 		if(error_count++ == 0)
 			log_command_update_error();
 #else
@@ -1062,8 +2171,23 @@ static bool parse_insn(int index, const char *file, int line, const char *buf,
 		log_script_too_many_param(max, i - 1);
 #ifdef USE_DEBUGGER
 		is_parse_error = true;
-		cmd[index].text[0] = '!';
-		set_error_command(index, cmd[index].text);
+		set_parse_error_command();
+		if(error_count++ == 0)
+			log_command_update_error();
+#else
+		log_script_parse_footer(file, line, buf);
+#endif
+		return false;
+	}
+
+	/* 数値のパラメータをチェックする */
+	for (j = 1; j < i; j++) {
+		if (is_valid_number(c->param[j], param_kind[c->type][j]))
+			continue;
+		log_script_not_number(c->param[j]);
+#ifdef USE_DEBUGGER
+		is_parse_error = true;
+		set_parse_error_command();
 		if(error_count++ == 0)
 			log_command_update_error();
 #else
@@ -1133,7 +2257,7 @@ static char *strtok_escape(char *buf, bool *escaped)
 }
 
 /* セリフ行をパースする */
-static bool parse_serif(int index, const char *file, int line, const char *buf,
+static bool parse_serif(const char *file, int line, const char *buf,
 			int locale_offset)
 {
 	char *first, *second, *third;
@@ -1145,31 +2269,30 @@ static bool parse_serif(int index, const char *file, int line, const char *buf,
 #endif
 
 	/* 行番号とオリジナルの行を保存しておく */
-	cmd[index].type = COMMAND_SERIF;
-	cmd[index].line = line;
-	cmd[index].text = strdup(buf);
-	if (cmd[index].text == NULL) {
+	parsed.type = COMMAND_SERIF;
+	parsed.line = line;
+	parsed.text = strdup(buf);
+	if (parsed.text == NULL) {
 		log_memory();
 		return false;
 	}
 
 	/* トークン化する文字列を複製する */
-	cmd[index].param[0] = strdup(&buf[locale_offset + 1]);
-	if (cmd[index].param[0] == NULL) {
+	parsed.param[0] = strdup(&buf[locale_offset + 1]);
+	if (parsed.param[0] == NULL) {
 		log_memory();
 		return false;
 	}
 
 	/* トークンを取得する(2つか3つある) */
-	first = strtok(cmd[index].param[0], "*");
+	first = strtok(parsed.param[0], "*");
 	second = strtok(NULL, "*");
 	third = strtok(NULL, "*");
 	if (first == NULL || second == NULL) {
 		log_script_empty_serif();
 #ifdef USE_DEBUGGER
 		is_parse_error = true;
-		cmd[index].text[0] = '!';
-		set_error_command(index, cmd[index].text);
+		set_parse_error_command();
 		if(error_count++ == 0)
 			log_command_update_error();
 #else
@@ -1180,13 +2303,13 @@ static bool parse_serif(int index, const char *file, int line, const char *buf,
 
 	/* トークンの数で場合分けする */
 	if (third != NULL) {
-		cmd[index].param[SERIF_PARAM_NAME] = first;
-		cmd[index].param[SERIF_PARAM_VOICE] = second;
-		cmd[index].param[SERIF_PARAM_MESSAGE] = third;
+		parsed.param[SERIF_PARAM_NAME] = first;
+		parsed.param[SERIF_PARAM_VOICE] = second;
+		parsed.param[SERIF_PARAM_MESSAGE] = third;
 	} else {
-		cmd[index].param[SERIF_PARAM_NAME] = first;
-		cmd[index].param[SERIF_PARAM_VOICE] = NULL;
-		cmd[index].param[SERIF_PARAM_MESSAGE] = second;
+		parsed.param[SERIF_PARAM_NAME] = first;
+		parsed.param[SERIF_PARAM_VOICE] = NULL;
+		parsed.param[SERIF_PARAM_MESSAGE] = second;
 	}
 
 	/* 成功 */
@@ -1194,43 +2317,43 @@ static bool parse_serif(int index, const char *file, int line, const char *buf,
 }
 
 /* メッセージ行をパースする */
-static bool parse_message(int index, const char *file, int line,
-			  const char *buf, int locale_offset)
+static bool parse_message(const char *file, int line, const char *buf,
+			  int locale_offset)
 {
 	char *lpar, *p;
 
 	UNUSED_PARAMETER(file);
 
 	/* 行番号とオリジナルの行(メッセージ全体)を保存しておく */
-	cmd[index].type = COMMAND_MESSAGE;
-	cmd[index].line = line;
-	cmd[index].text = strdup(buf);
-	if (cmd[index].text == NULL) {
+	parsed.type = COMMAND_MESSAGE;
+	parsed.line = line;
+	parsed.text = strdup(buf);
+	if (parsed.text == NULL) {
 		log_memory();
 		return false;
 	}
 
 	/* メッセージ(0番目のパラメータ)を複製する */
-	cmd[index].param[MESSAGE_PARAM_MESSAGE] = strdup(buf + locale_offset);
-	if (cmd[index].text == NULL) {
+	parsed.param[MESSAGE_PARAM_MESSAGE] = strdup(buf + locale_offset);
+	if (parsed.param[MESSAGE_PARAM_MESSAGE] == NULL) {
 		log_memory();
 		return false;
 	}
 
 	/* 名前「メッセージ」の形式の場合はセリフとする */
-	p = cmd[index].param[MESSAGE_PARAM_MESSAGE];
+	p = parsed.param[MESSAGE_PARAM_MESSAGE];
 	lpar = strstr(p, U8("「"));
 	if (lpar != NULL && lpar != buf &&
 	    strcmp(p + strlen(p) - 3, U8("」")) == 0) {
 		/* セリフに変更する */
-		cmd[index].type = COMMAND_SERIF;
+		parsed.type = COMMAND_SERIF;
 
 		/* トークン化する */
 		*(p + strlen(p) - 3) = '\0';
 		*lpar = '\0';
-		cmd[index].param[SERIF_PARAM_NAME] = p;
-		cmd[index].param[SERIF_PARAM_VOICE] = NULL;
-		cmd[index].param[SERIF_PARAM_MESSAGE] = lpar + 3;
+		parsed.param[SERIF_PARAM_NAME] = p;
+		parsed.param[SERIF_PARAM_VOICE] = NULL;
+		parsed.param[SERIF_PARAM_MESSAGE] = lpar + 3;
 	}
 
 	/* 成功 */
@@ -1238,23 +2361,23 @@ static bool parse_message(int index, const char *file, int line,
 }
 
 /* ラベル行をパースする */
-		static bool parse_label(int index, const char *file, int line, const char *buf,
-					int locale_offset)
+static bool parse_label(const char *file, int line, const char *buf,
+			int locale_offset)
 {
 	UNUSED_PARAMETER(file);
 
 	/* 行番号とオリジナルの行(メッセージ全体)を保存しておく */
-	cmd[index].type = COMMAND_LABEL;
-	cmd[index].line = line;
-	cmd[index].text = strdup(buf);
-	if (cmd[index].text == NULL) {
+	parsed.type = COMMAND_LABEL;
+	parsed.line = line;
+	parsed.text = strdup(buf);
+	if (parsed.text == NULL) {
 		log_memory();
 		return false;
 	}
 
 	/* ラベルを保存する */
-	cmd[index].param[LABEL_PARAM_LABEL] = strdup(&buf[locale_offset + 1]);
-	if (cmd[index].param[LABEL_PARAM_LABEL] == NULL) {
+	parsed.param[LABEL_PARAM_LABEL] = strdup(&buf[locale_offset + 1]);
+	if (parsed.param[LABEL_PARAM_LABEL] == NULL) {
 		log_memory();
 		return false;
 	}
@@ -1263,6 +2386,276 @@ static bool parse_message(int index, const char *file, int line,
 	return true;
 }
 
+#ifdef USE_DEBUGGER
+/* パースエラーのコマンドをエラー表示用のメッセージにする */
+static void set_parse_error_command(void)
+{
+	int i;
+
+	parsed.type = COMMAND_MESSAGE;
+	parsed.text[0] = '!';
+
+	/* 引数の本体を解放する */
+	free(parsed.param[0]);
+	for (i = 0; i < PARAM_SIZE; i++)
+		parsed.param[i] = NULL;
+}
+#endif
+
+/*
+ * コマンド配列への格納
+ */
+
+/* パースしたコマンドを格納する(indexがcmd_sizeなら末尾に追加する) */
+static bool store_command(int index)
+{
+	struct param_slot *new_slot, *slot;
+	void *new_cmd;
+	size_t new_alloc;
+	uint32_t text, top;
+	float f;
+	int i, n;
+
+	assert(index >= 0 && index <= cmd_size);
+	assert(cmd_alloc > 0 || cmd_size == 0);
+
+	/* コマンド配列を拡張する */
+	if (index == cmd_size && cmd_size == cmd_alloc) {
+		new_alloc = cmd_alloc == 0 ? 256 : (size_t)cmd_alloc * 2;
+		new_cmd = realloc(cmd, sizeof(struct command) * new_alloc);
+		if (new_cmd == NULL) {
+			log_memory();
+			return false;
+		}
+		cmd = new_cmd;
+		cmd_alloc = (int)new_alloc;
+	}
+
+	/* 省略されていない最後のパラメータまでを格納する */
+	for (n = PARAM_SIZE; n > 0; n--)
+		if (parsed.param[n - 1] != NULL)
+			break;
+
+	/* パラメータ表を拡張する */
+	if (param_slot_size + (uint32_t)n > param_slot_alloc) {
+		new_alloc = param_slot_alloc == 0 ? 1024 : param_slot_alloc;
+		while (new_alloc < param_slot_size + (uint32_t)n)
+			new_alloc *= 2;
+		new_slot = realloc(param_slot,
+				   sizeof(struct param_slot) * new_alloc);
+		if (new_slot == NULL) {
+			log_memory();
+			return false;
+		}
+		param_slot = new_slot;
+		param_slot_alloc = (uint32_t)new_alloc;
+	}
+
+	/* 文字列をプールに追加する */
+	text = add_pool_string(parsed.text != NULL ? parsed.text : "");
+	if (text == PARAM_NULL)
+		return false;
+	top = param_slot_size;
+	for (i = 0; i < n; i++) {
+		slot = &param_slot[top + (uint32_t)i];
+		slot->value = 0;
+		if (parsed.param[i] == NULL) {
+			slot->ofs = PARAM_NULL;
+			continue;
+		}
+		slot->ofs = add_pool_string(parsed.param[i]);
+		if (slot->ofs == PARAM_NULL)
+			return false;
+
+		/* 数値のパラメータを変換しておく */
+		switch (param_kind[parsed.type][i]) {
+		case PARAM_KIND_INT:
+			slot->value = (int32_t)atoi(parsed.param[i]);
+			break;
+		case PARAM_KIND_FLOAT:
+			f = (float)atof(parsed.param[i]);
+			memcpy(&slot->value, &f, sizeof(float));
+			break;
+		}
+	}
+	param_slot_size += (uint32_t)n;
+
+	/* コマンドを設定する */
+	cmd[index].type = parsed.type;
+	cmd[index].line = parsed.line;
+	cmd[index].text = text;
+	cmd[index].param_top = top;
+	cmd[index].param_count = (uint32_t)n;
+	memcpy(cmd[index].locale, parsed.locale, sizeof(parsed.locale));
+	cmd[index].locale[3] = '\0';
+	if (index == cmd_size)
+		cmd_size++;
+
+	clear_parsed_command();
+	return true;
+}
+
+/* 文字列プールに文字列を追加してオフセットを返す(失敗時はPARAM_NULL) */
+static uint32_t add_pool_string(const char *s)
+{
+	char *new_pool;
+	size_t len, new_alloc;
+	uint32_t ofs;
+
+	len = strlen(s) + 1;
+	if (len >= PARAM_NULL - pool_size) {
+		log_memory();
+		return PARAM_NULL;
+	}
+
+	/* 足りなければ倍に拡張する */
+	if (pool_size + len > pool_alloc) {
+		new_alloc = pool_alloc == 0 ? 65536 : pool_alloc;
+		while (new_alloc < pool_size + len)
+			new_alloc = new_alloc >= PARAM_NULL / 2 ?
+				PARAM_NULL : new_alloc * 2;
+		new_pool = realloc(pool, new_alloc);
+		if (new_pool == NULL) {
+			log_memory();
+			return PARAM_NULL;
+		}
+		pool = new_pool;
+		pool_alloc = (uint32_t)new_alloc;
+	}
+
+	ofs = pool_size;
+	memcpy(pool + ofs, s, len);
+	pool_size += (uint32_t)len;
+	return ofs;
+}
+
+/* パース中のコマンドを破棄する */
+static void clear_parsed_command(void)
+{
+	int i;
+
+	/* 行の内容と引数の本体を解放する */
+	free(parsed.text);
+	free(parsed.param[0]);
+	parsed.text = NULL;
+	for (i = 0; i < PARAM_SIZE; i++)
+		parsed.param[i] = NULL;
+
+	parsed.type = COMMAND_MIN;
+	parsed.line = 0;
+	parsed.locale[0] = '\0';
+}
+
+/* 読み込みが終わったら余分に確保した領域を縮める */
+static void shrink_command_array(void)
+{
+	void *p;
+
+	if (cmd_alloc > cmd_size && cmd_size > 0) {
+		p = realloc(cmd, sizeof(struct command) * (size_t)cmd_size);
+		if (p != NULL) {
+			cmd = p;
+			cmd_alloc = cmd_size;
+		}
+	}
+	if (param_slot_alloc > param_slot_size && param_slot_size > 0) {
+		p = realloc(param_slot,
+			    sizeof(struct param_slot) * param_slot_size);
+		if (p != NULL) {
+			param_slot = p;
+			param_slot_alloc = param_slot_size;
+		}
+	}
+	if (pool_alloc > pool_size && pool_size > 0) {
+		p = realloc(pool, pool_size);
+		if (p != NULL) {
+			pool = p;
+			pool_alloc = pool_size;
+		}
+	}
+}
+
+/* コマンドのパラメータを取得する(省略された場合はNULL) */
+static const char *get_param(int index, int param_index)
+{
+	const struct param_slot *slot;
+
+	slot = get_param_slot(index, param_index);
+	if (slot == NULL)
+		return NULL;
+
+	return pool + slot->ofs;
+}
+
+/* コマンドのパラメータ表の要素を取得する(省略された場合はNULL) */
+static const struct param_slot *get_param_slot(int index, int param_index)
+{
+	const struct command *c;
+	const struct param_slot *slot;
+
+	c = &cmd[index];
+	if ((uint32_t)param_index >= c->param_count)
+		return NULL;
+
+	slot = &param_slot[c->param_top + (uint32_t)param_index];
+	if (slot->ofs == PARAM_NULL)
+		return NULL;
+
+	return slot;
+}
+
+/*
+ * 数値のパラメータ
+ */
+
+/* コマンドのタイプとパラメータのインデックスごとの種類の表を作成する */
+static void init_param_kind(void)
+{
+	const struct numeric_param_item *item;
+	int i, j, index;
+
+	if (is_param_kind_initialized)
+		return;
+
+	for (i = 0; i < (int)NUMERIC_PARAM_TBL_SIZE; i++) {
+		item = &numeric_param_tbl[i];
+		for (j = 0; j < item->count; j++) {
+			index = item->param_index + item->stride * j;
+			assert(index < PARAM_SIZE);
+			param_kind[item->type][index] =
+				(unsigned char)item->kind;
+		}
+	}
+
+	is_param_kind_initialized = true;
+}
+
+/*
+ * 数値のパラメータとして正しいかチェックする
+ *  - 空文字列は省略とみなして0にする(使わないボタンの座標など)
+ */
+static bool is_valid_number(const char *s, int kind)
+{
+	char *end;
+
+	if (*s == '\0')
+		return true;
+
+	switch (kind) {
+	case PARAM_KIND_INT:
+		(void)strtol(s, &end, 10);
+		break;
+	case PARAM_KIND_FLOAT:
+		(void)strtod(s, &end);
+		break;
+	default:
+		return true;
+	}
+
+	/* 数値の後ろに文字が続く場合はエラーとする */
+	return end != s && *end == '\0';
+}
+
 #ifdef USE_DEBUGGER
 /*
  * スタートアップファイル/ラインを指定する
@@ -1317,7 +2710,7 @@ const char *get_line_string_at_line_num(int line)
 	/* コマンドを探す */
 	for (i = 0; i < cmd_size; i++) {
 		if (cmd[i].line == line)
-			return cmd[i].text;
+			return pool + cmd[i].text;
 		if (cmd[i].line > line)
 			break;
 	}
@@ -1333,46 +2726,37 @@ bool update_command(int index, const char *cmd_str)
 {
 	int line;
 	int top;
+	bool result;
 
 	/* メッセージに変換されるメッセージボックスを表示するようにする */
 	error_count = 0;
 
-	/* コマンドのメモリを解放する */
-	if (cmd[index].text != NULL) {
-		free(cmd[index].text);
-		cmd[index].text = NULL;
-	}
-	if (cmd[index].param[0] != NULL) {
-		free(cmd[index].param[0]);
-		cmd[index].param[0] = NULL;
-	}
+	/* 書き換え前の文字列はスクリプトの破棄までプールに残る */
+	clear_parsed_command();
 
 	/* ロケールを処理する */
 	top = 0;
 	if (strlen(cmd_str) > 4 && cmd_str[0] == '+' && cmd_str[3] == '+') {
-		cmd[index].locale[0] = cmd_str[1];
-		cmd[index].locale[1] = cmd_str[2];
-		cmd[index].locale[2] = '\0';
+		parsed.locale[0] = cmd_str[1];
+		parsed.locale[1] = cmd_str[2];
+		parsed.locale[2] = '\0';
 		top = 4;
 	} else {
-		cmd[index].locale[0] = '\0';
+		parsed.locale[0] = '\0';
 	}
 
 	/* 行頭の文字で仕分けする */
 	line = cmd[index].line;
 	switch (cmd_str[4]) {
 	case '@':
-		if (!parse_insn(index, cur_script, line, cmd_str, top))
-			return false;
-		return true;
+		result = parse_insn(cur_script, line, cmd_str, top);
+		break;
 	case '*':
-		if (!parse_serif(index, cur_script, line, cmd_str, top))
-			return false;
-		return true;
+		result = parse_serif(cur_script, line, cmd_str, top);
+		break;
 	case ':':
-		if (!parse_label(index, cur_script, line, cmd_str, top))
-			return false;
-		return true;
+		result = parse_label(cur_script, line, cmd_str, top);
+		break;
 	case '\0':
 		/* 空行は空白1つに変換する */
 		cmd_str = " ";
@@ -1381,27 +2765,43 @@ bool update_command(int index, const char *cmd_str)
 		/* コメントもメッセージにする */
 		/* fall-thru */
 	default:
-		if (!parse_message(index, cur_script, line, cmd_str, top))
+		result = parse_message(cur_script, line, cmd_str, top);
+		break;
+	}
+
+	/* パースエラーの場合もエラー表示用のメッセージとして格納する */
+	if (result || is_parse_error) {
+		is_parse_error = false;
+		if (!store_command(index))
+			return false;
+
+		/* ラベルが変わったかもしれないので作り直す */
+		if (!build_label_index())
 			return false;
-		return true;
 	}
-	return true;
+	clear_parsed_command();
+	return result;
 }
 
 /*
  * エラー時のコマンドを設定する
+ *  - textはこの関数で解放する
  */
 void set_error_command(int index, char *text)
 {
-	if (cmd[index].text != text)
-		if (cmd[index].text != NULL)
-			free(cmd[index].text);
-	if (cmd[index].param[0] != NULL)
-		free(cmd[index].param[0]);
+	uint32_t ofs;
+
+	ofs = add_pool_string(text);
+	free(text);
+	if (ofs == PARAM_NULL)
+		return;
 
 	cmd[index].type = COMMAND_MESSAGE;
-	cmd[index].text = text;
-	cmd[index].param[0] = NULL;
+	cmd[index].text = ofs;
+	cmd[index].param_count = 0;
+
+	/* ラベルだった場合のためにハッシュ表を作り直す */
+	build_label_index();
 }
 
 /*
@@ -1410,6 +2810,7 @@ void set_error_command(int index, char *text)
 bool load_debug_script(void)
 {
 	cleanup_script();
+	init_param_kind();
 
 	cur_script = strdup("DEBUG");
 	if (cur_script == NULL) {
@@ -1419,22 +2820,29 @@ bool load_debug_script(void)
 	}
 
 	cur_index = 0;
-	cmd_size = 1;
 	script_lines = 1;
 
-	cmd[0].type = COMMAND_MESSAGE;
-	cmd[0].line = 0;
-	cmd[0].text = strdup(conf_locale == LOCALE_JA ?
+	parsed.type = COMMAND_MESSAGE;
+	parsed.line = 0;
+	parsed.text = strdup(conf_locale == LOCALE_JA ?
 			     /* "実行を終了しました" (utf-8) */
 			     "\xe5\xae\x9f\xe8\xa1\x8c\xe3\x82\x92\xe7\xb5\x82"
 			     "\xe4\xba\x86\xe3\x81\x97\xe3\x81\xbe\xe3\x81\x97"
 			     "\xe3\x81\x9f" :
 			     "Execution finished.");
-	if (cmd[0].text == NULL) {
+	if (parsed.text == NULL) {
 		log_memory();
 		cleanup_script();
 		return false;
 	}
+	if (!store_command(0)) {
+		cleanup_script();
+		return false;
+	}
+	if (!build_label_index()) {
+		cleanup_script();
+		return false;
+	}
 
 	update_debug_info(true);
 	return true;
@@ -563,6 +563,14 @@ bool load_script(const char *fname);
 /* スクリプトファイル名を取得する */
 const char *get_script_file_name(void);
 
+#ifndef USE_DEBUGGER
+/* 常駐させるスクリプトの数を取得する(現在のスクリプトを含む) */
+int get_script_resident_count(void);
+
+/* 常駐させるスクリプトの合計サイズの上限(KB)を取得する */
+int get_script_resident_size(void);
+#endif
+
 /* 実行中のコマンドのインデックスを取得する(セーブ用) */
 int get_command_index(void);
 
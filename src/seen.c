@@ -8,13 +8,27 @@
 /*
  * [Changes]
  *  - 2021/07/31 作成
+ *  - 2026/10/19 複数のスクリプトの既読フラグを保持するようにした
  */
 
 #include "suika.h"
 
-/* 既読フラグ */
 #ifndef USE_DEBUGGER
-static bool seen_flag[SCRIPT_CMD_SIZE];
+/*
+ * 既読フラグ
+ *  - 常駐しているスクリプトと同じ数だけ保持する
+ *  - 先頭が現在のスクリプトの既読フラグで、以降は最近使った順
+ */
+struct seen_entry {
+	char *script;
+	bool *flag;
+	bool dirty;
+};
+static struct seen_entry *seen;
+static int seen_count;
+
+/* 現在のスクリプトの既読フラグ */
+#define seen_flag	(seen[0].flag)
 #endif
 
 /* 初期化済みか */
@@ -22,6 +36,10 @@ static bool is_initialized;
 
 /* 前方参照 */
 #ifndef USE_DEBUGGER
+static bool find_seen_entry(const char *script);
+static bool add_seen_entry(const char *script);
+static bool write_seen_entry(struct seen_entry *e);
+static void free_seen_entry(struct seen_entry *e);
 static const char *hash(const char *file);
 static char hex(int c);
 #endif
@@ -44,9 +62,22 @@ bool init_seen(void)
  */
 void cleanup_seen(void)
 {
+#ifndef USE_DEBUGGER
+	int i;
+#endif
+
 	if (is_initialized) {
-		/* 既読フラグをセーブする */
-		save_seen();
+#ifndef USE_DEBUGGER
+		/* 変更された既読フラグをセーブして破棄する */
+		for (i = 0; i < seen_count; i++) {
+			if (seen[i].dirty)
+				write_seen_entry(&seen[i]);
+			free_seen_entry(&seen[i]);
+		}
+		free(seen);
+		seen = NULL;
+		seen_count = 0;
+#endif
 
 		is_initialized = false;
 	}
@@ -64,8 +95,13 @@ bool load_seen(void)
 	const char *fname;
 	bool success;
 
-	/* 読み込む前に全部未読にする */
-	memset(seen_flag, 0, sizeof(seen_flag));
+	/* 保持している既読フラグであれば先頭に移動する */
+	if (find_seen_entry(get_script_file_name()))
+		return true;
+
+	/* 既読フラグを先頭に追加する */
+	if (!add_seen_entry(get_script_file_name()))
+		return false;
 
 	/* ファイル名を求める */
 	fname = hash(get_script_file_name());
@@ -78,8 +114,8 @@ bool load_seen(void)
 	success = false;
 	do {
 		/* 既読フラグを読み込む */
-		if (read_rfile(rf, &seen_flag, sizeof(seen_flag)) <
-		    sizeof(seen_flag))
+		if (read_rfile(rf, seen_flag, sizeof(bool) * SCRIPT_CMD_SIZE) <
+		    sizeof(bool) * SCRIPT_CMD_SIZE)
 			break;
 
 		/* 成功 */
@@ -91,7 +127,7 @@ bool load_seen(void)
 
 	/* 読み込みに失敗した場合全部未読にする */
 	if (!success)
-		memset(seen_flag, 0, sizeof(seen_flag));
+		memset(seen_flag, 0, sizeof(bool) * SCRIPT_CMD_SIZE);
 
 	return success;
 #endif
@@ -105,36 +141,14 @@ bool save_seen(void)
 #ifdef USE_DEBUGGER
 	return true;
 #else
-	struct wfile *wf;
-	const char *fname;
-	bool success;
-
-	/* セーブディレクトリを作成する */
-	make_sav_dir();
-
-	/* ファイル名を求める */
-	fname = hash(get_script_file_name());
-
-	/* ファイルを開く */
-	wf = open_wfile(SAVE_DIR, fname);
-	if (wf == NULL)
+	if (seen_count == 0)
 		return false;
 
-	success = false;
-	do {
-		/* 既読フラグを書き込む */
-		if (write_wfile(wf, &seen_flag, sizeof(seen_flag)) <
-		    sizeof(seen_flag))
-			break;
-
-		/* 成功 */
-		success = true;
-	} while (0);
-
-	/* ファイルをクローズする */
-	close_wfile(wf);
+	/* 変更されていなければ書き込まない */
+	if (!seen[0].dirty)
+		return true;
 
-	return success;
+	return write_seen_entry(&seen[0]);
 #endif
 }
 
@@ -148,6 +162,9 @@ bool get_seen(void)
 #else
 	int index;
 
+	if (seen_count == 0)
+		return false;
+
 	index = get_command_index();
 	assert(index >= 0 && index < SCRIPT_CMD_SIZE);
 
@@ -163,14 +180,127 @@ void set_seen(void)
 #ifndef USE_DEBUGGER
 	int index;
 
+	if (seen_count == 0)
+		return;
+
 	index = get_command_index();
 	assert(index >= 0 && index < SCRIPT_CMD_SIZE);
 
-	seen_flag[index] = true;
+	if (!seen_flag[index]) {
+		seen_flag[index] = true;
+		seen[0].dirty = true;
+	}
 #endif
 }
 
 #ifndef USE_DEBUGGER
+/* 保持している既読フラグを探して先頭に移動する */
+static bool find_seen_entry(const char *script)
+{
+	struct seen_entry e;
+	int i;
+
+	for (i = 0; i < seen_count; i++) {
+		if (strcmp(seen[i].script, script) != 0)
+			continue;
+
+		/* 先頭に移動する */
+		e = seen[i];
+		memmove(&seen[1], &seen[0],
+			sizeof(struct seen_entry) * (size_t)i);
+		seen[0] = e;
+		return true;
+	}
+	return false;
+}
+
+/* 未読の既読フラグを先頭に追加する */
+static bool add_seen_entry(const char *script)
+{
+	struct seen_entry e;
+	int max;
+
+	/* 配列を確保する */
+	max = get_script_resident_count();
+	if (seen == NULL) {
+		seen = malloc(sizeof(struct seen_entry) * (size_t)max);
+		if (seen == NULL) {
+			log_memory();
+			return false;
+		}
+	}
+
+	/* 最も前に使った既読フラグを追い出す */
+	if (seen_count == max) {
+		if (seen[seen_count - 1].dirty)
+			write_seen_entry(&seen[seen_count - 1]);
+		free_seen_entry(&seen[seen_count - 1]);
+		seen_count--;
+	}
+
+	/* 既読フラグを確保する */
+	e.script = strdup(script);
+	e.flag = calloc(SCRIPT_CMD_SIZE, sizeof(bool));
+	e.dirty = false;
+	if (e.script == NULL || e.flag == NULL) {
+		log_memory();
+		free_seen_entry(&e);
+		return false;
+	}
+
+	/* 先頭に挿入する */
+	memmove(&seen[1], &seen[0],
+		sizeof(struct seen_entry) * (size_t)seen_count);
+	seen[0] = e;
+	seen_count++;
+	return true;
+}
+
+/* 既読フラグをセーブする */
+static bool write_seen_entry(struct seen_entry *e)
+{
+	struct wfile *wf;
+	const char *fname;
+	bool success;
+
+	/* セーブディレクトリを作成する */
+	make_sav_dir();
+
+	/* ファイル名を求める */
+	fname = hash(e->script);
+
+	/* ファイルを開く */
+	wf = open_wfile(SAVE_DIR, fname);
+	if (wf == NULL)
+		return false;
+
+	success = false;
+	do {
+		/* 既読フラグを書き込む */
+		if (write_wfile(wf, e->flag, sizeof(bool) * SCRIPT_CMD_SIZE) <
+		    sizeof(bool) * SCRIPT_CMD_SIZE)
+			break;
+
+		/* 成功 */
+		e->dirty = false;
+		success = true;
+	} while (0);
+
+	/* ファイルをクローズする */
+	close_wfile(wf);
+
+	return success;
+}
+
+/* 既読フラグを破棄する */
+static void free_seen_entry(struct seen_entry *e)
+{
+	free(e->script);
+	free(e->flag);
+	e->script = NULL;
+	e->flag = NULL;
+}
+
 /* スクリプトファイル名からハッシュを求める */
 static const char *hash(const char *file)
 {
@@ -24,6 +24,11 @@
  *  - 2022-07-16 システムメニューを追加
  *  - 2022-10-20 キャラ顔絵を追加
  *  - 2023-01-06 日本語の指定に対応
+ *  - 2026-10-19 デコード済みイメージのキャッシュに対応
+ *  - 2026-10-19 初期化時の画像を並列にデコードする
+ *  - 2026-10-19 低メモリモードで背景とフェード用のレイヤをRGB565形式にする
+ *  - 2026-10-19 フェード用のレイヤを使用時に作成し、使わなくなったら解放する
+ *  - 2026-10-19 イメージの所有者の種類を設定する
  */
 
 #include "suika.h"
@@ -215,6 +220,16 @@ static int layer_anime_alpha_to[STAGE_LAYERS];
 static int shake_offset_x;
 static int shake_offset_y;
 
+/*
+ * フェード用のレイヤ
+ */
+
+/* FO/FIレイヤを使うコマンドが実行中であるか */
+static bool is_fade_layer_cmd_running;
+
+/* FO/FIレイヤを最後に使用した時刻 */
+static stop_watch_t fade_layer_sw;
+
 /*
  * GUIモード
  */
@@ -226,6 +241,7 @@ static struct image *gui_active_image;
 /*
  * 前方参照
  */
+static void preload_stage_images(void);
 static bool setup_namebox(void);
 static bool setup_msgbox(void);
 static bool setup_click(void);
@@ -235,6 +251,9 @@ static bool setup_sysmenu(void);
 static bool setup_banner(void);
 static bool setup_thumb(void);
 static bool create_fade_layer_images(void);
+static bool is_fade_layer_in_use(void);
+static struct image *create_screen_image(void);
+static void pack_bg_image(struct image *img);
 static void destroy_layer_image(int layer);
 static void draw_stage_fi_fo_fade(int fade_method);
 static void draw_stage_fi_fo_fade_normal(void);
@@ -315,6 +334,9 @@ bool init_stage(void)
 		gui_active_image = NULL;
 	}
 
+	/* 以下で読み込む画像を並列にデコードしておく */
+	preload_stage_images();
+
 	/* 名前ボックスをセットアップする */
 	if (!setup_namebox())
 		return false;
@@ -352,9 +374,15 @@ bool init_stage(void)
 	if (layer_image[LAYER_BG] == NULL)
 		return false;
 
-	/* フェードイン・アウトレイヤのイメージを作成する */
-	if (!create_fade_layer_images())
-		return false;
+	/* 再初期化時はフェードイン・アウトレイヤのイメージを破棄する */
+	destroy_layer_image(LAYER_FO);
+	destroy_layer_image(LAYER_FI);
+
+	/* 指定された場合はフェードイン・アウトレイヤのイメージを作成しておく */
+	if (conf_image_fade_preallocate) {
+		if (!create_fade_layer_images())
+			return false;
+	}
 
 	/* ブレンドタイプを設定する */
 	layer_blend[LAYER_FO] = BLEND_NONE;
@@ -378,6 +406,51 @@ bool init_stage(void)
 	return true;
 }
 
+/*
+ * 初期化時に読み込む画像を並列にデコードしておく
+ *  - 各セットアップ処理ではキャッシュにヒットする
+ */
+static void preload_stage_images(void)
+{
+	const char *tbl[] = {
+		conf_namebox_file,
+		conf_msgbox_bg_file,
+		conf_msgbox_fg_file,
+		conf_click_file1,
+		conf_click_file2,
+		conf_click_file3,
+		conf_click_file4,
+		conf_click_file5,
+		conf_click_file6,
+		conf_switch_bg_file,
+		conf_switch_fg_file,
+		conf_news_bg_file,
+		conf_news_fg_file,
+		conf_sysmenu_idle_file,
+		conf_sysmenu_hover_file,
+		conf_sysmenu_disable_file,
+		conf_sysmenu_collapsed_idle_file,
+		conf_sysmenu_collapsed_hover_file,
+		conf_automode_banner_file,
+		conf_skipmode_banner_file,
+	};
+	const char *dir[sizeof(tbl) / sizeof(tbl[0])];
+	const char *file[sizeof(tbl) / sizeof(tbl[0])];
+	int i, count;
+
+	/* 指定されていないファイルを除く */
+	count = 0;
+	for (i = 0; i < (int)(sizeof(tbl) / sizeof(tbl[0])); i++) {
+		if (tbl[i] == NULL)
+			continue;
+		dir[count] = CG_DIR;
+		file[count] = tbl[i];
+		count++;
+	}
+
+	preload_images(dir, file, count);
+}
+
 /* 名前ボックスをセットアップする */
 static bool setup_namebox(void)
 {
@@ -403,6 +476,7 @@ static bool setup_namebox(void)
 					       get_image_height(namebox_image));
 	if (layer_image[LAYER_NAME] == NULL)
 		return false;
+	set_image_category(layer_image[LAYER_NAME], IMAGE_CATEGORY_LAYER);
 
 	/* 名前ボックスレイヤの配置を行う */
 	layer_x[LAYER_NAME] = conf_namebox_x;
@@ -458,6 +532,7 @@ static bool setup_msgbox(void)
 		get_image_height(msgbox_bg_image));
 	if (layer_image[LAYER_MSG] == NULL)
 		return false;
+	set_image_category(layer_image[LAYER_MSG], IMAGE_CATEGORY_LAYER);
 
 	/* メッセージボックスレイヤの配置を行う */
 	layer_x[LAYER_MSG] = conf_msgbox_x;
@@ -501,6 +576,8 @@ static bool setup_click(void)
 			click_image[i] = create_image(1, 1);
 			if (click_image[i] == NULL)
 				return false;
+			set_image_category(click_image[i],
+					   IMAGE_CATEGORY_LAYER);
 			lock_image(click_image[i]);
 			clear_image_color(click_image[i],
 					  make_pixel_slow(0, 0, 0, 0));
@@ -691,6 +768,7 @@ static bool setup_thumb(void)
 				   conf_save_data_thumb_height);
 	if (thumb_image == NULL)
 		return false;
+	set_image_category(thumb_image, IMAGE_CATEGORY_THUMB);
 
 	return true;
 }
@@ -703,9 +781,10 @@ struct image *create_initial_bg(void)
 	struct image *img;
 
 	/* 背景レイヤのイメージを作成する */
-	img = create_image(conf_window_width, conf_window_height);
+	img = create_screen_image();
 	if (img == NULL)
 		return NULL;
+	set_image_category(img, IMAGE_CATEGORY_LAYER);
 
 	/* 塗り潰す */
 	lock_image(img);
@@ -718,36 +797,140 @@ struct image *create_initial_bg(void)
 	return img;
 }
 
-/* レイヤのイメージを作成する */
+/* レイヤのイメージを作成する(作成済みのものはそのまま使う) */
 static bool create_fade_layer_images(void)
 {
-	/* 再初期化時に破棄する */
-	if (layer_image[LAYER_FO] != NULL)
-		destroy_image(layer_image[LAYER_FO]);
-	if (layer_image[LAYER_FI] != NULL)
-		destroy_image(layer_image[LAYER_FI]);
-
 	/* フェードアウトのレイヤのイメージを作成する */
-	layer_image[LAYER_FO] = create_image(conf_window_width,
-					     conf_window_height);
-	if (layer_image[LAYER_FO] == NULL)
-		return false;
+	if (layer_image[LAYER_FO] == NULL) {
+		layer_image[LAYER_FO] = create_screen_image();
+		if (layer_image[LAYER_FO] == NULL)
+			return false;
+		set_image_category(layer_image[LAYER_FO], IMAGE_CATEGORY_FADE);
+		if (is_gpu_accelerated()) {
+			/* 時間のかかるGPUテクスチャ生成を先に行っておく */
+			lock_image(layer_image[LAYER_FO]);
+			unlock_image(layer_image[LAYER_FO]);
+		}
+	}
 
 	/* フェードインのレイヤのイメージを作成する */
-	layer_image[LAYER_FI] = create_image(conf_window_width,
-					     conf_window_height);
-	if (layer_image[LAYER_FI] == NULL)
+	if (layer_image[LAYER_FI] == NULL) {
+		layer_image[LAYER_FI] = create_screen_image();
+		if (layer_image[LAYER_FI] == NULL)
+			return false;
+		set_image_category(layer_image[LAYER_FI], IMAGE_CATEGORY_FADE);
+		if (is_gpu_accelerated()) {
+			/* 時間のかかるGPUテクスチャ生成を先に行っておく */
+			lock_image(layer_image[LAYER_FI]);
+			unlock_image(layer_image[LAYER_FI]);
+		}
+	}
+
+	return true;
+}
+
+/*
+ * フェード用のレイヤのイメージを用意する
+ *  - FO/FIレイヤを使うコマンドは開始時に呼び出す
+ *  - 作成済みの場合は使用中であることを記録するだけ
+ */
+bool prepare_fade_layer_images(void)
+{
+	if (!create_fade_layer_images())
 		return false;
 
-	if (is_gpu_accelerated()) {
-		/* 時間のかかるGPUテクスチャ生成を先に行っておく */
-		lock_image(layer_image[LAYER_FO]);
-		unlock_image(layer_image[LAYER_FO]);
-		lock_image(layer_image[LAYER_FI]);
-		unlock_image(layer_image[LAYER_FI]);
+	is_fade_layer_cmd_running = true;
+	reset_stop_watch(&fade_layer_sw);
+	return true;
+}
+
+/*
+ * フェード用のレイヤが使用中であるか調べる
+ *  - prepare_fade_layer_images()を呼んだコマンドの繰り返し動作中と、
+ *    フェードと画面揺らしの最中は使用中とする
+ */
+static bool is_fade_layer_in_use(void)
+{
+	/* コマンドが終了していれば、以降は次のprepareまで使われない */
+	if (!is_in_command_repetition())
+		is_fade_layer_cmd_running = false;
+
+	return is_fade_layer_cmd_running || stage_mode != STAGE_MODE_IDLE;
+}
+
+/*
+ * しばらく使われていないフェード用のレイヤのイメージを解放する
+ *  - 毎フレーム呼び出す
+ */
+void release_idle_fade_layer_images(void)
+{
+	/* 事前に作成する場合と、解放しない設定の場合 */
+	if (conf_image_fade_preallocate || conf_image_fade_release <= 0)
+		return;
+
+	/* 作成されていない場合 */
+	if (layer_image[LAYER_FO] == NULL && layer_image[LAYER_FI] == NULL)
+		return;
+
+	/* 使用中の場合は時刻を更新する */
+	if (is_fade_layer_in_use()) {
+		reset_stop_watch(&fade_layer_sw);
+		return;
 	}
 
-	return true;
+	/* 指定された時間が経過していない場合 */
+	if (get_stop_watch_lap(&fade_layer_sw) < conf_image_fade_release)
+		return;
+
+	release_fade_layer_images();
+}
+
+/*
+ * フェード用のレイヤのイメージを解放する
+ *  - メモリが不足したときに呼び出してもよい
+ *  - 使用中の場合は何もしない(次回の使用時に再び作成される)
+ */
+void release_fade_layer_images(void)
+{
+	if (conf_image_fade_preallocate)
+		return;
+	if (is_fade_layer_in_use())
+		return;
+
+	destroy_layer_image(LAYER_FO);
+	destroy_layer_image(LAYER_FI);
+}
+
+/*
+ * 画面サイズの不透明なイメージを作成する
+ *  - 低メモリモードではRGB565形式にする
+ */
+static struct image *create_screen_image(void)
+{
+	if (conf_image_lowmem)
+		return create_image_rgb565(conf_window_width,
+					   conf_window_height);
+
+	return create_image(conf_window_width, conf_window_height);
+}
+
+/*
+ * 低メモリモードでは不透明な背景イメージをRGB565形式に変換する
+ *  - キャッシュと共有されているイメージも変換し、キャッシュの使用量を
+ *    変換後のサイズにする
+ *  - 変換できない場合はそのまま使う
+ */
+static void pack_bg_image(struct image *img)
+{
+	if (!conf_image_lowmem)
+		return;
+	if (get_image_alpha_type(img) != IMAGE_ALPHA_OPAQUE)
+		return;
+
+	if (is_image_rgb565(img))
+		return;
+	if (pack_image_rgb565(img))
+		update_image_cache_bytes(img);
 }
 
 /*
@@ -851,6 +1034,9 @@ void cleanup_stage(void)
 		destroy_image(gui_active_image);
 		gui_active_image = NULL;
 	}
+
+	/* デコード済みイメージのキャッシュを空にする */
+	cleanup_image_cache();
 }
 
 /*
@@ -2538,6 +2724,8 @@ void change_bg_immediately(struct image *img)
 {
 	assert(img != NULL);
 
+	set_image_category(img, IMAGE_CATEGORY_LAYER);
+	pack_bg_image(img);
 	destroy_layer_image(LAYER_BG);
 	layer_image[LAYER_BG] = img;
 }
@@ -2548,10 +2736,15 @@ void change_bg_immediately(struct image *img)
 void start_bg_fade(struct image *img)
 {
 	assert(stage_mode == STAGE_MODE_IDLE);
+	assert(layer_image[LAYER_FO] != NULL);
+	assert(layer_image[LAYER_FI] != NULL);
 
 	/* 背景フェードを有効にする */
 	stage_mode = STAGE_MODE_BG_FADE;
 
+	/* 背景を変換しておく(フェードイン用のレイヤへの描画にも用いる) */
+	pack_bg_image(img);
+
 	/* フェードアウト用のレイヤにステージを描画する */
 	lock_image(layer_image[LAYER_FO]);
 	draw_layer_image(layer_image[LAYER_FO], LAYER_BG);
@@ -2566,6 +2759,7 @@ void start_bg_fade(struct image *img)
 	unlock_image(layer_image[LAYER_FO]);
 
 	/* フェードイン用のレイヤにイメージをセットする */
+	set_image_category(img, IMAGE_CATEGORY_LAYER);
 	new_bg_img = img;
 
 	/* フェードイン用のレイヤに背景を描画する */
@@ -2695,6 +2889,8 @@ void change_ch_immediately(int pos, struct image *img, int x, int y, int alpha)
 
 	layer = pos_to_layer(pos);
 	destroy_layer_image(layer);
+	if (img != NULL)
+		set_image_category(img, IMAGE_CATEGORY_LAYER);
 	layer_image[layer] = img;
 	layer_x[layer] = x;
 	layer_y[layer] = y;
@@ -2725,6 +2921,8 @@ void start_ch_fade(int pos, struct image *img, int x, int y, int alpha)
 
 	assert(stage_mode == STAGE_MODE_IDLE);
 	assert(pos >= 0 && pos < CH_ALL_LAYERS);
+	assert(layer_image[LAYER_FO] != NULL);
+	assert(layer_image[LAYER_FI] != NULL);
 
 	stage_mode = STAGE_MODE_CH_FADE;
 
@@ -2740,6 +2938,8 @@ void start_ch_fade(int pos, struct image *img, int x, int y, int alpha)
 	/* キャラを入れ替える */
 	layer = pos_to_layer(pos);
 	destroy_layer_image(layer);
+	if (img != NULL)
+		set_image_category(img, IMAGE_CATEGORY_LAYER);
 	layer_image[layer] = img;
 	layer_alpha[layer] = alpha;
 	layer_x[layer] = x;
@@ -2783,6 +2983,8 @@ void start_ch_fade_multi(const bool *stay, struct image **img, const int *x,
 	int i, layer;
 
 	assert(stage_mode == STAGE_MODE_IDLE);
+	assert(layer_image[LAYER_FO] != NULL);
+	assert(layer_image[LAYER_FI] != NULL);
 
 	/* このフェードでもSTAGE_MODE_CH_FADEを利用する */
 	stage_mode = STAGE_MODE_CH_FADE;
@@ -2801,6 +3003,9 @@ void start_ch_fade_multi(const bool *stay, struct image **img, const int *x,
 		if (!stay[i]) {
 			layer = pos_to_layer(i);
 			destroy_layer_image(layer);
+			if (img[i] != NULL)
+				set_image_category(img[i],
+						   IMAGE_CATEGORY_LAYER);
 			layer_image[layer] = img[i];
 			layer_alpha[layer] = 255;
 			layer_x[layer] = x[i];
@@ -2810,7 +3015,11 @@ void start_ch_fade_multi(const bool *stay, struct image **img, const int *x,
 
 	/* 背景を入れ替える */
 	if (!stay[CH_BASIC_LAYERS]) {
+		pack_bg_image(img[CH_BASIC_LAYERS]);
 		destroy_layer_image(LAYER_BG);
+		if (img[CH_BASIC_LAYERS] != NULL)
+			set_image_category(img[CH_BASIC_LAYERS],
+					   IMAGE_CATEGORY_LAYER);
 		layer_image[LAYER_BG] = img[CH_BASIC_LAYERS];
 	}
 
@@ -2948,6 +3157,8 @@ void stop_ch_anime(void)
 void start_shake(void)
 {
 	assert(stage_mode == STAGE_MODE_IDLE);
+	assert(layer_image[LAYER_FO] != NULL);
+	assert(layer_image[LAYER_FI] != NULL);
 
 	stage_mode = STAGE_MODE_SHAKE;
 
@@ -3285,6 +3496,9 @@ void draw_news_fg_image(int x, int y)
  */
 void lock_draw_char_on_fo_fi(void)
 {
+	assert(layer_image[LAYER_FO] != NULL);
+	assert(layer_image[LAYER_FI] != NULL);
+
 	lock_image(layer_image[LAYER_FO]);
 	lock_image(layer_image[LAYER_FI]);
 }
@@ -3337,6 +3551,9 @@ void draw_image_on_fo_fi(int x, int y, struct image *img)
  */
 void lock_fo_fi_for_menu(void)
 {
+	assert(layer_image[LAYER_FO] != NULL);
+	assert(layer_image[LAYER_FI] != NULL);
+
 	lock_image(layer_image[LAYER_FO]);
 	lock_image(layer_image[LAYER_FI]);
 }
@@ -3387,9 +3604,10 @@ bool create_temporary_bg(void)
 	destroy_layer_image(LAYER_BG);
 
 	/* 背景のイメージを作成する */
-	img = create_image(conf_window_width, conf_window_height);
+	img = create_screen_image();
 	if (img == NULL)
 		return false;
+	set_image_category(img, IMAGE_CATEGORY_LAYER);
 
 	/* FOレイヤの中身をコピーする */
 	lock_image(img);
@@ -3672,6 +3890,7 @@ bool create_temporary_bg_for_gui(void)
 	img = create_image(conf_window_width, conf_window_height);
 	if (img == NULL)
 		return false;
+	set_image_category(img, IMAGE_CATEGORY_LAYER);
 
 	/* idleの中身をコピーする */
 	if (gui_idle_image != NULL) {
@@ -84,6 +84,15 @@ void cleanup_stage(void);
 /* 起動・ロード直後の一時的な背景を作成する */
 struct image *create_initial_bg(void);
 
+/* フェード用のレイヤのイメージを用意する(FO/FIレイヤを使う前に呼び出す) */
+bool prepare_fade_layer_images(void);
+
+/* しばらく使われていないフェード用のレイヤのイメージを解放する */
+void release_idle_fade_layer_images(void);
+
+/* 使用中でなければフェード用のレイヤのイメージを解放する */
+void release_fade_layer_images(void);
+
 /*
  * ステージ描画
  */
@@ -11,6 +11,7 @@
  *  2016-05-29 作成 (suika)
  *  2017-11-07 フルスクリーンで解像度変更するように修正
  *  2022-06-08 デバッガ対応
+ *  2026-10-19 パスの生成をワーカスレッドから呼べるようにした
  */
 
 #ifdef _MSC_VER
@@ -1529,11 +1530,11 @@ bool make_sav_dir(void)
 
 /*
  * データのディレクトリ名とファイル名を指定して有効なパスを取得する
+ *  - セーブデータ以外はワーカスレッドから呼び出されてもよい
  */
 char *make_valid_path(const char *dir, const char *fname)
 {
-	wchar_t *buf;
-	const char *result;
+	char *buf;
 	size_t len;
 
 	if (dir == NULL)
@@ -1552,19 +1553,21 @@ char *make_valid_path(const char *dir, const char *fname)
 
 	/* パスのメモリを確保する */
 	len = strlen(dir) + 1 + strlen(fname) + 1;
-	buf = malloc(sizeof(wchar_t) * len);
+	buf = malloc(len);
 	if (buf == NULL)
 		return NULL;
 
-	/* パスを生成する */
-	wcscpy(buf, conv_utf8_to_utf16(dir));
+	/*
+	 * パスを生成する
+	 *  - 静的バッファを使うconv_utf8_to_utf16()を経由せずにUTF-8のまま
+	 *    連結する
+	 */
+	strcpy(buf, dir);
 	if (strlen(dir) != 0)
-		wcscat(buf, L"\\");
-	wcscat(buf, conv_utf8_to_utf16(fname));
+		strcat(buf, "\\");
+	strcat(buf, fname);
 
-	result = conv_utf16_to_utf8(buf);
-	free(buf);
-	return strdup(result);
+	return buf;
 }
 
 /*